@@ -0,0 +1,426 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/batch.h"
+#include "include/capabilities.h"
+#include "include/exec.h"
+#include "include/ipc.h"
+#include "include/resource.h"
+#include "include/syscall.h"
+#include "include/unix.h"
+#include "logging.h"
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sstream>
+#include <sys/mount.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace bonding::batch
+{
+  std::expected<Job, error::Err> Job::of_line(
+    const std::string & line, const config::Batch_Options & defaults, const size_t index) noexcept
+  {
+    Job job = {
+      .id = std::to_string(index),
+      .command = {},
+      .timeout_ms = defaults.timeout_ms,
+      .overlay = defaults.overlay,
+      .reset_cgroups = defaults.reset_cgroups};
+
+    if (!line.starts_with("{"))
+      {
+        std::istringstream words(line);
+        for (std::string word; words >> word;)
+          job.command.push_back(word);
+      }
+    else
+      try
+        {
+          const nlohmann::json json = nlohmann::json::parse(line);
+          job.id = json.value("id", job.id);
+          job.timeout_ms = json.value("timeout_ms", job.timeout_ms);
+          job.overlay = json.value("overlay", job.overlay);
+          job.reset_cgroups = json.value("reset_cgroups", job.reset_cgroups);
+
+          if (json["command"].is_string())
+            {
+              std::istringstream words(json["command"].get<std::string>());
+              for (std::string word; words >> word;)
+                job.command.push_back(word);
+            }
+          else
+            job.command = json["command"].get<std::vector<std::string>>();
+        }
+      catch (const nlohmann::json::exception & e)
+        {
+          return std::unexpected(ERR_MSG(error::Code::Batch, e.what()));
+        }
+
+    if (job.command.empty())
+      return std::unexpected(
+        ERR_MSG(error::Code::Batch, "Job " + job.id + " has no command"));
+
+    return job;
+  }
+
+  std::expected<Job, error::Err> Job::of_json(const nlohmann::json & json) noexcept
+  {
+    try
+      {
+        return Job{
+          .id = json["id"],
+          .command = json["command"],
+          .timeout_ms = json["timeout_ms"],
+          .overlay = json["overlay"],
+          .reset_cgroups = json["reset_cgroups"]};
+      }
+    catch (const nlohmann::json::exception & e)
+      {
+        return std::unexpected(ERR_MSG(error::Code::Batch, e.what()));
+      }
+  }
+
+  nlohmann::json Job::to_json() const noexcept
+  {
+    return {
+      {"id", id},
+      {"command", command},
+      {"timeout_ms", timeout_ms},
+      {"overlay", overlay},
+      {"reset_cgroups", reset_cgroups}};
+  }
+
+  std::expected<void, error::Err>
+    Runner::enter_overlay(const config::Container_Options & options) noexcept
+  {
+    const std::string upper = SCRATCH + "/upper";
+    const std::string work = SCRATCH + "/work";
+    const std::string merged = SCRATCH + "/merged";
+    const std::string data = "lowerdir=/,upperdir=" + upper + ",workdir=" + work;
+    const std::string scratch =
+      "mode=0755"
+      + (0 == options.tmpfs.scratch ? "" : ",size=" + std::to_string(options.tmpfs.scratch));
+
+    /* The scratch is stacked on the root of the container, which is left untouched
+     * even when writable: "/.." crosses into the scratch, "/" still resolves below. */
+    if (-1 == unshare(CLONE_NEWNS)
+        || -1 == mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr)
+        || -1 == mount("tmpfs", "/", "tmpfs", 0, scratch.c_str()))
+      return std::unexpected(ERR_MSG(error::Code::Mounts, "Cannot mount the job scratch"));
+
+    for (const auto & dir : {upper, work, merged})
+      if (-1 == mkdir(dir.c_str(), 0755))
+        return std::unexpected(ERR_MSG(error::Code::Mounts, "Cannot create " + dir));
+
+    if (-1 == mount("overlay", merged.c_str(), "overlay", 0, data.c_str()))
+      return std::unexpected(ERR_MSG(error::Code::Mounts, "Cannot mount the job overlay"));
+
+    /* An overlay does not cross mount points, the additional mounts are bound again. */
+    for (const auto & [real_path, mount_path] : options.mounts)
+      {
+        const std::string source = "/" + mount_path;
+        const std::string target = merged + "/" + mount_path;
+        if (-1 == mount(source.c_str(), target.c_str(), nullptr, MS_BIND | MS_REC, nullptr))
+          return std::unexpected(
+            ERR_MSG(error::Code::Mounts, "Cannot mount " + source + " into the job overlay"));
+      }
+
+    if (-1 == chdir(merged.c_str()) || -1 == chroot(".") || -1 == chdir("/"))
+      return std::unexpected(ERR_MSG(error::Code::Mounts, "Cannot enter the job overlay"));
+
+    return {};
+  }
+
+  void Runner::exec_job(
+    const config::Container_Options & options,
+    const Job &                       job,
+    const int                         stdout_fd,
+    const int                         stderr_fd) noexcept
+  {
+    /* The whole job is killed on timeout, including what it started. */
+    setpgid(0, 0);
+    close(options.ipc.second);
+
+    if (job.overlay && !enter_overlay(options).has_value())
+      _exit(127);
+
+    /* The runner keeps its capabilities to mount the overlays, the job must not. */
+    capabilities::Capabilities::setup().value();
+    syscall::Syscall::setup().value();
+
+    int stdin_pipe[2] = {-1, -1};
+    if (-1 == pipe(stdin_pipe) || -1 == dup2(stdin_pipe[0], STDIN_FILENO)
+        || -1 == dup2(stdout_fd, STDOUT_FILENO) || -1 == dup2(stderr_fd, STDERR_FILENO))
+      _exit(127);
+
+    close(stdin_pipe[0]);
+    close(stdin_pipe[1]);
+
+    exec::Execve::search(job.command, exec::Execve::with_defaults(options.batch.env));
+    _exit(127);
+  }
+
+  void Runner::reap_orphans() noexcept
+  {
+    while (0 < waitpid(-1, nullptr, WNOHANG | __WALL))
+      ;
+  }
+
+  nlohmann::json
+    Runner::run(const config::Container_Options & options, const Job & job) noexcept
+  {
+    const auto start = std::chrono::steady_clock::now();
+
+    int out[2] = {-1, -1};
+    int err[2] = {-1, -1};
+    if (-1 == pipe2(out, O_CLOEXEC) || -1 == pipe2(err, O_CLOEXEC))
+      return {{"id", job.id}, {"error", "Cannot create the output pipes"}};
+
+    const pid_t pid = fork();
+    if (0 == pid)
+      exec_job(options, job, out[1], err[1]);
+
+    close(out[1]);
+    close(err[1]);
+
+    if (-1 == pid)
+      {
+        close(out[0]);
+        close(err[0]);
+        return {{"id", job.id}, {"error", "Cannot fork the job process"}};
+      }
+
+    const int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (-1 != timer && job.timeout_ms > 0)
+      {
+        itimerspec deadline = {};
+        deadline.it_value.tv_sec = job.timeout_ms / 1000;
+        deadline.it_value.tv_nsec = (job.timeout_ms % 1000) * 1000000;
+        timerfd_settime(timer, 0, &deadline, nullptr);
+      }
+
+    std::string output[2];
+    bool        truncated = false;
+    bool        timed_out = false;
+    pollfd      fds[3] = {
+      {.fd = out[0], .events = POLLIN, .revents = 0},
+      {.fd = err[0], .events = POLLIN, .revents = 0},
+      {.fd = timer, .events = POLLIN, .revents = 0}};
+
+    while (-1 != fds[0].fd || -1 != fds[1].fd)
+      {
+        if (-1 == poll(fds, 3, -1))
+          {
+            if (EINTR == errno)
+              continue;
+            break;
+          }
+
+        if (0 != (fds[2].revents & POLLIN))
+          {
+            uint64_t expirations = 0;
+            if (sizeof(expirations) == read(timer, &expirations, sizeof(expirations)))
+              {
+                LOG_WARNING << "Job " << job.id << " timed out, killing it";
+                kill(-pid, SIGKILL);
+                timed_out = true;
+              }
+            fds[2].fd = -1;
+          }
+
+        for (int i = 0; i < 2; ++i)
+          {
+            if (0 == (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+              continue;
+
+            char          buffer[16 * 1024];
+            const ssize_t n = read(fds[i].fd, buffer, sizeof(buffer));
+            if (n <= 0)
+              {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                continue;
+              }
+
+            /* Past the limit the output is still drained, so the job never blocks. */
+            const size_t room = options.batch.output_limit
+                                - std::min(options.batch.output_limit, output[i].size());
+            const size_t kept = std::min(room, static_cast<size_t>(n));
+            output[i].append(buffer, kept);
+            truncated = truncated || kept < static_cast<size_t>(n);
+          }
+      }
+
+    if (-1 != timer)
+      close(timer);
+
+    int    status = 0;
+    rusage usage = {};
+    wait4(pid, &status, __WALL, &usage);
+    reap_orphans();
+
+    const auto wall = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+
+    const auto ms = [](const timeval & tv) {
+      return static_cast<int64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+    };
+
+    return {
+      {"id", job.id},
+      {"exit_code", WIFEXITED(status) ? WEXITSTATUS(status) : -1},
+      {"signal", WIFSIGNALED(status) ? WTERMSIG(status) : 0},
+      {"timed_out", timed_out},
+      {"wall_ms", wall.count()},
+      {"rusage",
+       {{"user_ms", ms(usage.ru_utime)},
+        {"system_ms", ms(usage.ru_stime)},
+        {"max_rss_kb", usage.ru_maxrss},
+        {"minor_faults", usage.ru_minflt},
+        {"major_faults", usage.ru_majflt},
+        {"voluntary_switches", usage.ru_nvcsw},
+        {"involuntary_switches", usage.ru_nivcsw}}},
+      {"stdout", output[0]},
+      {"stderr", output[1]},
+      {"truncated", truncated}};
+  }
+
+  int Runner::serve(const config::Container_Options & options, const int socket) noexcept
+  {
+    LOG_INFO << "Serving batch jobs...✓";
+
+    for (;;)
+      {
+        const auto message = ipc::IPC::recv_string(socket);
+        if (!message.has_value() || message->empty())
+          break;
+
+        nlohmann::json result;
+        try
+          {
+            const auto job = Job::of_json(nlohmann::json::parse(*message));
+            result = job.has_value() ? run(options, *job)
+                                     : nlohmann::json{{"error", job.error().to_string()}};
+          }
+        catch (const nlohmann::json::exception & e)
+          {
+            result = {{"error", e.what()}};
+          }
+
+        /* The output of a job is not necessarily valid UTF-8. */
+        if (!ipc::IPC::send_string(
+               socket, result.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace))
+               .has_value())
+          return EXIT_FAILURE;
+      }
+
+    LOG_INFO << "Batch queue finished";
+    return EXIT_SUCCESS;
+  }
+
+  std::expected<std::pair<int, int>, error::Err>
+    Dispatcher::open_queue(const std::string & queue) noexcept
+  {
+    if (queue == "-")
+      return std::make_pair(STDIN_FILENO, STDOUT_FILENO);
+
+    struct stat info = {};
+    if (-1 == stat(queue.c_str(), &info))
+      return std::unexpected(ERR_MSG(error::Code::Batch, "Cannot find the queue " + queue));
+
+    if (!S_ISSOCK(info.st_mode))
+      return unix::Filesystem::Open(queue, O_RDONLY | O_CLOEXEC)
+        .transform([](const int fd) { return std::make_pair(fd, STDOUT_FILENO); })
+        .transform_error([&](const error::Err & e) {
+        return ERR_MSG(error::Code::Batch, "Cannot open the queue " + queue);
+      });
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (queue.size() >= sizeof(addr.sun_path))
+      return std::unexpected(ERR_MSG(error::Code::Batch, "Queue path too long: " + queue));
+
+    memcpy(addr.sun_path, queue.c_str(), queue.size());
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == fd)
+      return std::unexpected(ERR(error::Code::Socket));
+
+    if (-1 == connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)))
+      {
+        close(fd);
+        return std::unexpected(
+          ERR_MSG(error::Code::Batch, "Cannot connect to the queue " + queue));
+      }
+
+    return std::make_pair(fd, fd);
+  }
+
+  std::expected<void, error::Err>
+    Dispatcher::serve(const config::Container_Options & options, const int socket) noexcept
+  {
+    const auto [input, output] = open_queue(options.batch_queue).value();
+
+    FILE * queue = fdopen(input, "r");
+    if (nullptr == queue)
+      return std::unexpected(ERR(error::Code::Batch));
+
+    LOG_INFO << "Reading batch jobs from " << options.batch_queue << "...✓";
+
+    char *  line = nullptr;
+    size_t  capacity = 0;
+    size_t  index = 0;
+    ssize_t length = 0;
+    while (-1 != (length = getline(&line, &capacity, queue)))
+      {
+        std::string text(line, length);
+        while (!text.empty() && (text.back() == '\n' || text.back() == '\r'))
+          text.pop_back();
+
+        if (text.empty() || text.starts_with("#"))
+          continue;
+
+        nlohmann::json result;
+        if (const auto job = Job::of_line(text, options.batch, ++index); !job.has_value())
+          result = {{"id", std::to_string(index)}, {"error", job.error().to_string()}};
+        else
+          {
+            if (job->reset_cgroups)
+              resource::CgroupsV1::reset_counters(options).value();
+
+            ipc::IPC::send_string(socket, job->to_json().dump()).value();
+            result =
+              nlohmann::json::parse(ipc::IPC::recv_string(socket).value(), nullptr, false);
+            if (result.is_discarded())
+              result = {{"id", job->id}, {"error", "Invalid result from the runner"}};
+
+            result["cgroups"] = resource::CgroupsV1::read_counters(options);
+          }
+
+        unix::Filesystem::Write(
+          output, result.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) + "\n")
+          .value();
+      }
+
+    free(line);
+
+    /* Only the descriptors we opened are closed, not the standard ones. */
+    if (STDIN_FILENO == input)
+      clearerr(queue);
+    else
+      fclose(queue);
+
+    LOG_INFO << "Ran " << index << " batch jobs...✓";
+    return ipc::IPC::send_string(socket, "");
+  }
+} // namespace bonding::batch
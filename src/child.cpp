@@ -1,37 +1,56 @@
 /** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
 
 #include "include/child.h"
+#include "include/batch.h"
 #include "include/capabilities.h"
 #include "include/exec.h"
+#include "include/handoff.h"
 #include "include/hostname.h"
+#include "include/init.h"
 #include "logging.h"
 #include "include/mount.h"
 #include "include/namespace.h"
+#include "include/output.h"
 #include "include/syscall.h"
 
+#include <cerrno>
 #include <cstdio>
 #include <error.h>
+#include <fcntl.h>
 #include <sched.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 namespace bonding::child
 {
   std::expected<void, error::Err> Child::Process::setup_container_configurations() noexcept
   {
-    hostname::Hostname::setup(container_options->hostname).value();
-    mounts::Mount::setup(
-      container_options->mount_dir, container_options->hostname, container_options->mounts)
-      .value();
+    ns::Namespace::join(*container_options).value();
+
+    /* The UTS namespace may be shared with another container, keep its hostname. */
+    if (0 != (container_options->clone_flags & CLONE_NEWUTS))
+      hostname::Hostname::setup(container_options->hostname).value();
+    mounts::Mount::setup(*container_options).value();
+
+    /* The batch runner keeps its capabilities to give each job a fresh overlay,
+     * the jobs drop them and install the seccomp filter by themselves. */
+    const bool batch = !container_options->batch_queue.empty();
     ns::Namespace::setup(container_options->ipc.second, container_options->uid).value();
-    capabilities::Capabilities::setup().value();
-    syscall::Syscall::setup().value();
+
+    if (!batch)
+      {
+        capabilities::Capabilities::setup().value();
+        syscall::Syscall::setup().value();
+      }
 
     return {};
   }
 
   int Child::Process::_main(void *options) noexcept
   {
-    container_options = static_cast<config::Container_Options *>(options);
+    container_options = static_cast<const config::Container_Options *>(options);
+    logging::after_fork();
+    logging::set_phase("setup");
 
     setup_container_configurations()
       .transform([]() -> std::expected<void, error::Err> {
@@ -43,22 +62,82 @@ namespace bonding::child
       return err;
     }).value();
 
+    if (!container_options->batch_queue.empty())
+      return batch::Runner::serve(*container_options, container_options->ipc.second);
+
     int ret_code = 0;
 
-    if (!exec::Execve::call(container_options->path, container_options->argv).has_value())
+    logging::set_phase("exec");
+    output::Output::install(*container_options).value();
+    const auto env = handoff::Handoff::install(*container_options).value();
+    if (container_options->init)
+      return init::Init::run(*container_options, env);
+
+    if (!exec::Execve::call(*container_options, container_options->argv, env).has_value())
       ret_code = -1;
 
     return ret_code;
   }
 
   std::expected<pid_t, error::Err> Child::generate_child_process(
-    const config::Container_Options container_options) noexcept
+    const config::Container_Options & container_options) noexcept
+  {
+    /* The records of the supervisor are not left in the copy of the child. */
+    logging::flush();
+
+    if (!ns::Namespace::joins_pid(container_options))
+      return clone_child(container_options, 0);
+
+    /* The supervisor keeps creating threads, it cannot enter the pid namespace: a
+     * process forked for this enters it, and clones the child process as a child of
+     * the supervisor. */
+    int channel[2];
+    if (-1 == pipe2(channel, O_CLOEXEC))
+      return std::unexpected(ERR(error::Code::ChildProcess));
+
+    const pid_t intermediate = fork();
+    if (-1 == intermediate)
+      {
+        close(channel[0]);
+        close(channel[1]);
+        return std::unexpected(ERR(error::Code::ChildProcess));
+      }
+
+    if (0 == intermediate)
+      {
+        const pid_t child_pid =
+          ns::Namespace::enter_pid(container_options)
+            .and_then([&]() { return clone_child(container_options, CLONE_PARENT); })
+            .value_or(-1);
+
+        const bool sent = sizeof(child_pid) == write(channel[1], &child_pid, sizeof(child_pid));
+        _exit(sent ? EXIT_SUCCESS : EXIT_FAILURE);
+      }
+
+    close(channel[1]);
+    pid_t child_pid = -1;
+    if (sizeof(child_pid) != read(channel[0], &child_pid, sizeof(child_pid)))
+      child_pid = -1;
+    close(channel[0]);
+
+    while (-1 == waitpid(intermediate, nullptr, 0) && EINTR == errno)
+      ;
+
+    if (-1 == child_pid)
+      return std::unexpected(ERR_MSG(error::Code::ChildProcess,
+                                     "Cannot clone the child process in its pid namespace"));
+
+    return child_pid;
+  }
+
+  std::expected<pid_t, error::Err> Child::clone_child(
+    const config::Container_Options & container_options, const int flags) noexcept
   {
     const pid_t child_pid = clone(
       Process::_main,
       static_cast<char *>(Process::STACK) + Process::STACK_SIZE,
-      container_options.clone_flags,
-      (void *) &container_options);
+      container_options.clone_flags | flags,
+      const_cast<config::Container_Options *>(&container_options));
 
     if (-1 == child_pid)
       return std::unexpected(ERR(error::Code::ChildProcess));
@@ -66,7 +145,7 @@ namespace bonding::child
     return child_pid;
   }
 
-  std::expected<void, error::Err> Child::wait() const noexcept
+  std::expected<int, error::Err> Child::wait() const noexcept
   {
     LOG_DEBUG << "Waiting for child process " << m_pid << " finish...";
 
@@ -79,6 +158,6 @@ namespace bonding::child
     LOG_INFO << "Child process exit with code " << ((child_process_status >> 8) & 0xFF)
              << ", signal " << (child_process_status & 0x7F);
 
-    return {};
+    return child_process_status;
   }
 } // namespace bonding::child
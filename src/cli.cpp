@@ -4,6 +4,14 @@
 #include "include/bonding.hpp"
 #include "include/configfile.h"
 #include "include/container.h"
+#include "include/enter.h"
+#include "include/environment.h"
+#include "include/events.h"
+#include "include/gc.h"
+#include "include/id.h"
+#include "include/manifest.h"
+#include "include/oci.h"
+#include "include/store.h"
 #include "logging.h"
 #include "include/unix.h"
 #include <cstdlib>
@@ -42,6 +50,99 @@ namespace bonding::cli
         true)
       .value();
 
+    parser
+      .add(
+        "replace",
+        "Replace the running container of the current directory without downtime",
+        "replace",
+        false,
+        true)
+      .value();
+
+    parser
+      .add(
+        "container",
+        "Execute the command following -- inside a running container",
+        "exec",
+        false)
+      .value();
+
+    parser
+      .add(
+        "queue",
+        "Run every command of a queue (file, unix socket or -) in one sandbox",
+        "batch",
+        false)
+      .value();
+
+    parser
+      .add(
+        "manifest",
+        "Start every container of a manifest, in the order of their dependencies",
+        "up",
+        false)
+      .value();
+
+    parser
+      .add(
+        "layout",
+        "Import the image of a local OCI layout, run with \"mount_dir\": \"oci:<name>\"",
+        "import",
+        false)
+      .value();
+
+    parser.add("list", "List the containers of the current directory", "list", false, true)
+      .value();
+
+    parser
+      .add("inspect", "Show the record of a container, by name or id", "inspect", false)
+      .value();
+
+    parser
+      .add(
+        "events",
+        "Follow the lifecycle events of the containers of the current directory",
+        "events",
+        false,
+        true)
+      .value();
+
+    parser
+      .add(
+        "adopt",
+        "Watch the containers whose supervisor died, and clean up after them",
+        "adopt",
+        false,
+        true)
+      .value();
+
+    parser
+      .add(
+        "features",
+        "Report the kernel features bonding uses when they are available",
+        "features",
+        false,
+        true)
+      .value();
+
+    parser
+      .add(
+        "gc",
+        "Remove the cgroups and state directories leaked by crashed supervisors, and unmount "
+        "the unused images",
+        "gc",
+        false,
+        true)
+      .value();
+
+    parser
+      .add(
+        "name",
+        "The name of the container of run, replace or batch, or of the imported image",
+        "name",
+        false)
+      .value();
+
     parser.add("help", "show this message", "help", false, true).value();
 
     parser.add("version", "show the version of bonding", "version", false, true).value();
@@ -78,6 +179,12 @@ namespace bonding::cli
         if (parsed == "-h" || parsed == "--help")
           return std::unexpected(ERR(error::Code::Cli));
 
+        if (parsed == "--")
+          {
+            m_rest.assign(m_argv + i + 1, m_argv + m_argc);
+            break;
+          }
+
         int id = 0;
         if (const auto it = m_shorthands.find(parsed); it == m_shorthands.end())
           return std::unexpected(
@@ -118,6 +225,8 @@ namespace bonding::cli
     return true;
   }
 
+  const std::vector<std::string> & Parser::rest() const noexcept { return m_rest; }
+
   std::expected<void, error::Err> Parser::help() const noexcept
   {
     std::cerr << "Usage: " << m_argv[0] << " [help]";
@@ -242,6 +351,28 @@ namespace bonding::cli
       return init(parser);
     else if (parser.get<bool>("run").value())
       return run(parser);
+    else if (parser.get<bool>("replace").value())
+      return replace(parser);
+    else if (parser.parsed("container").value())
+      return exec(parser);
+    else if (parser.parsed("queue").value())
+      return batch(parser);
+    else if (parser.parsed("manifest").value())
+      return up(parser);
+    else if (parser.parsed("layout").value())
+      return import_layout(parser);
+    else if (parser.get<bool>("list").value())
+      return list(parser);
+    else if (parser.parsed("inspect").value())
+      return inspect(parser);
+    else if (parser.get<bool>("adopt").value())
+      return adopt(parser);
+    else if (parser.get<bool>("gc").value())
+      return gc(parser);
+    else if (parser.get<bool>("features").value())
+      return features(parser);
+    else if (parser.get<bool>("events").value())
+      return events(parser);
     else if (parser.get<bool>("version").value())
       return version(parser);
     else if (parser.get<bool>("help").value())
@@ -252,11 +383,141 @@ namespace bonding::cli
     return {};
   }
 
+  /** Read ./bonding.json, and name the container as given on the command line. */
+  static std::expected<config::Container_Options, error::Err>
+    read_options(const Parser & args) noexcept
+  {
+    config::Container_Options options =
+      configfile::Config_File::read("./bonding.json").value();
+
+    if (args.parsed("name").value())
+      {
+        options.name = args.get<std::string>("name").value();
+        if (!id::Id::valid_name(options.name))
+          return std::unexpected(
+            ERR_MSG(error::Code::Cli, "Invalid container name " + options.name));
+      }
+
+    return options;
+  }
+
   [[nodiscard]] std::expected<void, error::Err> run(const Parser & args) noexcept
   {
-    return container::Container::start(
-      configfile::Config_File::read("./bonding.json").value());
+    return container::Container::start(read_options(args).value());
+
+    return {};
+  }
+
+  [[nodiscard]] std::expected<void, error::Err> replace(const Parser & args) noexcept
+  {
+    return container::Container::replace(read_options(args).value());
+  }
+
+  [[nodiscard]] std::expected<void, error::Err> exec(const Parser & args) noexcept
+  {
+    if (args.rest().empty())
+      return std::unexpected(ERR_MSG(error::Code::Cli, "Missing the command after --"));
+
+    exit(enter::Enter::exec(args.get<std::string>("container").value(), args.rest()).value());
+  }
+
+  [[nodiscard]] std::expected<void, error::Err> batch(const Parser & args) noexcept
+  {
+    return container::Container::batch(
+      read_options(args).value(), args.get<std::string>("queue").value());
+  }
+
+  [[nodiscard]] std::expected<void, error::Err> up(const Parser & args) noexcept
+  {
+    return manifest::Launcher::up(
+      manifest::Manifest::read(args.get<std::string>("manifest").value()).value());
+  }
+
+  [[nodiscard]] std::expected<void, error::Err> import_layout(const Parser & args) noexcept
+  {
+    const std::string name =
+      args.parsed("name").value() ? args.get<std::string>("name").value() : "";
+
+    std::cout << oci::Importer::import(args.get<std::string>("layout").value(), name).value()
+              << std::endl;
+    return {};
+  }
+
+  [[nodiscard]] std::expected<void, error::Err> list(const Parser & args) noexcept
+  {
+    const auto entries = store::Store::open().value().list();
+
+    timespec now = {};
+    clock_gettime(CLOCK_REALTIME, &now);
+    const int64_t now_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+
+    printf("%-24s %-16s %-8s %-9s %s\n", "NAME", "ID", "PID", "STATUS", "UPTIME");
+    for (const auto & entry : entries)
+      printf(
+        "%-24s %-16s %-8d %-9s %lds\n",
+        entry.record.name,
+        entry.record.id,
+        entry.record.pid,
+        store::Store::Entry::to_string(entry.status),
+        static_cast<long>((now_ns - entry.record.started_at) / 1000000000LL));
+
+    return {};
+  }
+
+  [[nodiscard]] std::expected<void, error::Err> inspect(const Parser & args) noexcept
+  {
+    const std::string name = args.get<std::string>("inspect").value();
+    const auto        entry = store::Store::open().value().find(name);
+    if (!entry.has_value())
+      return std::unexpected(ERR_MSG(error::Code::Cli, "No container " + name));
+
+    nlohmann::json json = entry->record.to_json();
+    json["slot"] = entry->slot;
+    json["supervisor"] = entry->owner;
+    json["status"] = store::Store::Entry::to_string(entry->status);
+
+    std::cout << json.dump(4) << std::endl;
+    return {};
+  }
+
+  [[nodiscard]] std::expected<void, error::Err> events(const Parser & args) noexcept
+  {
+    auto subscriber = events::Subscriber::open().value();
+
+    for (uint64_t lost = 0;;)
+      {
+        const auto event = subscriber.next(std::chrono::milliseconds(1000));
+        if (lost != subscriber.lost())
+          {
+            LOG_WARNING << "Missed " << subscriber.lost() - lost << " events";
+            lost = subscriber.lost();
+          }
+
+        if (event.has_value())
+          std::cout << event->to_json().dump() << std::endl;
+      }
+
+    return {};
+  }
+
+  [[nodiscard]] std::expected<void, error::Err> adopt(const Parser & args) noexcept
+  {
+    /* A restarted supervisor first collects what the crash leaked before any record. */
+    gc::Collector::collect().value();
+    return store::Adopter::adopt();
+  }
+
+  [[nodiscard]] std::expected<void, error::Err> gc(const Parser & args) noexcept
+  {
+    return gc::Collector::collect();
+  }
+
+  [[nodiscard]] std::expected<void, error::Err> features(const Parser & args) noexcept
+  {
+    nlohmann::json report = environment::Features::get().to_json();
+    report["release"] = environment::Info::kernel.release;
 
+    std::cout << report.dump(2) << std::endl;
     return {};
   }
 
@@ -0,0 +1,320 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/configcache.h"
+#include "include/bonding.hpp"
+#include "logging.h"
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+namespace bonding::configfile
+{
+  namespace
+  {
+    /** Appends the fields to the blob. */
+    class Writer
+    {
+    public:
+      template <class T>
+        requires std::is_arithmetic_v<T>
+      void operator()(const T & value) noexcept
+      {
+        m_blob.append(reinterpret_cast<const char *>(&value), sizeof(value));
+      }
+
+      void operator()(const std::string & value) noexcept
+      {
+        (*this)(static_cast<uint32_t>(value.size()));
+        m_blob.append(value);
+      }
+
+      template <class T>
+      void operator()(const std::vector<T> & values) noexcept
+      {
+        (*this)(static_cast<uint32_t>(values.size()));
+        for (const auto & value : values)
+          (*this)(value);
+      }
+
+      void operator()(const std::pair<std::string, std::string> & value) noexcept
+      {
+        (*this)(value.first);
+        (*this)(value.second);
+      }
+
+      void operator()(const config::Namespace_Join & value) noexcept
+      {
+        (*this)(value.kind);
+        (*this)(value.flag);
+        (*this)(value.target);
+      }
+
+      void operator()(const config::CgroupsV1::Control::Setting & value) noexcept
+      {
+        (*this)(value.name);
+        (*this)(value.value);
+      }
+
+      void operator()(const config::CgroupsV1::Control & value) noexcept
+      {
+        (*this)(value.control);
+        (*this)(value.settings);
+      }
+
+      std::string & blob() noexcept { return m_blob; }
+
+    private:
+      std::string m_blob;
+    };
+
+    /** Reads the fields back from the mapped blob, every read is bounds checked. */
+    class Reader
+    {
+    public:
+      Reader(const char * data, const size_t size) : m_data(data), m_end(data + size) {}
+
+      template <class T>
+        requires std::is_arithmetic_v<T>
+      void operator()(T & value) noexcept
+      {
+        if (!take(sizeof(value)))
+          return;
+
+        memcpy(&value, m_data - sizeof(value), sizeof(value));
+      }
+
+      void operator()(std::string & value) noexcept
+      {
+        uint32_t size = 0;
+        (*this)(size);
+        if (take(size))
+          value.assign(m_data - size, size);
+      }
+
+      template <class T>
+      void operator()(std::vector<T> & values) noexcept
+      {
+        uint32_t count = 0;
+        (*this)(count);
+
+        /* Every element takes a byte at least, a corrupted count stops here. */
+        if (m_failed || count > static_cast<size_t>(m_end - m_data))
+          {
+            m_failed = true;
+            return;
+          }
+
+        std::vector<T> result;
+        result.reserve(count);
+        for (uint32_t i = 0; i < count && !m_failed; ++i)
+          result.push_back(read<T>());
+
+        values = std::move(result);
+      }
+
+      void operator()(std::pair<std::string, std::string> & value) noexcept
+      {
+        (*this)(value.first);
+        (*this)(value.second);
+      }
+
+      void operator()(config::Namespace_Join & value) noexcept
+      {
+        (*this)(value.kind);
+        (*this)(value.flag);
+        (*this)(value.target);
+      }
+
+      bool failed() const noexcept { return m_failed || m_data != m_end; }
+
+    private:
+      bool take(const size_t size) noexcept
+      {
+        if (m_failed || size > static_cast<size_t>(m_end - m_data))
+          {
+            m_failed = true;
+            return false;
+          }
+
+        m_data += size;
+        return true;
+      }
+
+      /** The settings and controls have const members, they are built in place. */
+      template <class T>
+      T read() noexcept
+      {
+        if constexpr (std::is_same_v<T, config::CgroupsV1::Control::Setting>)
+          {
+            std::string name;
+            std::string value;
+            (*this)(name);
+            (*this)(value);
+            return T{.name = std::move(name), .value = std::move(value)};
+          }
+        else if constexpr (std::is_same_v<T, config::CgroupsV1::Control>)
+          {
+            std::string                                      control;
+            std::vector<config::CgroupsV1::Control::Setting> settings;
+            (*this)(control);
+            (*this)(settings);
+            return T{.control = std::move(control), .settings = std::move(settings)};
+          }
+        else
+          {
+            T value{};
+            (*this)(value);
+            return value;
+          }
+      }
+
+    private:
+      const char * m_data;
+      const char * m_end;
+      bool         m_failed = false;
+    };
+
+    /** The single list of the compiled fields, shared by the writer and the reader. */
+    template <class Archive, class Options>
+    void fields(Archive & archive, Options & options) noexcept
+    {
+      archive(options.debug);
+      archive(options.path);
+      archive(options.mount_dir);
+      archive(options.uid);
+      archive(options.argv);
+      archive(options.hostname);
+      archive(options.mounts);
+      archive(options.idmapped);
+      archive(options.clone_flags);
+      archive(options.cgroups_options);
+      archive(options.listen);
+      archive(options.notify);
+      archive(options.ready_timeout);
+      archive(options.namespaces);
+      archive(options.batch.overlay);
+      archive(options.batch.reset_cgroups);
+      archive(options.batch.timeout_ms);
+      archive(options.batch.output_limit);
+      archive(options.batch.env);
+      archive(options.init);
+      archive(options.log.json);
+      archive(options.log.max_size);
+      archive(options.log.files);
+      archive(options.output.mode);
+      archive(options.output.path);
+      archive(options.output.max_size);
+      archive(options.output.files);
+      archive(options.output.drop);
+      archive(options.tmpfs.scratch);
+      archive(options.tmpfs.shm);
+      archive(options.tmpfs.huge_pages);
+      archive(options.prefetch);
+    }
+  } // namespace
+
+  uint64_t Config_Cache::hash_of(const std::string & content) noexcept
+  {
+    /* FNV-1a */
+    uint64_t   hash = 14695981039346656037ULL;
+    const auto feed = [&hash](const void * data, const size_t size) {
+      for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ static_cast<const uint8_t *>(data)[i]) * 1099511628211ULL;
+    };
+
+    feed(BONDING_VERSION.data(), BONDING_VERSION.size());
+    feed(&FORMAT, sizeof(FORMAT));
+    feed(content.data(), content.size());
+
+    return hash;
+  }
+
+  std::string Config_Cache::path_of(const uint64_t hash) noexcept
+  {
+    char name[32] = {0};
+    snprintf(name, sizeof(name), "config-%016lx.bin", hash);
+    return CACHE_DIR + name;
+  }
+
+  std::optional<config::Container_Options> Config_Cache::load(const uint64_t hash) noexcept
+  {
+    const std::string path = path_of(hash);
+
+    /* Missing is the common case of a new configuration, not an error. */
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 == fd)
+      return std::nullopt;
+
+    struct stat st = {};
+    void *      data = MAP_FAILED;
+    if (-1 != fstat(fd, &st) && static_cast<size_t>(st.st_size) >= sizeof(MAGIC))
+      data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+    if (MAP_FAILED == data)
+      return std::nullopt;
+
+    config::Container_Options options{};
+    Reader                    reader(
+      static_cast<const char *>(data) + sizeof(MAGIC), st.st_size - sizeof(MAGIC));
+
+    const bool valid = 0 == memcmp(data, MAGIC, sizeof(MAGIC));
+    if (valid)
+      fields(reader, options);
+
+    munmap(data, st.st_size);
+
+    if (!valid || reader.failed())
+      {
+        LOG_WARNING << "Ignoring the corrupted compiled configuration " << path;
+        unlink(path.c_str());
+        return std::nullopt;
+      }
+
+    LOG_DEBUG << "Loading the compiled configuration " << path << "...✓";
+    return options;
+  }
+
+  void Config_Cache::store(const uint64_t hash, const config::Container_Options & options) noexcept
+  {
+    Writer writer;
+    writer.blob().append(MAGIC, sizeof(MAGIC));
+    fields(writer, options);
+
+    const std::string path = path_of(hash);
+    const std::string tmp = path + "." + std::to_string(getpid());
+    std::error_code   ec;
+
+    /* Renamed into place, a concurrent run never loads a partial blob. */
+    bool stored = false;
+    std::filesystem::create_directories(CACHE_DIR, ec);
+    if (!ec)
+      {
+        const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (-1 != fd)
+          {
+            const std::string & blob = writer.blob();
+            size_t              offset = 0;
+            for (ssize_t written = 0; offset < blob.size(); offset += written)
+              if ((written = write(fd, blob.data() + offset, blob.size() - offset)) <= 0)
+                break;
+
+            close(fd);
+            stored = offset == blob.size() && 0 == rename(tmp.c_str(), path.c_str());
+          }
+      }
+
+    if (!stored)
+      {
+        LOG_WARNING << "Cannot compile the configuration to " << path;
+        unlink(tmp.c_str());
+        return;
+      }
+
+    LOG_DEBUG << "Compiling the configuration to " << path << "...✓";
+  }
+} // namespace bonding::configfile
@@ -1,5 +1,7 @@
 #include "include/configfile.h"
 #include "include/config.h"
+#include "include/configcache.h"
+#include "include/namespace.h"
 #include "include/resource.h"
 #include "include/unix.h"
 #include "nlohmann/json_fwd.hpp"
@@ -37,17 +39,39 @@ namespace bonding::configfile
       generate_socketpair().value(),
       json["hostname"],
       read_mounts(json).value(),
+      read_idmapped(json).value(),
       read_clone(json).value(),
-      read_cgroups_options(json).value()};
+      read_cgroups_options(json).value(),
+      read_listen(json).value(),
+      json.value("notify", false),
+      json.value("ready_timeout", 60u),
+      read_namespaces(json).value(),
+      read_batch(json).value(),
+      json.value("init", false),
+      read_log(json).value(),
+      read_output(json).value(),
+      read_tmpfs(json).value(),
+      json.value("prefetch", 0u)};
   }
 
   std::expected<config::Container_Options, error::Err>
     Config_File::read(const std::string & path) noexcept
   {
-    const nlohmann::json data =
-      parse(unix::Filesystem::read_entire_file(path).value()).value();
+    const std::string content = unix::Filesystem::read_entire_file(path).value();
+    const uint64_t    hash = Config_Cache::hash_of(content);
 
-    return Container_Options_of_json(data);
+    /* Only the runtime fields are left to initialize on a compiled configuration. */
+    if (auto compiled = Config_Cache::load(hash); compiled.has_value())
+      {
+        compiled->ipc = generate_socketpair().value();
+        return std::move(compiled.value());
+      }
+
+    auto options = parse(content).and_then(Container_Options_of_json);
+    if (options.has_value())
+      Config_Cache::store(hash, options.value());
+
+    return options;
   }
 
   std::expected<int, error::Err>
@@ -94,6 +118,185 @@ namespace bonding::configfile
     return mounts;
   }
 
+  std::expected<std::vector<std::string>, error::Err>
+    Config_File::read_idmapped(const nlohmann::json & data) noexcept
+  {
+    std::vector<std::string> idmapped;
+
+    try
+      {
+        if (data.contains("idmapped"))
+          for (auto && path : data["idmapped"])
+            {
+              if (!data["mounts"].contains(path))
+                return std::unexpected(ERR_MSG(
+                  error::Code::Configfile, std::string(path) + " is not one of the mounts"));
+
+              idmapped.push_back(path);
+            }
+      }
+    catch (const nlohmann::json::exception & e)
+      {
+        return std::unexpected(ERR_MSG(error::Code::Configfile, e.what()));
+      }
+    return idmapped;
+  }
+
+  std::expected<std::vector<std::string>, error::Err>
+    Config_File::read_listen(const nlohmann::json & data) noexcept
+  {
+    std::vector<std::string> listen;
+
+    try
+      {
+        if (data.contains("listen"))
+          for (auto && address : data["listen"])
+            listen.push_back(address);
+      }
+    catch (const nlohmann::json::exception & e)
+      {
+        return std::unexpected(ERR_MSG(error::Code::Configfile, e.what()));
+      }
+    return listen;
+  }
+
+  std::expected<std::vector<config::Namespace_Join>, error::Err>
+    Config_File::read_namespaces(const nlohmann::json & data) noexcept
+  {
+    std::vector<config::Namespace_Join> namespaces;
+
+    try
+      {
+        if (data.contains("namespaces"))
+          for (auto && [kind, target] : data["namespaces"].items())
+            try
+              {
+                namespaces.push_back(
+                  config::Namespace_Join{kind, ns::Namespace::KINDS.at(kind), target});
+              }
+            catch (const std::out_of_range & e)
+              {
+                return std::unexpected(ERR_MSG(
+                  error::Code::Configfile, kind + " is not a joinable namespace"));
+              }
+      }
+    catch (const nlohmann::json::exception & e)
+      {
+        return std::unexpected(ERR_MSG(error::Code::Configfile, e.what()));
+      }
+    return namespaces;
+  }
+
+  std::expected<config::Batch_Options, error::Err>
+    Config_File::read_batch(const nlohmann::json & data) noexcept
+  {
+    config::Batch_Options batch;
+
+    try
+      {
+        if (data.contains("batch"))
+          {
+            const nlohmann::json & options = data["batch"];
+            batch.overlay = options.value("overlay", batch.overlay);
+            batch.reset_cgroups = options.value("reset_cgroups", batch.reset_cgroups);
+            batch.timeout_ms = options.value("timeout_ms", batch.timeout_ms);
+            batch.output_limit = options.value("output_limit", batch.output_limit);
+
+            if (options.contains("env"))
+              for (const auto & [name, value] : options["env"].items())
+                batch.env.push_back(name + "=" + value.get<std::string>());
+          }
+      }
+    catch (const nlohmann::json::exception & e)
+      {
+        return std::unexpected(ERR_MSG(error::Code::Configfile, e.what()));
+      }
+    return batch;
+  }
+
+  std::expected<config::Tmpfs_Options, error::Err>
+    Config_File::read_tmpfs(const nlohmann::json & data) noexcept
+  {
+    config::Tmpfs_Options tmpfs;
+
+    try
+      {
+        if (data.contains("tmpfs"))
+          {
+            const nlohmann::json & options = data["tmpfs"];
+            tmpfs.scratch = options.value("scratch", tmpfs.scratch);
+            tmpfs.shm = options.value("shm", tmpfs.shm);
+            tmpfs.huge_pages = options.value("huge_pages", tmpfs.huge_pages);
+          }
+      }
+    catch (const nlohmann::json::exception & e)
+      {
+        return std::unexpected(ERR_MSG(error::Code::Configfile, e.what()));
+      }
+
+    if (tmpfs.huge_pages != "never" && tmpfs.huge_pages != "always"
+        && tmpfs.huge_pages != "within_size" && tmpfs.huge_pages != "advise")
+      return std::unexpected(
+        ERR_MSG(error::Code::Configfile, "Unknown huge pages policy " + tmpfs.huge_pages));
+
+    return tmpfs;
+  }
+
+  std::expected<config::Log_Options, error::Err>
+    Config_File::read_log(const nlohmann::json & data) noexcept
+  {
+    config::Log_Options log;
+
+    try
+      {
+        if (data.contains("log"))
+          {
+            const nlohmann::json & options = data["log"];
+            log.json = options.value("json", log.json);
+            log.max_size = options.value("max_size", log.max_size);
+            log.files = options.value("files", log.files);
+          }
+      }
+    catch (const nlohmann::json::exception & e)
+      {
+        return std::unexpected(ERR_MSG(error::Code::Configfile, e.what()));
+      }
+    return log;
+  }
+
+  std::expected<config::Output_Options, error::Err>
+    Config_File::read_output(const nlohmann::json & data) noexcept
+  {
+    config::Output_Options output;
+
+    try
+      {
+        if (data.contains("output"))
+          {
+            const nlohmann::json & options = data["output"];
+            output.mode = options.value("mode", output.mode);
+            output.path = options.value("path", output.path);
+            output.max_size = options.value("max_size", output.max_size);
+            output.files = options.value("files", output.files);
+            output.drop = options.value("backpressure", std::string("block")) == "drop";
+          }
+      }
+    catch (const nlohmann::json::exception & e)
+      {
+        return std::unexpected(ERR_MSG(error::Code::Configfile, e.what()));
+      }
+
+    if (output.mode != "inherit" && output.mode != "file" && output.mode != "socket")
+      return std::unexpected(
+        ERR_MSG(error::Code::Configfile, "Unknown output mode " + output.mode));
+
+    if (output.mode == "socket" && output.path.empty())
+      return std::unexpected(
+        ERR_MSG(error::Code::Configfile, "The socket output needs a path"));
+
+    return output;
+  }
+
   std::expected<std::vector<config::CgroupsV1::Control>, error::Err>
     Config_File::read_cgroups_options(const nlohmann::json & data) noexcept
   {
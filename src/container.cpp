@@ -1,53 +1,208 @@
 /** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
 
 #include "include/container.h"
+#include "include/batch.h"
 #include "include/config.h"
+#include "include/handoff.h"
+#include "include/id.h"
+#include "include/image.h"
 #include "include/ipc.h"
 #include "include/namespace.h"
+#include "include/output.h"
+#include "include/prefetch.h"
+#include "include/reaper.h"
 #include "include/resource.h"
 #include "include/syscall.h"
 #include "include/unix.h"
+#include <csignal>
 #include <error.h>
+#include <sys/wait.h>
 
 namespace bonding::container
 {
   std::expected<void, error::Err> Container::create() noexcept
   {
+    logging::set_phase("create");
+    ns::Namespace::close_joins(m_config).value();
+
+    /* Read ahead while the child process sets up its mounts. The threads are started
+     * once it is cloned: a thread holding a lock of the libc at that time would leave
+     * it held forever in the child. */
+    prefetch::Prefetcher::replay(m_config);
+    m_control.start(m_child_process.m_pid, m_config, m_predecessor.has_value()).value();
+    m_output.start(m_config).value();
+
+    /* Before the workload is let run, so that it is recorded from its first file. */
+    if (!m_recorder.start(m_config, m_child_process.m_pid).has_value())
+      LOG_WARNING << "Cannot record the prefetch manifest of the container";
+
     if (ipc::IPC::recv_boolean(m_sockets.first))
       {
         ns::Namespace::handle_child_uid_map(m_child_process.m_pid).value();
-        resource::Resource::setup(m_config).value();
+        resource::Resource::setup(m_config, m_child_process.m_pid).value();
         ipc::IPC::send_boolean(m_sockets.first, false).value();
+        record();
+        announce();
       }
     else
       {
         return std::unexpected(
           ERR_MSG(error::Code::Namespace, "No user namespace set up from child process"));
       }
-    return m_child_process.wait();
+
+    m_control.mark_ready();
+    logging::set_phase("running");
+
+    if (!m_config.batch_queue.empty())
+      {
+        logging::set_phase("batch");
+        batch::Dispatcher::serve(m_config, m_sockets.first).value();
+      }
+
+    if (m_predecessor.has_value())
+      {
+        /* The predecessor keeps serving, its socket was not replaced yet: the successor
+         * is not left running behind it. */
+        const auto ready =
+          m_control.wait_ready(std::chrono::seconds(m_config.ready_timeout));
+        if (!ready.has_value())
+          {
+            kill(m_child_process.m_pid, SIGKILL);
+            static_cast<void>(m_child_process.wait());
+            return std::unexpected(ready.error());
+          }
+
+        m_control.publish().value();
+        m_predecessor->drain(DRAIN_GRACE).value();
+        LOG_INFO << "Handing over from the predecessor container...✓";
+      }
+
+    const int status = m_child_process.wait().value();
+    if (m_events.has_value())
+      m_events->publish(
+        events::Event::Type::Exited,
+        m_child_process.m_pid,
+        WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+
+    return {};
   }
 
   std::expected<void, error::Err> Container::clean_and_exit() noexcept
   {
+    logging::set_phase("clean");
+    m_monitor.stop();
+    m_recorder.stop();
+    m_control.stop().value();
+    m_output.stop().value();
     Container_Cleaner::close_socket(m_sockets.first).value();
     Container_Cleaner::close_socket(m_sockets.second).value();
-    resource::Resource::clean(m_config).value();
     syscall::Syscall::Syscall::clean().value();
 
+    /* The cgroups and the state directory may stay busy for a while after the workload
+     * exited, the next launch does not wait for them. */
+    reaper::Reaper::detach(reaper::Job::of(
+      m_config, m_store.has_value() ? std::optional<size_t>(m_slot) : std::nullopt));
+
     return {};
   }
 
+  std::expected<void, error::Err> Container::start(config::Container_Options options) noexcept
+  {
+    prepare(options, {});
+    return launch(std::move(options), std::nullopt);
+  }
+
   std::expected<void, error::Err>
-    Container::start(const config::Container_Options & argv) noexcept
+    Container::batch(config::Container_Options options, const std::string & queue) noexcept
+  {
+    options.batch_queue = queue;
+    prepare(options, {});
+    return launch(std::move(options), std::nullopt);
+  }
+
+  std::expected<void, error::Err> Container::replace(config::Container_Options options) noexcept
+  {
+    if (options.name.empty())
+      return std::unexpected(
+        ERR_MSG(error::Code::Container, "The name of the container to replace is missing"));
+
+    auto predecessor = control::Client::connect(control::Server::path_of(options.name));
+    if (!predecessor.has_value())
+      return std::unexpected(ERR_MSG(
+        error::Code::Container, "No running container " + options.name + " to replace"));
+
+    /* The successor takes over the name, its state lives under a new id. */
+    prepare(options, predecessor->handoff().value());
+    return launch(std::move(options), std::move(*predecessor));
+  }
+
+  void Container::prepare(
+    config::Container_Options & options, std::vector<config::Passed_Fd> inherited) noexcept
+  {
+    id::Id::prepare(options).value();
+    setup_logging(options);
+
+    handoff::Handoff::prepare(options, std::move(inherited)).value();
+    output::Output::prepare(options).value();
+    image::Image::prepare(options).value();
+    ns::Namespace::prepare_joins(options).value();
+  }
+
+  void Container::record() noexcept
+  {
+    auto store = store::Store::open();
+    if (!store.has_value())
+      return;
+
+    const auto slot = store->claim(store::Record::of(m_config, m_child_process.m_pid));
+    if (!slot.has_value())
+      return;
+
+    m_slot = *slot;
+    m_store.emplace(std::move(*store));
+  }
+
+  void Container::announce() noexcept
   {
-    Container container(argv);
+    auto publisher = events::Publisher::open(m_config);
+    if (!publisher.has_value())
+      return;
 
-    if (argv.debug)
+    m_events.emplace(std::move(*publisher));
+    m_events->publish(events::Event::Type::Started, m_child_process.m_pid, 0);
+
+    if (!m_monitor.start(m_config, *m_events, m_child_process.m_pid).has_value())
+      LOG_WARNING << "Cannot monitor the cgroups of the container";
+  }
+
+  void Container::setup_logging(const config::Container_Options & options) noexcept
+  {
+    logging::set_container(options.name);
+    logging::set_phase("prepare");
+
+    if (!options.log.json)
+      return;
+
+    const std::string path = LOG_DIR + options.name + ".jsonl";
+    if (unix::Filesystem::Mkdir(LOG_DIR).has_value()
+        && logging::open_json(path, options.log.max_size, options.log.files))
+      LOG_INFO << "Logging to " << path << "...✓";
+    else
+      LOG_WARNING << "Cannot open the log file " << path;
+  }
+
+  std::expected<void, error::Err> Container::launch(
+    config::Container_Options options, std::optional<control::Client> predecessor) noexcept
+  {
+    if (options.debug)
       {
         logging::set_level(LOG_LEVEL_DEBUG);
         LOG_DEBUG << "Activate debug mode...✓";
       }
 
+    syscall::Syscall::prepare().value();
+    Container container(std::move(options), std::move(predecessor));
+
     return container.create()
       .transform([&]() {
       LOG_INFO << "Cleaning and exiting container...✓";
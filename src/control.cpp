@@ -0,0 +1,427 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/control.h"
+#include "include/ipc.h"
+#include "include/unix.h"
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace bonding::control
+{
+  namespace
+  {
+    std::expected<sockaddr_un, error::Err> make_address(const std::string & path) noexcept
+    {
+      sockaddr_un addr = {};
+      addr.sun_family = AF_UNIX;
+      if (path.size() >= sizeof(addr.sun_path))
+        return std::unexpected(
+          ERR_MSG(error::Code::Socket, "Control socket path too long: " + path));
+
+      memcpy(addr.sun_path, path.c_str(), path.size());
+      return addr;
+    }
+  } // namespace
+
+  std::string Server::path_of(const std::string & name) noexcept
+  {
+    return ".bonding/run/" + name + ".sock";
+  }
+
+  std::expected<void, error::Err> Server::start(
+    const pid_t child, const config::Container_Options & options, const bool takeover) noexcept
+  {
+    unix::Filesystem::Mkdir(m_path.substr(0, m_path.find_last_of('/'))).value();
+
+    if (!takeover && Client::connect(m_path).has_value())
+      return std::unexpected(ERR_MSG(
+        error::Code::Container,
+        "A container is already running with the control socket " + m_path));
+
+    m_bound_path = takeover ? m_path + "." + std::to_string(getpid()) : m_path;
+    unlink(m_bound_path.c_str());
+
+    sockaddr_un addr = make_address(m_bound_path).value();
+    m_listen = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (-1 == m_listen)
+      return std::unexpected(ERR(error::Code::Socket));
+
+    if (-1 == bind(m_listen, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))
+        || -1 == listen(m_listen, SOMAXCONN))
+      return std::unexpected(
+        ERR_MSG(error::Code::Socket, "Cannot bind the control socket " + m_bound_path));
+
+    struct stat st = {};
+    if (-1 == stat(m_bound_path.c_str(), &st))
+      return std::unexpected(ERR(error::Code::Socket));
+
+    m_bound_inode = st.st_ino;
+
+    if (-1 == pipe2(m_wakeup, O_CLOEXEC))
+      return std::unexpected(ERR(error::Code::Socket));
+
+    /* Only the workload keeps the other end, so that its exit is seen as EOF. */
+    close(options.notify_socket.second);
+
+    m_child = child;
+    m_notify = options.notify_socket.first;
+    m_notify_ready = options.notify;
+    m_fds = options.fds;
+    m_thread = std::thread(&Server::loop, this);
+
+    LOG_DEBUG << "Serving control socket " << m_bound_path << "...✓";
+    return {};
+  }
+
+  void Server::mark_ready() noexcept
+  {
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_notify_ready)
+      {
+        LOG_INFO << "Waiting for the workload to report its readiness...";
+        return;
+      }
+
+    m_ready = true;
+    m_ready_cond.notify_all();
+  }
+
+  std::expected<void, error::Err>
+    Server::wait_ready(const std::chrono::seconds timeout) noexcept
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_ready_cond.wait_for(lock, timeout, [this]() { return m_ready || m_exited; }))
+      return std::unexpected(ERR_MSG(
+        error::Code::Container,
+        "The workload is not ready after " + std::to_string(timeout.count()) + "s"));
+
+    if (!m_ready)
+      return std::unexpected(
+        ERR_MSG(error::Code::Container, "The workload exited before being ready"));
+
+    LOG_INFO << "Container is ready...✓";
+    return {};
+  }
+
+  std::expected<void, error::Err> Server::publish() noexcept
+  {
+    if (m_bound_path == m_path)
+      return {};
+
+    if (-1 == rename(m_bound_path.c_str(), m_path.c_str()))
+      return std::unexpected(ERR_MSG(
+        error::Code::Socket, "Cannot publish the control socket " + m_path));
+
+    m_bound_path = m_path;
+    LOG_DEBUG << "Publishing control socket " << m_path << "...✓";
+    return {};
+  }
+
+  std::expected<void, error::Err> Server::stop() noexcept
+  {
+    if (m_thread.joinable())
+      {
+        if (-1 == write(m_wakeup[1], "", 1))
+          return std::unexpected(ERR(error::Code::Socket));
+
+        m_thread.join();
+      }
+
+    m_child = -1;
+
+    for (const int fd : m_connections)
+      close(fd);
+    for (const auto & fd : m_fds)
+      close(fd.fd);
+
+    for (const int fd : {m_listen, m_notify, m_wakeup[0], m_wakeup[1]})
+      if (-1 != fd)
+        close(fd);
+
+    m_connections.clear();
+    m_fds.clear();
+    m_listen = m_notify = m_wakeup[0] = m_wakeup[1] = -1;
+
+    unlink_if_owned();
+    return {};
+  }
+
+  void Server::unlink_if_owned() noexcept
+  {
+    struct stat st = {};
+    if (m_bound_path.empty() || -1 == stat(m_bound_path.c_str(), &st))
+      return;
+
+    if (st.st_ino == m_bound_inode)
+      unlink(m_bound_path.c_str());
+  }
+
+  void Server::loop() noexcept
+  {
+    while (true)
+      {
+        std::vector<pollfd> fds = {{m_wakeup[0], POLLIN, 0}, {m_listen, POLLIN, 0}};
+        if (-1 != m_notify)
+          fds.push_back({m_notify, POLLIN, 0});
+        for (const int connection : m_connections)
+          fds.push_back({connection, POLLIN, 0});
+
+        int timeout = -1;
+        if (m_kill_deadline.has_value())
+          timeout = static_cast<int>(std::max<int64_t>(
+            0,
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+              *m_kill_deadline - std::chrono::steady_clock::now())
+              .count()));
+
+        if (-1 == poll(fds.data(), fds.size(), timeout) && EINTR != errno)
+          {
+            LOG_ERROR << "Control socket poll failed: " << strerror(errno);
+            return;
+          }
+
+        if (0 != fds[0].revents)
+          return;
+
+        if (m_kill_deadline.has_value()
+            && std::chrono::steady_clock::now() >= *m_kill_deadline)
+          {
+            LOG_WARNING << "Workload " << m_child << " did not drain in time, killing it";
+            kill(m_child, SIGKILL);
+            m_kill_deadline.reset();
+          }
+
+        if (0 != (fds[1].revents & POLLIN))
+          {
+            const int connection = accept4(m_listen, nullptr, nullptr, SOCK_CLOEXEC);
+            if (-1 != connection)
+              m_connections.push_back(connection);
+          }
+
+        size_t next = 2;
+        if (-1 != m_notify && 0 != fds[next++].revents)
+          handle_notify();
+
+        for (; next < fds.size(); ++next)
+          if (0 != fds[next].revents)
+            handle_request(fds[next].fd);
+      }
+  }
+
+  void Server::handle_request(const int connection) noexcept
+  {
+    char          buf[256] = {0};
+    const ssize_t size = recv(connection, buf, sizeof(buf) - 1, 0);
+    if (size <= 0)
+      {
+        close(connection);
+        std::erase(m_connections, connection);
+        return;
+      }
+
+    std::istringstream request(std::string(buf, size));
+    std::string        command;
+    request >> command;
+
+    if (command == "STATUS")
+      {
+        bool ready = false;
+        {
+          const std::lock_guard<std::mutex> lock(m_mutex);
+          ready = m_ready;
+        }
+
+        const std::string reply =
+          "OK pid=" + std::to_string(m_child) + " ready=" + (ready ? "1" : "0");
+        send(connection, reply.c_str(), reply.size(), MSG_NOSIGNAL);
+      }
+    else if (command == "HANDOFF")
+      {
+        std::string      payload;
+        std::vector<int> fds;
+        for (const auto & fd : m_fds)
+          {
+            payload += fd.address.empty() ? "state " + fd.name : "listen " + fd.address;
+            payload += "\n";
+            fds.push_back(fd.fd);
+          }
+
+        if (ipc::IPC::send_fds(connection, payload, fds).has_value())
+          LOG_INFO << "Handing " << fds.size() << " descriptors over to a successor...✓";
+      }
+    else if (command == "DRAIN")
+      {
+        int64_t grace = 0;
+        request >> grace;
+        drain(std::chrono::milliseconds(grace));
+        send(connection, "OK", 2, MSG_NOSIGNAL);
+      }
+    else
+      {
+        const std::string reply = "ERR unknown request " + command;
+        send(connection, reply.c_str(), reply.size(), MSG_NOSIGNAL);
+      }
+  }
+
+  void Server::handle_notify() noexcept
+  {
+    const auto message = ipc::IPC::recv_fds(m_notify);
+
+    /* An empty datagram is what a closed SOCK_SEQPACKET peer looks like. */
+    if (!message.has_value() || (message->first.empty() && message->second.empty()))
+      {
+        close(m_notify);
+        m_notify = -1;
+
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_exited = true;
+        m_ready_cond.notify_all();
+        return;
+      }
+
+    const auto & [payload, fds] = *message;
+    std::istringstream lines(payload);
+    bool               store = false;
+    std::string        name = "stored";
+
+    for (std::string line; std::getline(lines, line);)
+      {
+        if (line == "READY=1")
+          {
+            const std::lock_guard<std::mutex> lock(m_mutex);
+            m_ready = true;
+            m_ready_cond.notify_all();
+          }
+        else if (line == "FDSTORE=1")
+          store = true;
+        else if (line.starts_with("FDNAME="))
+          name = line.substr(7);
+      }
+
+    for (const int fd : fds)
+      {
+        if (store)
+          m_fds.push_back(config::Passed_Fd{name, "", fd});
+        else
+          close(fd);
+      }
+
+    if (store)
+      LOG_DEBUG << "Storing " << fds.size() << " state descriptors named " << name;
+  }
+
+  void Server::drain(const std::chrono::milliseconds grace) noexcept
+  {
+    LOG_INFO << "Draining workload " << m_child << " within " << grace.count() << "ms";
+
+    if (m_child > 0)
+      kill(m_child, SIGTERM);
+
+    m_kill_deadline = std::chrono::steady_clock::now() + grace;
+  }
+
+  Client::~Client()
+  {
+    if (-1 != m_socket)
+      close(m_socket);
+  }
+
+  std::expected<Client, error::Err> Client::connect(const std::string & path) noexcept
+  {
+    const auto addr = make_address(path);
+    if (!addr.has_value())
+      return std::unexpected(addr.error());
+
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (-1 == fd)
+      return std::unexpected(ERR(error::Code::Socket));
+
+    if (-1 == ::connect(fd, reinterpret_cast<const sockaddr *>(&*addr), sizeof(*addr)))
+      {
+        close(fd);
+        return std::unexpected(
+          ERR_MSG(error::Code::Socket, "Cannot connect to control socket " + path));
+      }
+
+    return Client(fd);
+  }
+
+  std::expected<std::string, error::Err>
+    Client::request(const std::string & command) noexcept
+  {
+    if (-1 == send(m_socket, command.c_str(), command.size(), MSG_NOSIGNAL))
+      return std::unexpected(ERR_MSG(error::Code::Socket, "Cannot send " + command));
+
+    char          buf[4096] = {0};
+    const ssize_t size = recv(m_socket, buf, sizeof(buf), 0);
+    if (size <= 0)
+      return std::unexpected(
+        ERR_MSG(error::Code::Socket, "No reply to " + command + " from the container"));
+
+    return std::string(buf, size);
+  }
+
+  std::expected<Client::Status, error::Err> Client::status() noexcept
+  {
+    const std::string reply = request("STATUS").value();
+
+    Status status = {-1, false};
+    int    ready = 0;
+    if (2 != sscanf(reply.c_str(), "OK pid=%d ready=%d", &status.pid, &ready))
+      return std::unexpected(ERR_MSG(error::Code::Container, reply));
+
+    status.ready = (1 == ready);
+    return status;
+  }
+
+  std::expected<std::vector<config::Passed_Fd>, error::Err> Client::handoff() noexcept
+  {
+    if (-1 == send(m_socket, "HANDOFF", 7, MSG_NOSIGNAL))
+      return std::unexpected(ERR_MSG(error::Code::Socket, "Cannot request a handoff"));
+
+    const auto [payload, fds] = ipc::IPC::recv_fds(m_socket).value();
+
+    std::vector<config::Passed_Fd> passed;
+    std::istringstream             lines(payload);
+    for (std::string kind, value; lines >> kind >> value;)
+      {
+        if (passed.size() == fds.size())
+          break;
+
+        if (kind == "listen")
+          passed.push_back(config::Passed_Fd{"listen", value, fds[passed.size()]});
+        else
+          passed.push_back(config::Passed_Fd{value, "", fds[passed.size()]});
+      }
+
+    if (passed.size() != fds.size())
+      {
+        for (const int fd : fds)
+          close(fd);
+
+        return std::unexpected(
+          ERR_MSG(error::Code::Socket, "Malformed handoff from the container"));
+      }
+
+    LOG_INFO << "Receiving " << passed.size() << " descriptors from the predecessor...✓";
+    return passed;
+  }
+
+  std::expected<void, error::Err>
+    Client::drain(const std::chrono::milliseconds grace) noexcept
+  {
+    const std::string reply = request("DRAIN " + std::to_string(grace.count())).value();
+    if (!reply.starts_with("OK"))
+      return std::unexpected(ERR_MSG(error::Code::Container, reply));
+
+    return {};
+  }
+} // namespace bonding::control
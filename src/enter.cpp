@@ -0,0 +1,180 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/enter.h"
+#include "include/capabilities.h"
+#include "include/control.h"
+#include "include/exec.h"
+#include "include/resource.h"
+#include "include/syscall.h"
+#include "include/unix.h"
+#include "logging.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <grp.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace bonding::enter
+{
+  std::expected<int, error::Err>
+    Enter::namespaces_of(const pid_t pid) noexcept
+  {
+    int flags = 0;
+
+    for (const auto & [kind, flag] : NAMESPACES)
+      {
+        struct stat ours = {};
+        struct stat theirs = {};
+        const std::string path = "/proc/" + std::to_string(pid) + "/ns/" + kind;
+
+        if (-1 == stat(path.c_str(), &theirs))
+          return std::unexpected(ERR_MSG(error::Code::Namespace, "Cannot stat " + path));
+
+        if (-1 == stat(("/proc/self/ns/" + kind).c_str(), &ours) || ours.st_ino != theirs.st_ino
+            || ours.st_dev != theirs.st_dev)
+          flags |= flag;
+      }
+
+    return flags;
+  }
+
+  std::expected<std::pair<uid_t, gid_t>, error::Err> Enter::ids_of(const pid_t pid) noexcept
+  {
+    const std::string proc = "/proc/" + std::to_string(pid) + "/";
+
+    /* Translate a host id through the "<inside> <outside> <count>" lines of a map. */
+    const auto inside = [&](const std::string & map, const uint32_t id) -> uint32_t {
+      std::istringstream lines(unix::Filesystem::read_entire_file(proc + map).value_or(""));
+      for (uint32_t first, outside, count; lines >> first >> outside >> count;)
+        if (id >= outside && id - outside < count)
+          return first + (id - outside);
+
+      return id;
+    };
+
+    std::istringstream status(unix::Filesystem::read_entire_file(proc + "status").value());
+    uint32_t           uid = 0;
+    uint32_t           gid = 0;
+    for (std::string field; status >> field;)
+      {
+        if (field == "Uid:")
+          status >> uid;
+        else if (field == "Gid:")
+          status >> gid;
+      }
+
+    return std::make_pair(inside("uid_map", uid), inside("gid_map", gid));
+  }
+
+  std::vector<std::string> Enter::environ_of(const pid_t pid) noexcept
+  {
+    /* NUL-separated, the workload may have changed its own since it started. */
+    const std::string content =
+      unix::Filesystem::read_entire_file("/proc/" + std::to_string(pid) + "/environ")
+        .value_or("");
+
+    std::vector<std::string> env;
+    for (size_t begin = 0, end = 0; begin < content.size(); begin = end + 1)
+      {
+        end = std::min(content.find('\0', begin), content.size());
+        if (end > begin)
+          env.push_back(content.substr(begin, end - begin));
+      }
+
+    return exec::Execve::with_defaults(std::move(env));
+  }
+
+  std::expected<void, error::Err>
+    Enter::enter(const pid_t pid, const int pidfd, const int flags) noexcept
+  {
+    /* Linux 5.8+: every namespace at once, and atomically. */
+    if (-1 != pidfd && 0 == setns(pidfd, flags))
+      return {};
+
+    for (const auto & [kind, flag] : NAMESPACES)
+      {
+        if (0 == (flags & flag))
+          continue;
+
+        const std::string path = "/proc/" + std::to_string(pid) + "/ns/" + kind;
+        const int         fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (-1 == fd)
+          return std::unexpected(ERR_MSG(error::Code::Namespace, "Cannot open " + path));
+
+        const int result = setns(fd, flag);
+        close(fd);
+
+        if (-1 == result)
+          return std::unexpected(ERR_MSG(error::Code::Namespace, "Cannot join " + path));
+      }
+
+    return {};
+  }
+
+  void Enter::run(const std::vector<std::string> & argv,
+                  const std::vector<std::string> & env,
+                  const uid_t                      uid,
+                  const gid_t                      gid) noexcept
+  {
+    if (-1 == chdir("/") || -1 == setgroups(0, nullptr) || -1 == setresgid(gid, gid, gid)
+        || -1 == setresuid(uid, uid, uid))
+      {
+        LOG_ERROR << "Cannot switch to uid " << uid << " inside the container";
+        _exit(EXIT_FAILURE);
+      }
+
+    capabilities::Capabilities::setup().value();
+    syscall::Syscall::setup().value();
+
+    /* Looked up after chdir, in the root of the container. */
+    exec::Execve::search(argv, env);
+    _exit(127);
+  }
+
+  std::expected<int, error::Err>
+    Enter::exec(const std::string & container, const std::vector<std::string> & argv) noexcept
+  {
+    const pid_t pid = control::Client::connect(control::Server::path_of(container))
+                        .and_then([](control::Client client) { return client.status(); })
+                        .transform_error([&](const error::Err & e) {
+      return ERR_MSG(error::Code::Container, "No running container " + container);
+    }).value().pid;
+
+    const int  pidfd = static_cast<int>(::syscall(SYS_pidfd_open, pid, 0));
+    const int  flags = namespaces_of(pid).value();
+    const auto [uid, gid] = ids_of(pid).value();
+    const auto env = environ_of(pid);
+
+    /* Loaded from the cache: no filter is compiled on the probe path. */
+    syscall::Syscall::prepare().value();
+
+    /* Joining a user namespace requires a single-threaded process. */
+    logging::set_async(false);
+
+    /* The cgroup files are only reachable from the host mount namespace. */
+    resource::Resource::join(pid).value();
+    enter(pid, pidfd, flags).value();
+
+    if (-1 != pidfd)
+      close(pidfd);
+
+    LOG_DEBUG << "Entering container " << container << " (process " << pid << ")...✓";
+
+    /* The pid namespace only applies to the children. */
+    const pid_t child = fork();
+    if (-1 == child)
+      return std::unexpected(ERR(error::Code::ChildProcess));
+
+    if (0 == child)
+      run(argv, env, uid, gid);
+
+    int status = 0;
+    if (-1 == waitpid(child, &status, 0))
+      return std::unexpected(ERR(error::Code::ChildProcess));
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  }
+} // namespace bonding::enter
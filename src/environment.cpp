@@ -1,7 +1,13 @@
 #include "include/environment.h"
+#include <cerrno>
 #include <dirent.h>
 #include <filesystem>
+#include <fstream>
+#include <linux/io_uring.h>
+#include <linux/magic.h>
 #include <string>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <utility>
 
@@ -25,19 +31,152 @@ namespace bonding::environment
   std::expected<bool, error::Err>
     CgroupsV1::checking_if_controller_supported(const std::string & controller) noexcept
   {
-    for (const auto & support_controller :
-         std::filesystem::recursive_directory_iterator(PATH))
+    /* Every hierarchy is mounted at the root, or linked there under each of the
+     * controllers it is co-mounted with. */
+    if (0 == access((PATH + controller).c_str(), F_OK))
       {
-        if (support_controller.path().filename().c_str() == controller)
-          {
-            LOG_DEBUG << "Check if Cgroups-v1 " << controller
-                      << " controller is supported...✓";
-
-            return true;
-          }
+        LOG_DEBUG << "Check if Cgroups-v1 " << controller << " controller is supported...✓";
+        return true;
       }
 
     LOG_ERROR << "Check if Cgroups-v1 " << controller << " controller is supported...✗";
     return false;
   }
-} // namespace bonding::environment
\ No newline at end of file
+
+  namespace
+  {
+    /** A system call made to fail on its arguments tells whether it exists. */
+    bool implemented(const long result) noexcept { return 0 <= result || ENOSYS != errno; }
+
+    /** The descriptor a probe opened, if it did */
+    bool opened(const long fd) noexcept
+    {
+      if (0 > fd)
+        return false;
+
+      close(static_cast<int>(fd));
+      return true;
+    }
+  } // namespace
+
+  const std::vector<std::pair<const char *, bool Features::*>> & Features::fields() noexcept
+  {
+    static const std::vector<std::pair<const char *, bool Features::*>> fields = {
+      {"pidfd", &Features::pidfd},
+      {"idmapped_mounts", &Features::idmapped_mounts},
+      {"cgroup_v2", &Features::cgroup_v2},
+      {"io_uring", &Features::io_uring}};
+
+    return fields;
+  }
+
+  Features Features::probe() noexcept
+  {
+    Features features;
+
+    features.pidfd = opened(::syscall(SYS_pidfd_open, getpid(), 0));
+    features.idmapped_mounts =
+      implemented(::syscall(SYS_mount_setattr, -1, "", 0, nullptr, 0));
+
+    struct statfs cgroup = {};
+    features.cgroup_v2 =
+      0 == statfs("/sys/fs/cgroup", &cgroup) && CGROUP2_SUPER_MAGIC == cgroup.f_type;
+
+    io_uring_params params = {};
+    features.io_uring = opened(::syscall(SYS_io_uring_setup, 1, &params));
+
+    return features;
+  }
+
+  std::string Features::key() noexcept
+  {
+    std::ifstream boot("/proc/sys/kernel/random/boot_id");
+    std::string   boot_id;
+    boot >> boot_id;
+
+    return Info::kernel.release + " " + boot_id;
+  }
+
+  std::optional<Features> Features::load(const std::string & key) noexcept
+  {
+    std::ifstream cache(CACHE);
+    std::string   cached;
+    if (!std::getline(cache, cached) || cached != key)
+      return std::nullopt;
+
+    std::map<std::string, std::string> values;
+    for (std::string line; std::getline(cache, line);)
+      {
+        const size_t equal = line.find('=');
+        if (std::string::npos == equal)
+          return std::nullopt;
+
+        values.emplace(line.substr(0, equal), line.substr(equal + 1));
+      }
+
+    /* A table written by a version of bonding with other features is probed again. */
+    if (values.size() != fields().size())
+      return std::nullopt;
+
+    Features features;
+    for (const auto & [name, field] : fields())
+      {
+        const auto value = values.find(name);
+        if (values.end() == value || ("0" != value->second && "1" != value->second))
+          return std::nullopt;
+
+        features.*field = "1" == value->second;
+      }
+
+    return features;
+  }
+
+  void Features::store(const std::string & key, const Features & features) noexcept
+  {
+    /* Renamed into place, a concurrent launch reads the previous table or this one. */
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(CACHE).parent_path(), ec);
+
+    const std::string temporary = CACHE + "." + std::to_string(getpid());
+    {
+      std::ofstream file(temporary, std::ios::trunc);
+      file << key << "\n";
+      for (const auto & [name, field] : fields())
+        file << name << "=" << (features.*field ? 1 : 0) << "\n";
+      if (!file.flush())
+        ec = std::make_error_code(std::errc::io_error);
+    }
+
+    if (ec || -1 == rename(temporary.c_str(), CACHE.c_str()))
+      {
+        unlink(temporary.c_str());
+        LOG_WARNING << "Cannot cache the kernel features in " << CACHE;
+      }
+  }
+
+  const Features & Features::get() noexcept
+  {
+    static const Features features = []() {
+      const std::string key = Features::key();
+      if (const auto cached = load(key); cached.has_value())
+        return *cached;
+
+      const Features probed = probe();
+      store(key, probed);
+
+      LOG_DEBUG << "Probing the kernel features...✓";
+      return probed;
+    }();
+
+    return features;
+  }
+
+  nlohmann::json Features::to_json() const noexcept
+  {
+    nlohmann::json json = nlohmann::json::object();
+    for (const auto & [name, field] : fields())
+      json[name] = this->*field;
+
+    return json;
+  }
+} // namespace bonding::environment
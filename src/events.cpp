@@ -0,0 +1,385 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/events.h"
+#include "include/id.h"
+#include "logging.h"
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace bonding::events
+{
+  struct alignas(64) Ring::Header
+  {
+    uint64_t magic;
+
+    /** The sequence number of the next event */
+    uint64_t head;
+
+    /** Bumped by every event, the futex the subscribers sleep on */
+    uint32_t signal;
+
+    /** The subscribers sleeping, or about to */
+    uint32_t waiters;
+  };
+
+  struct alignas(64) Ring::Slot
+  {
+    /** 2 * sequence + 1 while written, 2 * sequence + 2 once published */
+    uint64_t seq;
+    Event    event;
+  };
+
+  namespace
+  {
+    int64_t now() noexcept
+    {
+      timespec time = {};
+      clock_gettime(CLOCK_REALTIME, &time);
+      return time.tv_sec * 1000000000LL + time.tv_nsec;
+    }
+
+    long futex(uint32_t * word, const int op, const uint32_t value, const timespec * timeout)
+    {
+      return ::syscall(SYS_futex, word, op, value, timeout, nullptr, 0);
+    }
+  } // namespace
+
+  const char * Event::to_string(const Type type) noexcept
+  {
+    switch (type)
+      {
+      case Type::Started:
+        return "started";
+      case Type::Exited:
+        return "exited";
+      case Type::Oom:
+        return "oom";
+      case Type::Throttled:
+        return "throttled";
+      }
+
+    return "unknown";
+  }
+
+  nlohmann::json Event::to_json() const noexcept
+  {
+    return {
+      {"event", to_string(type)},
+      {"id", id},
+      {"name", name},
+      {"pid", pid},
+      {"value", value},
+      {"time", time}};
+  }
+
+  Ring::~Ring()
+  {
+    if (nullptr != m_map)
+      munmap(m_map, HEADER_SIZE + SLOTS * sizeof(Slot));
+  }
+
+  std::expected<Ring, error::Err> Ring::open() noexcept
+  {
+    const size_t size = HEADER_SIZE + SLOTS * sizeof(Slot);
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(PATH).parent_path(), ec);
+
+    const int fd = ::open(PATH.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (-1 == fd)
+      return std::unexpected(ERR_MSG(error::Code::Container, "Cannot open " + PATH));
+
+    struct stat st = {};
+    if (-1 == fstat(fd, &st)
+        || (static_cast<size_t>(st.st_size) < size && -1 == ftruncate(fd, size)))
+      {
+        close(fd);
+        return std::unexpected(ERR_MSG(error::Code::Container, "Cannot extend " + PATH));
+      }
+
+    void * map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map)
+      return std::unexpected(ERR_MSG(error::Code::Container, "Cannot map " + PATH));
+
+    Ring ring(map);
+
+    uint64_t                  expected = 0;
+    std::atomic_ref<uint64_t> magic(ring.header().magic);
+    if (!magic.compare_exchange_strong(expected, MAGIC) && MAGIC != expected)
+      return std::unexpected(
+        ERR_MSG(error::Code::Container, PATH + " was written by another bonding version"));
+
+    return ring;
+  }
+
+  Ring::Header & Ring::header() const noexcept { return *static_cast<Header *>(m_map); }
+
+  Ring::Slot & Ring::slot(const uint64_t sequence) const noexcept
+  {
+    return static_cast<Slot *>(static_cast<void *>(
+      static_cast<char *>(m_map) + HEADER_SIZE))[sequence & (SLOTS - 1)];
+  }
+
+  Publisher::Publisher(Ring ring, const config::Container_Options & options) noexcept
+    : Ring(std::move(ring))
+    , m_id(options.id)
+    , m_name(options.name)
+  {}
+
+  std::expected<Publisher, error::Err>
+    Publisher::open(const config::Container_Options & options) noexcept
+  {
+    return Ring::open().transform(
+      [&](Ring ring) { return Publisher(std::move(ring), options); });
+  }
+
+  void Publisher::publish(const Event::Type type, const pid_t pid, const int64_t value) noexcept
+  {
+    Event event = {.type = type, .pid = pid, .value = value, .time = now()};
+    snprintf(event.id, sizeof(event.id), "%s", m_id.c_str());
+    snprintf(event.name, sizeof(event.name), "%s", m_name.c_str());
+
+    Header &       head = header();
+    const uint64_t sequence =
+      std::atomic_ref<uint64_t>(head.head).fetch_add(1, std::memory_order_acq_rel);
+
+    Slot &                    s = slot(sequence);
+    std::atomic_ref<uint64_t> seq(s.seq);
+    seq.store(2 * sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    s.event = event;
+    seq.store(2 * sequence + 2, std::memory_order_release);
+
+    /* Nobody sleeps most of the time, then publishing is only memory writes. */
+    std::atomic_ref<uint32_t>(head.signal).fetch_add(1, std::memory_order_seq_cst);
+    if (0 != std::atomic_ref<uint32_t>(head.waiters).load(std::memory_order_seq_cst))
+      futex(&head.signal, FUTEX_WAKE, INT_MAX, nullptr);
+  }
+
+  Subscriber::Subscriber(Ring ring) noexcept : Ring(std::move(ring))
+  {
+    m_next = std::atomic_ref<uint64_t>(header().head).load(std::memory_order_acquire);
+  }
+
+  std::expected<Subscriber, error::Err> Subscriber::open() noexcept
+  {
+    return Ring::open().transform([](Ring ring) { return Subscriber(std::move(ring)); });
+  }
+
+  bool Subscriber::wait(const std::chrono::steady_clock::time_point deadline) noexcept
+  {
+    Header &                  head = header();
+    std::atomic_ref<uint32_t> signal(head.signal);
+    std::atomic_ref<uint32_t> waiters(head.waiters);
+
+    const uint32_t observed = signal.load(std::memory_order_seq_cst);
+    waiters.fetch_add(1, std::memory_order_seq_cst);
+
+    bool woken = true;
+    if (m_next == std::atomic_ref<uint64_t>(head.head).load(std::memory_order_seq_cst))
+      {
+        const auto left = deadline - std::chrono::steady_clock::now();
+        if (left <= std::chrono::nanoseconds::zero())
+          woken = false;
+        else
+          {
+            const auto     ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left);
+            const timespec timeout = {
+              .tv_sec = ns.count() / 1000000000LL, .tv_nsec = ns.count() % 1000000000LL};
+
+            if (-1 == futex(&head.signal, FUTEX_WAIT, observed, &timeout)
+                && ETIMEDOUT == errno)
+              woken = false;
+          }
+      }
+
+    waiters.fetch_sub(1, std::memory_order_seq_cst);
+    return woken;
+  }
+
+  std::optional<Event>
+    Subscriber::next(const std::chrono::milliseconds timeout) noexcept
+  {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    for (int spins = 0;;)
+      {
+        const uint64_t head =
+          std::atomic_ref<uint64_t>(header().head).load(std::memory_order_acquire);
+
+        /* Lapped: the oldest events still in the ring are the ones to read. */
+        if (head - m_next > SLOTS)
+          {
+            m_lost += head - SLOTS - m_next;
+            m_next = head - SLOTS;
+          }
+
+        if (m_next == head)
+          {
+            if (!wait(deadline))
+              return std::nullopt;
+
+            continue;
+          }
+
+        Slot &                    s = slot(m_next);
+        std::atomic_ref<uint64_t> seq(s.seq);
+        const uint64_t            published = 2 * m_next + 2;
+        const uint64_t            begin = seq.load(std::memory_order_acquire);
+
+        if (begin == published)
+          {
+            const Event event = s.event;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (begin == seq.load(std::memory_order_relaxed))
+              {
+                ++m_next;
+                return event;
+              }
+          }
+        else if (begin < published && ++spins < STALLED_SPINS)
+          {
+            /* The producer took the sequence number and is filling the slot. */
+            std::this_thread::yield();
+            continue;
+          }
+
+        /* Overwritten under us, or its producer died while filling it. */
+        if (begin < published)
+          {
+            ++m_lost;
+            ++m_next;
+          }
+
+        spins = 0;
+      }
+  }
+
+  int Monitor::watch_oom(const std::string & cgroup) noexcept
+  {
+    const int control = ::open((cgroup + "/memory.oom_control").c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 == control)
+      return -1;
+
+    const int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    const std::string registration =
+      std::to_string(efd) + " " + std::to_string(control);
+
+    const int  events = ::open((cgroup + "/cgroup.event_control").c_str(), O_WRONLY | O_CLOEXEC);
+    const bool registered = -1 != efd && -1 != events
+                            && static_cast<ssize_t>(registration.size())
+                                 == write(events, registration.c_str(), registration.size());
+
+    /* The kernel keeps its own references once registered. */
+    close(control);
+    if (-1 != events)
+      close(events);
+
+    if (!registered)
+      {
+        if (-1 != efd)
+          close(efd);
+        return -1;
+      }
+
+    return efd;
+  }
+
+  uint64_t Monitor::throttled(const std::string & cpu_stat) noexcept
+  {
+    char      buffer[512] = {0};
+    const int fd = ::open(cpu_stat.c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 == fd)
+      return 0;
+
+    const ssize_t size = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+
+    const char * field = size > 0 ? strstr(buffer, "nr_throttled ") : nullptr;
+    return nullptr == field ? 0 : strtoull(field + strlen("nr_throttled "), nullptr, 10);
+  }
+
+  std::expected<void, error::Err> Monitor::start(
+    const config::Container_Options & options, Publisher & publisher, const pid_t pid) noexcept
+  {
+    const std::string cgroup = id::Id::cgroup_of(options.id);
+
+    for (const auto & control : options.cgroups_options)
+      if (control.control == "memory")
+        m_oom = watch_oom("/sys/fs/cgroup/memory/" + cgroup);
+      else if (control.control == "cpu")
+        m_cpu_stat = "/sys/fs/cgroup/cpu/" + cgroup + "/cpu.stat";
+
+    if (-1 == m_oom && m_cpu_stat.empty())
+      return {};
+
+    if (-1 == pipe2(m_wakeup, O_CLOEXEC))
+      return std::unexpected(ERR(error::Code::Container));
+
+    m_thread = std::thread(&Monitor::loop, this, std::ref(publisher), pid);
+
+    LOG_DEBUG << "Monitoring the cgroups of the container...✓";
+    return {};
+  }
+
+  void Monitor::loop(Publisher & publisher, const pid_t pid) noexcept
+  {
+    uint64_t last = m_cpu_stat.empty() ? 0 : throttled(m_cpu_stat);
+    const int interval = m_cpu_stat.empty() ? -1 : THROTTLE_INTERVAL.count();
+
+    while (true)
+      {
+        pollfd fds[2] = {
+          {.fd = m_wakeup[0], .events = POLLIN, .revents = 0},
+          {.fd = m_oom, .events = POLLIN, .revents = 0}};
+
+        if (-1 == poll(fds, -1 == m_oom ? 1 : 2, interval) && EINTR != errno)
+          return;
+
+        if (0 != fds[0].revents)
+          return;
+
+        uint64_t ooms = 0;
+        if (0 != fds[1].revents && sizeof(ooms) == read(m_oom, &ooms, sizeof(ooms)))
+          publisher.publish(Event::Type::Oom, pid, ooms);
+
+        if (!m_cpu_stat.empty())
+          if (const uint64_t current = throttled(m_cpu_stat); current > last)
+            {
+              publisher.publish(Event::Type::Throttled, pid, current - last);
+              last = current;
+            }
+      }
+  }
+
+  void Monitor::stop() noexcept
+  {
+    if (m_thread.joinable())
+      {
+        if (1 == write(m_wakeup[1], "", 1))
+          m_thread.join();
+        else
+          m_thread.detach();
+      }
+
+    for (const int fd : {m_oom, m_wakeup[0], m_wakeup[1]})
+      if (-1 != fd)
+        close(fd);
+
+    m_oom = m_wakeup[0] = m_wakeup[1] = -1;
+  }
+} // namespace bonding::events
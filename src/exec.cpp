@@ -1,24 +1,175 @@
 /** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
 
 #include "include/exec.h"
+#include "include/error.h"
+#include "include/handoff.h"
+#include "include/unix.h"
+#include "logging.h"
 #include <algorithm>
-#include <iterator>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <sys/syscall.h>
 #include <unistd.h>
-#include "include/error.h"
 
 namespace bonding::exec
 {
-  std::expected<void, error::Err>
-    Execve::call(const std::string &path, const std::vector<std::string> &argv) noexcept
+  Arguments::Arguments(const std::vector<std::string> & argv,
+                       const std::vector<std::string> & env) noexcept
+  {
+    /* The two arrays first, then the strings they point to. */
+    const size_t pointers = argv.size() + 1 + env.size() + 1;
+    size_t       size = pointers * sizeof(char *);
+    for (const auto * strings : {&argv, &env})
+      for (const auto & string : *strings)
+        size += string.size() + 1;
+
+    m_block.reset(new char[size]);
+    m_argv = reinterpret_cast<char **>(m_block.get());
+    m_envp = m_argv + argv.size() + 1;
+
+    char *  string = m_block.get() + pointers * sizeof(char *);
+    char ** array = m_argv;
+    for (const auto * strings : {&argv, &env})
+      {
+        for (const auto & s : *strings)
+          {
+            memcpy(string, s.c_str(), s.size() + 1);
+            *array++ = string;
+            string += s.size() + 1;
+          }
+
+        *array++ = nullptr;
+      }
+  }
+
+  void Execve::prepare(const config::Container_Options & options,
+                       const std::string &               new_root) noexcept
+  {
+    /* The jobs of a batch are executed by name. */
+    if (!options.batch_queue.empty() || !options.path.starts_with("/"))
+      return;
+
+    const unix::Fd root(open(new_root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC));
+    if (!root)
+      return;
+
+    /* Resolved as after pivot_root: through the mounts of the container and under its
+     * root, absolute symlinks included. */
+    open_how how = {};
+    how.flags = O_PATH | O_CLOEXEC;
+    how.resolve = RESOLVE_IN_ROOT;
+
+    const unix::Fd file(
+      ::syscall(SYS_openat2, root.get(), options.path.c_str(), &how, sizeof(how)));
+    if (!file)
+      {
+        LOG_DEBUG << "Cannot open the executable " << options.path << " ahead, it is "
+                  << "executed by name";
+        return;
+      }
+
+    if (script(file.get()))
+      return;
+
+    /* Out of the range of the descriptors handed to the workload, which are moved
+     * there right before the exec. */
+    executable = fcntl(file.get(), F_DUPFD_CLOEXEC, handoff::Handoff::end_of(options));
+    if (-1 != executable)
+      LOG_DEBUG << "Opening the executable " << options.path << " ahead...✓";
+  }
+
+  std::vector<std::string> Execve::with_defaults(std::vector<std::string> env) noexcept
   {
-    std::transform(
-      argv.begin(), argv.end(), std::back_inserter(args), ([](const std::string &arg) {
-      return const_cast<char *>(arg.c_str());
-    }));
+    const auto has = [&env](const std::string & prefix) {
+      return std::ranges::any_of(
+        env, [&](const std::string & var) { return var.starts_with(prefix); });
+    };
+
+    if (!has("PATH="))
+      env.push_back("PATH=" + DEFAULT_PATH);
+    if (!has("HOME="))
+      env.push_back("HOME=/");
 
-    // const auto x = &args[0];
-    if (-1 == execve(path.c_str(), static_cast<char *const *>(&args[0]), nullptr))
+    return env;
+  }
+
+  std::expected<void, error::Err> Execve::call(
+    const std::string &              path,
+    const std::vector<std::string> & argv,
+    const std::vector<std::string> & env) noexcept
+  {
+    const Arguments arguments(argv, env);
+
+    if (-1 == execve(path.c_str(), arguments.argv(), arguments.envp()))
       return std::unexpected(ERR(error::Code::Exec));
     return {};
   }
-} // namespace bonding::exec
\ No newline at end of file
+
+  std::expected<void, error::Err> Execve::call(
+    const config::Container_Options & options,
+    const std::vector<std::string> &  argv,
+    const std::vector<std::string> &  env) noexcept
+  {
+    if (-1 == executable)
+      return call(options.path, argv, env);
+
+    const Arguments arguments(argv, env);
+
+    ::syscall(SYS_execveat, executable, "", arguments.argv(), arguments.envp(), AT_EMPTY_PATH);
+
+    /* A format which the kernel reads from a path only, a script passing as a binary. */
+    if (ENOEXEC == errno || ENOENT == errno)
+      return call(options.path, argv, env);
+    return std::unexpected(ERR(error::Code::Exec));
+  }
+
+  std::expected<void, error::Err> Execve::search(
+    const std::vector<std::string> & argv, const std::vector<std::string> & env) noexcept
+  {
+    if (std::string::npos != argv[0].find('/'))
+      return call(argv[0], argv, env);
+
+    std::string path = DEFAULT_PATH;
+    for (const auto & var : env)
+      if (var.starts_with("PATH="))
+        path = var.substr(5);
+
+    const Arguments arguments(argv, env);
+    bool            denied = false;
+    for (size_t begin = 0, end = 0; begin <= path.size(); begin = end + 1)
+      {
+        end = std::min(path.find(':', begin), path.size());
+
+        /* An empty entry is the working directory. */
+        const std::string dir = end == begin ? "." : path.substr(begin, end - begin);
+        execve((dir + "/" + argv[0]).c_str(), arguments.argv(), arguments.envp());
+
+        /* As execvpe(), a directory the command is not found in is skipped, as well as
+         * one it cannot be executed from, unless no other has it. */
+        if (EACCES == errno)
+          denied = true;
+        else if (ENOENT != errno && ENOTDIR != errno && ESTALE != errno && ENODEV != errno
+                 && ETIMEDOUT != errno)
+          return std::unexpected(ERR_MSG(error::Code::Exec, "Cannot execute " + argv[0]));
+      }
+
+    errno = denied ? EACCES : ENOENT;
+    return std::unexpected(
+      ERR_MSG(error::Code::Exec, "Cannot find " + argv[0] + " in " + path));
+  }
+
+  bool Execve::script(const int file) noexcept
+  {
+    /* A descriptor opened with O_PATH is read through a new open of its own. */
+    const unix::Fd readable(
+      open(("/proc/self/fd/" + std::to_string(file)).c_str(), O_RDONLY | O_CLOEXEC));
+    if (!readable)
+      return false;
+
+    char magic[2] = {0};
+    return sizeof(magic) == read(readable.get(), magic, sizeof(magic)) && '#' == magic[0]
+           && '!' == magic[1];
+  }
+} // namespace bonding::exec
@@ -0,0 +1,124 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/gc.h"
+#include "include/environment.h"
+#include "include/id.h"
+#include "include/image.h"
+#include "include/resource.h"
+#include "include/store.h"
+#include "logging.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <thread>
+#include <unistd.h>
+
+namespace bonding::gc
+{
+  std::vector<std::string> Collector::hierarchies() noexcept
+  {
+    std::vector<std::string> roots;
+
+    /* cgroups v2 mounts a single hierarchy at the root. */
+    if (environment::Features::get().cgroup_v2)
+      return {CGROUP_ROOT};
+
+    /* The co-mounted controllers are also linked under each of their names. */
+    std::error_code ec;
+    for (const auto & entry : std::filesystem::directory_iterator(CGROUP_ROOT, ec))
+      if (!entry.is_symlink(ec) && entry.is_directory(ec))
+        roots.push_back(entry.path().string() + "/");
+
+    return roots;
+  }
+
+  std::vector<reaper::Job> Collector::orphans() noexcept
+  {
+    std::set<std::string> recorded;
+    if (auto store = store::Store::open(); store.has_value())
+      for (const auto & entry : store->list())
+        recorded.insert(entry.record.id);
+
+    const std::vector<std::string> roots = hierarchies();
+
+    std::vector<reaper::Job> jobs;
+    for (const auto & id : id::Id::claimed())
+      {
+        if (recorded.contains(id))
+          continue;
+
+        /* Without a readable marker, the owner may be claiming the id right now. */
+        const id::Id::Owner owner = id::Id::owner_of(id);
+        if (id::Id::Owner::Running == owner
+            || (id::Id::Owner::Unknown == owner && id::Id::age(id).value_or(GRACE) < GRACE))
+          continue;
+
+        reaper::Job job = {.cgroups = {}, .id = id, .slot = std::nullopt, .owner = getpid()};
+        for (const auto & root : roots)
+          if (const std::string dir = root + id::Id::cgroup_of(id);
+              0 == access(dir.c_str(), F_OK))
+            job.cgroups.push_back(dir);
+
+        jobs.push_back(std::move(job));
+      }
+
+    /* The idle cgroups claimed from the pool by a launch which then crashed. */
+    std::map<std::string, reaper::Job> idle;
+    for (const auto & root : roots)
+      {
+        std::error_code ec;
+        for (const auto & shard :
+             std::filesystem::directory_iterator(root + id::Id::cgroup_root(), ec))
+          for (const auto & entry : std::filesystem::directory_iterator(shard.path(), ec))
+            if (const auto id = resource::Pool::idle_id(entry.path().filename().string());
+                id.has_value() && !resource::Pool::pooled(*id))
+              idle[*id].cgroups.push_back(entry.path().string());
+      }
+
+    for (auto & [id, job] : idle)
+      {
+        job.owner = getpid();
+        jobs.push_back(std::move(job));
+      }
+
+    return jobs;
+  }
+
+  std::expected<void, error::Err> Collector::collect() noexcept
+  {
+    resource::Pool::shrink();
+    image::Image::collect();
+
+    const std::vector<reaper::Job> jobs = orphans();
+    if (jobs.empty())
+      {
+        LOG_INFO << "Nothing to collect";
+        return {};
+      }
+
+    const size_t workers =
+      std::clamp<size_t>(std::thread::hardware_concurrency(), 1, MAX_WORKERS);
+
+    /* A batch at a time, the kernel is not flooded with thousands of rmdir() at once. */
+    for (size_t begin = 0; begin < jobs.size(); begin += BATCH)
+      {
+        const size_t        end = std::min(begin + BATCH, jobs.size());
+        std::atomic<size_t> next{begin};
+
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < std::min(workers, end - begin); ++i)
+          threads.emplace_back([&]() {
+            for (size_t job = next++; job < end; job = next++)
+              reaper::Reaper::run(jobs[job]);
+          });
+
+        for (auto & thread : threads)
+          thread.join();
+      }
+
+    LOG_INFO << "Collecting " << jobs.size() << " leaked containers...✓";
+    return {};
+  }
+} // namespace bonding::gc
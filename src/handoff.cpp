@@ -0,0 +1,201 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/handoff.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace bonding::handoff
+{
+  std::expected<int, error::Err> Listener::open(const std::string & address) noexcept
+  {
+    if (address.starts_with("unix:"))
+      return open_unix(address.substr(5));
+
+    const std::string inet = address.starts_with("tcp:") ? address.substr(4) : address;
+    const size_t      colon = inet.find_last_of(':');
+    if (std::string::npos == colon)
+      return std::unexpected(
+        ERR_MSG(error::Code::Socket, "Invalid listen address " + address));
+
+    std::string host = inet.substr(0, colon);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+      host = host.substr(1, host.size() - 2);
+
+    return open_tcp(host, inet.substr(colon + 1));
+  }
+
+  std::expected<int, error::Err> Listener::open_unix(const std::string & path) noexcept
+  {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+      return std::unexpected(
+        ERR_MSG(error::Code::Socket, "Unix socket path too long: " + path));
+
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == fd)
+      return std::unexpected(ERR(error::Code::Socket));
+
+    /* A stale socket file left by a dead process would make bind() fail. */
+    unlink(path.c_str());
+
+    if (-1 == bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))
+        || -1 == listen(fd, BACKLOG))
+      {
+        close(fd);
+        return std::unexpected(ERR_MSG(error::Code::Socket, "Cannot listen on " + path));
+      }
+
+    LOG_INFO << "Listening on unix:" << path << "...✓";
+    return fd;
+  }
+
+  std::expected<int, error::Err>
+    Listener::open_tcp(const std::string & host, const std::string & port) noexcept
+  {
+    addrinfo   hints = {};
+    addrinfo * result = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+    if (
+      0
+      != getaddrinfo(
+        (host.empty() || host == "*") ? nullptr : host.c_str(), port.c_str(), &hints, &result))
+      return std::unexpected(
+        ERR_MSG(error::Code::Socket, "Cannot resolve listen address " + host + ":" + port));
+
+    int fd = -1;
+    for (addrinfo * ai = result; nullptr != ai && -1 == fd; ai = ai->ai_next)
+      {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (-1 == fd)
+          continue;
+
+        const int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        if (-1 == bind(fd, ai->ai_addr, ai->ai_addrlen) || -1 == listen(fd, BACKLOG))
+          {
+            close(fd);
+            fd = -1;
+          }
+      }
+
+    freeaddrinfo(result);
+
+    if (-1 == fd)
+      return std::unexpected(
+        ERR_MSG(error::Code::Socket, "Cannot listen on " + host + ":" + port));
+
+    LOG_INFO << "Listening on " << host << ":" << port << "...✓";
+    return fd;
+  }
+
+  std::expected<void, error::Err> Handoff::prepare(
+    config::Container_Options & options, std::vector<config::Passed_Fd> inherited) noexcept
+  {
+    std::vector<config::Passed_Fd> fds;
+
+    /* Listeners come first and in the configuration order, so that the workload
+     * can find them by position. */
+    for (const auto & address : options.listen)
+      {
+        const auto it = std::find_if(
+          inherited.begin(), inherited.end(), [&](const config::Passed_Fd & fd) {
+          return fd.address == address;
+        });
+
+        if (it != inherited.end())
+          {
+            LOG_INFO << "Taking over listener " << address << "...✓";
+            fds.push_back(*it);
+            inherited.erase(it);
+          }
+        else
+          fds.push_back(config::Passed_Fd{"listen", address, Listener::open(address).value()});
+      }
+
+    for (const auto & fd : inherited)
+      {
+        if (fd.address.empty())
+          fds.push_back(fd);
+        else
+          {
+            LOG_WARNING << "Listener " << fd.address << " is no longer configured, closing it";
+            close(fd.fd);
+          }
+      }
+
+    options.fds = std::move(fds);
+
+    int notify[2] = {-1, -1};
+    if (-1 == socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, notify))
+      return std::unexpected(ERR(error::Code::Socket));
+
+    options.notify_socket = std::make_pair(notify[0], notify[1]);
+    return {};
+  }
+
+  std::expected<std::vector<std::string>, error::Err>
+    Handoff::install(const config::Container_Options & options) noexcept
+  {
+    std::vector<int> sources;
+    for (const auto & fd : options.fds)
+      sources.push_back(fd.fd);
+    sources.push_back(options.notify_socket.second);
+
+    /* Move every descriptor above the target range first, so that a dup2() never
+     * overwrites a descriptor which has not been moved yet. */
+    const int        base = end_of(options);
+    std::vector<int> moved;
+    for (const int fd : sources)
+      {
+        const int high = fcntl(fd, F_DUPFD_CLOEXEC, base);
+        if (-1 == high)
+          return std::unexpected(ERR(error::Code::Exec));
+
+        moved.push_back(high);
+      }
+
+    for (size_t i = 0; i < moved.size(); ++i)
+      {
+        /* The duplicated descriptor does not inherit FD_CLOEXEC. */
+        if (-1 == dup2(moved[i], LISTEN_FDS_START + static_cast<int>(i)))
+          return std::unexpected(ERR(error::Code::Exec));
+
+        close(moved[i]);
+      }
+
+    std::string names;
+    for (const auto & fd : options.fds)
+      names += (names.empty() ? "" : ":") + fd.name;
+
+    std::vector<std::string> env = {
+      "BONDING_NOTIFY_FD=" + std::to_string(LISTEN_FDS_START + options.fds.size())};
+
+    if (!options.fds.empty())
+      {
+        env.push_back("LISTEN_FDS=" + std::to_string(options.fds.size()));
+        env.push_back("LISTEN_PID=" + std::to_string(getpid()));
+        env.push_back("LISTEN_FDNAMES=" + names);
+      }
+
+    LOG_DEBUG << "Handing " << options.fds.size() << " descriptors to the workload...✓";
+    return env;
+  }
+
+  int Handoff::end_of(const config::Container_Options & options) noexcept
+  {
+    /* The passed descriptors, then the notify socket */
+    return LISTEN_FDS_START + static_cast<int>(options.fds.size()) + 1;
+  }
+} // namespace bonding::handoff
@@ -0,0 +1,204 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/id.h"
+#include "include/resource.h"
+#include "include/store.h"
+#include "logging.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bonding::id
+{
+  std::string Id::generate() noexcept
+  {
+    uint64_t value = 0;
+
+    /* Without the entropy pool, fall back to what differs between two processes. */
+    if (sizeof(value) != getrandom(&value, sizeof(value), GRND_NONBLOCK))
+      {
+        static std::atomic<uint64_t> counter{0};
+        value = std::chrono::steady_clock::now().time_since_epoch().count()
+                ^ (static_cast<uint64_t>(getpid()) << 40)
+                ^ (counter.fetch_add(1, std::memory_order_relaxed) * 0x9E3779B97F4A7C15ULL);
+      }
+
+    char id[17] = {0};
+    snprintf(id, sizeof(id), "%016lx", value);
+    return id;
+  }
+
+  std::string Id::sharded(const std::string & id) noexcept
+  {
+    return id.substr(0, SHARD_DIGITS) + "/" + id;
+  }
+
+  std::string Id::marker_of(const std::string & id) noexcept
+  {
+    return STATE_DIR + sharded(id) + MARKER;
+  }
+
+  std::string Id::owner() noexcept
+  {
+    return std::to_string(getpid()) + " " + std::to_string(store::Store::start_time(getpid()))
+           + "\n";
+  }
+
+  void Id::mark(const std::string & id) noexcept
+  {
+    const std::string marker = marker_of(id);
+    const std::string temporary = marker + "." + std::to_string(getpid());
+    const std::string content = owner();
+
+    /* Renamed over the previous one, a crash never leaves a marker half-written. */
+    const int  fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    const bool written = -1 != fd
+                         && static_cast<ssize_t>(content.size())
+                              == write(fd, content.c_str(), content.size());
+    if (-1 != fd)
+      close(fd);
+
+    if (!written || -1 == rename(temporary.c_str(), marker.c_str()))
+      {
+        unlink(temporary.c_str());
+        LOG_WARNING << "Cannot take over the container " << id;
+      }
+  }
+
+  void Id::unmark(const std::string & id) noexcept
+  {
+    if (-1 == unlink(marker_of(id).c_str()) && ENOENT != errno)
+      LOG_WARNING << "Cannot remove " << marker_of(id);
+  }
+
+  Id::Owner Id::owner_of(const std::string & id) noexcept
+  {
+    std::ifstream marker(marker_of(id));
+
+    pid_t    pid = 0;
+    uint64_t start = 0;
+    if (!(marker >> pid >> start) || pid <= 0)
+      return Owner::Unknown;
+
+    /* The start time tells the owner apart from a later process reusing its pid. */
+    return start == store::Store::start_time(pid) ? Owner::Running : Owner::Gone;
+  }
+
+  std::optional<std::chrono::seconds> Id::age(const std::string & id) noexcept
+  {
+    struct stat st = {};
+    if (-1 == stat(marker_of(id).c_str(), &st) && -1 == stat(state_dir(id).c_str(), &st))
+      return std::nullopt;
+
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::seconds>(now)
+           - std::chrono::seconds(st.st_mtime);
+  }
+
+  std::vector<std::string> Id::claimed() noexcept
+  {
+    std::set<std::string> ids;
+
+    std::error_code ec;
+    for (const auto & shard : std::filesystem::directory_iterator(STATE_DIR, ec))
+      for (const auto & entry : std::filesystem::directory_iterator(shard.path(), ec))
+        {
+          std::string name = entry.path().filename().string();
+          if (name.size() > MARKER.size() && name.ends_with(MARKER))
+            name.resize(name.size() - MARKER.size());
+          else if (!entry.is_directory(ec))
+            continue;
+
+          ids.insert(name);
+        }
+
+    return {ids.begin(), ids.end()};
+  }
+
+  std::string Id::state_dir(const std::string & id) noexcept
+  {
+    return STATE_DIR + sharded(id) + "/";
+  }
+
+  std::string Id::cgroup_root() noexcept { return CGROUP_DIR; }
+
+  std::string Id::cgroup_of(const std::string & id) noexcept
+  {
+    return CGROUP_DIR + sharded(id);
+  }
+
+  bool Id::valid_name(const std::string & name) noexcept
+  {
+    return !name.empty() && name.size() <= 64 && '.' != name.front()
+           && std::string::npos == name.find('/');
+  }
+
+  std::expected<void, error::Err>
+    Id::prepare(config::Container_Options & options) noexcept
+  {
+    /* cgroups v1 renames a cgroup within its parent only, the shard is the pool's. */
+    const std::optional<std::string> recycled =
+      resource::Pool::take(resource::Pool::key_of(options));
+
+    for (int attempt = 0; attempt < ATTEMPTS; ++attempt)
+      {
+        std::string id = generate();
+        if (recycled.has_value())
+          id.replace(0, SHARD_DIGITS, *recycled, 0, SHARD_DIGITS);
+
+        const std::string dir = state_dir(id);
+        const std::string marker = marker_of(id);
+
+        /* The shard is shared, only the exclusive creation of the marker claims the id. */
+        std::error_code ec;
+        std::filesystem::create_directories(STATE_DIR + id.substr(0, SHARD_DIGITS), ec);
+        if (ec)
+          return std::unexpected(
+            ERR_MSG(error::Code::Container, "Cannot create the state directory " + dir));
+
+        const int fd = open(marker.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (-1 == fd)
+          {
+            if (EEXIST == errno)
+              continue;
+
+            return std::unexpected(ERR_MSG(error::Code::Container, "Cannot create " + marker));
+          }
+
+        const std::string content = owner();
+        const bool        written =
+          static_cast<ssize_t>(content.size()) == write(fd, content.c_str(), content.size());
+        close(fd);
+
+        if (!written || -1 == mkdir(dir.c_str(), 0700))
+          {
+            const bool collision = written && EEXIST == errno;
+            unlink(marker.c_str());
+            if (collision)
+              continue;
+
+            return std::unexpected(
+              ERR_MSG(error::Code::Container, "Cannot create the state directory " + dir));
+          }
+
+        options.id = id;
+        if (options.name.empty())
+          options.name = id;
+
+        if (recycled.has_value() && !resource::Pool::adopt(*recycled, options))
+          LOG_WARNING << "Cannot reuse the cgroups of the container " << *recycled;
+
+        LOG_INFO << "Container " << options.name << " has the id " << id << "...✓";
+        return {};
+      }
+
+    return std::unexpected(ERR_MSG(error::Code::Container, "Cannot allocate a container id"));
+  }
+} // namespace bonding::id
@@ -0,0 +1,269 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/image.h"
+#include "include/oci.h"
+#include "logging.h"
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <linux/loop.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bonding::image
+{
+  std::expected<void, error::Err>
+    Image::prepare(config::Container_Options & options) noexcept
+  {
+    const bool  oci = options.mount_dir.starts_with(OCI_PREFIX);
+    struct stat st = {};
+    if (!oci && (-1 == stat(options.mount_dir.c_str(), &st) || !S_ISREG(st.st_mode)))
+      return {};
+
+    const std::vector<std::string> layers =
+      oci ? oci::Importer::layers_of(options.mount_dir.substr(OCI_PREFIX.size())).value()
+          : std::vector<std::string>{};
+
+    const std::string key = oci ? key_of(layers) : key_of(options.mount_dir);
+    const std::string dir = IMAGES_DIR + key + "/";
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+
+    /* The first container of an image mounts it, the others wait for it to. */
+    const unix::Fd lock(open((IMAGES_DIR + key + ".lock").c_str(),
+                             O_RDWR | O_CREAT | O_CLOEXEC,
+                             0600));
+    if (!lock || -1 == flock(lock.get(), LOCK_EX))
+      return std::unexpected(
+        ERR_MSG(error::Code::Mounts, "Cannot lock the image " + options.mount_dir));
+
+    /* Taken under the lock of the mount: the image is never collected in between. */
+    unix::Fd user(open((IMAGES_DIR + key + ".users").c_str(),
+                       O_RDONLY | O_CREAT | O_CLOEXEC,
+                       0600));
+    if (!user || -1 == flock(user.get(), LOCK_SH))
+      return std::unexpected(
+        ERR_MSG(error::Code::Mounts, "Cannot lock the image " + options.mount_dir));
+    users.push_back(std::move(user));
+
+    if (!mounted(dir))
+      (oci ? mount_layers(layers, dir) : mount(options.mount_dir, dir)).value();
+
+    LOG_INFO << "Using the image " << options.mount_dir << " mounted on " << dir << "...✓";
+    options.mount_dir = dir;
+    return {};
+  }
+
+  void Image::collect() noexcept
+  {
+    size_t          collected = 0;
+    std::error_code ec;
+    for (const auto & entry : std::filesystem::directory_iterator(IMAGES_DIR, ec))
+      {
+        if (!entry.is_directory(ec))
+          continue;
+
+        /* An image being mounted, or used by a supervisor, is left alone. The lock
+         * files stay: a launch may have opened them already. */
+        const std::string key = entry.path().filename().string();
+        const std::string path = IMAGES_DIR + key;
+        const unix::Fd    lock(open((path + ".lock").c_str(), O_RDWR | O_CLOEXEC));
+        const unix::Fd    user(open((path + ".users").c_str(), O_RDONLY | O_CLOEXEC));
+        if (!lock || -1 == flock(lock.get(), LOCK_EX | LOCK_NB)
+            || (user && -1 == flock(user.get(), LOCK_EX | LOCK_NB)))
+          continue;
+
+        /* The containers keep their own mounts of it, the loop device goes with them. */
+        const std::string dir = path + "/";
+        if (mounted(dir) && -1 == umount2(dir.c_str(), MNT_DETACH))
+          {
+            LOG_WARNING << "Cannot unmount the unused image " << dir;
+            continue;
+          }
+
+        rmdir(dir.c_str());
+        ++collected;
+      }
+
+    if (0 != collected)
+      LOG_INFO << "Unmounting " << collected << " unused images...✓";
+  }
+
+  std::optional<std::string> Image::type_of(const unix::Fd & image) noexcept
+  {
+    uint32_t magic = 0;
+
+    if (sizeof(magic) == pread(image.get(), &magic, sizeof(magic), 0)
+        && SQUASHFS_MAGIC == magic)
+      return "squashfs";
+
+    if (sizeof(magic) == pread(image.get(), &magic, sizeof(magic), EROFS_OFFSET)
+        && EROFS_MAGIC == magic)
+      return "erofs";
+
+    return std::nullopt;
+  }
+
+  std::string Image::key_of(const std::string & path) noexcept
+  {
+    struct stat st = {};
+    stat(path.c_str(), &st);
+
+    std::string fields;
+    for (const auto field : {
+           static_cast<uint64_t>(st.st_dev),
+           static_cast<uint64_t>(st.st_ino),
+           static_cast<uint64_t>(st.st_size),
+           static_cast<uint64_t>(st.st_mtim.tv_sec),
+           static_cast<uint64_t>(st.st_mtim.tv_nsec)})
+      fields += std::to_string(field) + ":";
+
+    return hash_of(fields);
+  }
+
+  std::string Image::key_of(const std::vector<std::string> & layers) noexcept
+  {
+    std::string stack;
+    for (const auto & layer : layers)
+      stack += layer + ":";
+
+    return hash_of(stack);
+  }
+
+  std::string Image::hash_of(const std::string & content) noexcept
+  {
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const char c : content)
+      hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+
+    char key[17] = {0};
+    snprintf(key, sizeof(key), "%016lx", hash);
+    return key;
+  }
+
+  std::expected<unix::Fd, error::Err> Image::attach(const unix::Fd & image) noexcept
+  {
+    const unix::Fd control(open("/dev/loop-control", O_RDWR | O_CLOEXEC));
+    if (!control)
+      return std::unexpected(ERR_MSG(error::Code::Mounts, "Cannot open /dev/loop-control"));
+
+    for (int attempt = 0; attempt < ATTEMPTS; ++attempt)
+      {
+        const int number = ioctl(control.get(), LOOP_CTL_GET_FREE);
+        if (-1 == number)
+          break;
+
+        unix::Fd loop(open(("/dev/loop" + std::to_string(number)).c_str(),
+                           O_RDONLY | O_CLOEXEC));
+        if (!loop)
+          break;
+
+        /* Freed by the kernel once the last mount of the image is gone. */
+        loop_config config = {};
+        config.fd = image.get();
+        config.info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR | LO_FLAGS_DIRECT_IO;
+
+        if (0 == ioctl(loop.get(), LOOP_CONFIGURE, &config))
+          return loop;
+
+        /* Direct I/O takes a backing filesystem which supports it. */
+        config.info.lo_flags &= ~LO_FLAGS_DIRECT_IO;
+        if (EINVAL == errno && 0 == ioctl(loop.get(), LOOP_CONFIGURE, &config))
+          return loop;
+
+        /* LOOP_CONFIGURE needs Linux 5.8, the older way takes two calls. */
+        if ((EINVAL == errno || ENOTTY == errno)
+            && 0 == ioctl(loop.get(), LOOP_SET_FD, image.get()))
+          {
+            if (0 == ioctl(loop.get(), LOOP_SET_STATUS64, &config.info))
+              return loop;
+
+            ioctl(loop.get(), LOOP_CLR_FD, 0);
+          }
+
+        if (EBUSY != errno)
+          break;
+      }
+
+    return std::unexpected(ERR_MSG(error::Code::Mounts, "Cannot attach a loop device"));
+  }
+
+  std::expected<void, error::Err>
+    Image::mount(const std::string & path, const std::string & dir) noexcept
+  {
+    const unix::Fd image(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!image)
+      return std::unexpected(ERR_MSG(error::Code::Mounts, "Cannot open the image " + path));
+
+    const auto type = type_of(image);
+    if (!type.has_value())
+      return std::unexpected(
+        ERR_MSG(error::Code::Mounts, path + " is neither an EROFS nor a squashfs image"));
+
+    const unix::Fd loop = attach(image).value();
+
+    char device[64] = {0};
+    snprintf(device, sizeof(device), "/proc/self/fd/%d", loop.get());
+
+    if (-1 == ::mount(device, dir.c_str(), type->c_str(), MS_RDONLY, nullptr))
+      return std::unexpected(
+        ERR_MSG(error::Code::Mounts, "Cannot mount the image " + path + " on " + dir));
+
+    LOG_INFO << "Mount the " << *type << " image " << path << " on " << dir << "...✓";
+    return {};
+  }
+
+  std::expected<void, error::Err> Image::mount_layers(
+    const std::vector<std::string> & layers, const std::string & dir) noexcept
+  {
+    if (layers.empty())
+      return std::unexpected(ERR_MSG(error::Code::Mounts, "An image without any layer"));
+
+    /* overlayfs stacks two lower layers at least, a single one is bound read-only. No
+     * device node of a layer is usable, the whiteouts are read by overlayfs itself. */
+    bool mounted = false;
+    if (1 == layers.size())
+      {
+        const unsigned long read_only = MS_REMOUNT | MS_BIND | MS_RDONLY | MS_NODEV;
+        mounted = 0 == ::mount(layers.front().c_str(), dir.c_str(), nullptr, MS_BIND, nullptr)
+                  && 0 == ::mount(nullptr, dir.c_str(), nullptr, read_only, nullptr);
+      }
+    else
+      {
+        /* The uppermost layer comes first. */
+        std::string data = "lowerdir=";
+        for (auto layer = layers.rbegin(); layer != layers.rend(); ++layer)
+          data += *layer + (std::next(layer) == layers.rend() ? "" : ":");
+
+        mounted =
+          0 == ::mount("overlay", dir.c_str(), "overlay", MS_RDONLY | MS_NODEV, data.c_str());
+      }
+
+    if (!mounted)
+      return std::unexpected(
+        ERR_MSG(error::Code::Mounts, "Cannot stack the " + std::to_string(layers.size())
+                                       + " layers of the image on " + dir));
+
+    LOG_INFO << "Stack " << layers.size() << " layers on " << dir << "...✓";
+    return {};
+  }
+
+  bool Image::mounted(const std::string & dir) noexcept
+  {
+    /* A bind mount is on the same device as its parent, the kernel tells it apart. */
+    struct statx mount_root = {};
+    if (0 == statx(AT_FDCWD, dir.c_str(), AT_SYMLINK_NOFOLLOW, 0, &mount_root)
+        && 0 != (mount_root.stx_attributes_mask & STATX_ATTR_MOUNT_ROOT))
+      return 0 != (mount_root.stx_attributes & STATX_ATTR_MOUNT_ROOT);
+
+    struct stat self = {}, parent = {};
+    return 0 == stat(dir.c_str(), &self) && 0 == stat((dir + "..").c_str(), &parent)
+           && self.st_dev != parent.st_dev;
+  }
+} // namespace bonding::image
@@ -0,0 +1,87 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_BATCH_H
+#define BONDING_BATCH_H
+
+#include "config.h"
+#include "error.h"
+#include <cstdint>
+#include <expected>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace bonding::batch
+{
+  /** A command of the queue, read from one line: either a JSON object
+   **   {"id": "...", "command": [...] or "...", "timeout_ms": 0, "overlay": false,
+   **    "reset_cgroups": true}
+   ** or a plain command line, whose words are split on blanks. */
+  struct Job
+  {
+    std::string              id;
+    std::vector<std::string> command;
+    int64_t                  timeout_ms;
+    bool                     overlay;
+    bool                     reset_cgroups;
+
+    static std::expected<Job, error::Err> of_line(
+      const std::string & line, const config::Batch_Options & defaults, size_t index) noexcept;
+
+    static std::expected<Job, error::Err> of_json(const nlohmann::json & json) noexcept;
+    nlohmann::json                        to_json() const noexcept;
+  };
+
+  /** Executed by the child process, in place of the workload: runs the jobs sent
+   ** by the supervisor one after another inside the sandbox, and sends back
+   ** their exit status, rusage and output. */
+  class Runner
+  {
+  public:
+    /** Serve the jobs until the supervisor sends an empty one. */
+    static int serve(const config::Container_Options & options, int socket) noexcept;
+
+  private:
+    static nlohmann::json
+      run(const config::Container_Options & options, const Job & job) noexcept;
+
+    /** Executed by the job process: switch to a private mount namespace whose root
+     ** is an overlay of the container root, the writes land on a tmpfs which
+     ** disappears with the job. Nothing is written to the container root, which may
+     ** be a read-only image. */
+    static std::expected<void, error::Err>
+      enter_overlay(const config::Container_Options & options) noexcept;
+
+    [[noreturn]] static void exec_job(
+      const config::Container_Options & options,
+      const Job &                       job,
+      int                               stdout_fd,
+      int                               stderr_fd) noexcept;
+
+    /** Reap the orphans reparented to us, we are the init of the pid namespace. */
+    static void reap_orphans() noexcept;
+
+  private:
+    /** The tmpfs of a job overlay, mounted on top of the root of the container */
+    inline static const std::string SCRATCH = "/..";
+  };
+
+  /** Executed by the supervisor: reads the queue and dispatches its jobs
+   ** to the runner, then writes one JSON line per job. The queue is a file
+   ** (results on stdout), "-" for the standard input, or a unix stream socket
+   ** where the results are written back. */
+  class Dispatcher
+  {
+  public:
+    static std::expected<void, error::Err>
+      serve(const config::Container_Options & options, int socket) noexcept;
+
+  private:
+    /** The descriptors the jobs are read from and the results written to */
+    static std::expected<std::pair<int, int>, error::Err>
+      open_queue(const std::string & queue) noexcept;
+  };
+} // namespace bonding::batch
+
+#endif /* BONDING_BATCH_H */
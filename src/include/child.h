@@ -19,35 +19,35 @@ namespace bonding::child
   class Child
   {
   public:
+    /** The options are not copied: the child process gets its own snapshot of them
+     ** with the address space of the supervisor. */
     explicit Child(const config::Container_Options & container_options)
-      : m_container_options(container_options)
-      , m_pid(generate_child_process(container_options).value())
+      : m_pid(generate_child_process(container_options).value())
     {
       LOG_INFO << "Starting container with command " << container_options.path
                << " on process " << m_pid;
     }
 
-    Child() : m_container_options(config::Container_Options()), m_pid(-1)
+    Child() : m_pid(-1)
     {
       std::terminate();
     }
 
-    /* Wait for the child to finish. */
-    [[nodiscard]] std::expected<void, error::Err> wait() const noexcept;
+    /* Wait for the child to finish, returns its wait status. */
+    [[nodiscard]] std::expected<int, error::Err> wait() const noexcept;
 
   private:
     class Process
     {
     private:
-      inline static config::Container_Options * container_options;
+      inline static const config::Container_Options * container_options;
 
     public:
       inline static const uint32_t STACK_SIZE = 1024 * 1024;
       inline static void *         STACK = malloc(STACK_SIZE);
 
     public:
-      /** Make a copy of config::Container_Optionsm, instead of using
-       ** the reference of the parent process */
+      /** The options live in the copy of the parent process address space */
       [[maybe_unused]] static int _main(void * options) noexcept;
 
       static std::expected<void, error::Err> setup_container_configurations() noexcept;
@@ -55,10 +55,10 @@ namespace bonding::child
 
   private:
     static std::expected<pid_t, error::Err>
-      generate_child_process(config::Container_Options container_options) noexcept;
+      generate_child_process(const config::Container_Options & container_options) noexcept;
 
-  private:
-    const config::Container_Options m_container_options;
+    static std::expected<pid_t, error::Err>
+      clone_child(const config::Container_Options & container_options, int flags) noexcept;
 
   public:
     const pid_t m_pid;
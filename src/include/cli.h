@@ -53,6 +53,9 @@ namespace bonding::cli
     template <typename T>
     std::expected<T, error::Err> parse(std::string const & value) const noexcept;
 
+    /** The arguments following "--", passed through untouched */
+    [[nodiscard]] const std::vector<std::string> & rest() const noexcept;
+
   private:
     int                                  m_argc;
     char **                              m_argv;
@@ -60,6 +63,7 @@ namespace bonding::cli
     std::unordered_map<std::string, cmd> m_cmds;
     std::unordered_map<std::string, int> m_shorthands;
     std::vector<std::string>             m_names;
+    std::vector<std::string>             m_rest;
   };
 
   enum class Mode
@@ -78,6 +82,17 @@ namespace bonding::cli
 
   std::expected<void, error::Err> function(const Parser args) noexcept;
   std::expected<void, error::Err> run(const Parser & args) noexcept;
+  std::expected<void, error::Err> replace(const Parser & args) noexcept;
+  std::expected<void, error::Err> exec(const Parser & args) noexcept;
+  std::expected<void, error::Err> batch(const Parser & args) noexcept;
+  std::expected<void, error::Err> up(const Parser & args) noexcept;
+  std::expected<void, error::Err> import_layout(const Parser & args) noexcept;
+  std::expected<void, error::Err> list(const Parser & args) noexcept;
+  std::expected<void, error::Err> inspect(const Parser & args) noexcept;
+  std::expected<void, error::Err> adopt(const Parser & args) noexcept;
+  std::expected<void, error::Err> gc(const Parser & args) noexcept;
+  std::expected<void, error::Err> features(const Parser & args) noexcept;
+  std::expected<void, error::Err> events(const Parser & args) noexcept;
   std::expected<void, error::Err> init(const Parser & args) noexcept;
   std::expected<void, error::Err> version(const Parser & args) noexcept;
 }; // namespace bonding::cli
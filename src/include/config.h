@@ -31,6 +31,109 @@ namespace bonding::config
     };
   }; // namespace CgroupsV1
 
+  /** A file descriptor handed to the workload: either a socket listening on
+   ** one of the `listen` addresses, or a state descriptor stored by the workload. */
+  struct Passed_Fd
+  {
+    /** exported through LISTEN_FDNAMES */
+    std::string name;
+
+    /** the listen address, empty for state descriptors */
+    std::string address;
+
+    int fd;
+  };
+
+  /** A namespace the container joins instead of creating a new one. */
+  struct Namespace_Join
+  {
+    /** net, ipc, uts, cgroup or pid */
+    std::string kind;
+
+    /** The CLONE_NEW* flag of the kind */
+    int flag;
+
+    /** A namespace file (/proc/<pid>/ns/<kind>) or "container:<name>" */
+    std::string target;
+  };
+
+  /** A namespace descriptor opened by the supervisor for the child process: either a
+   ** namespace file, or a pidfd of `pid` entering every namespace of `flags` at once. */
+  struct Joined_Namespace
+  {
+    int   flags;
+    int   fd;
+    pid_t pid;
+  };
+
+  /** In batch mode the sandbox is built once and runs every job of a queue. */
+  struct Batch_Options
+  {
+    /** Run each job on a fresh overlay, its writes are discarded afterwards */
+    bool overlay = false;
+
+    /** Reset the cgroups counters before each job */
+    bool reset_cgroups = true;
+
+    /** Wall-clock limit of a job, 0 for none */
+    int64_t timeout_ms = 0;
+
+    /** The bytes of stdout and stderr kept for each job */
+    size_t output_limit = 64 * 1024;
+
+    /** The environment of the jobs (NAME=value), which get a default PATH and HOME
+     ** when it has none */
+    std::vector<std::string> env;
+  };
+
+  /** Structured logging of a container, besides the console. */
+  struct Log_Options
+  {
+    /** Write the records as JSON lines to .bonding/log/<name>.jsonl */
+    bool json = false;
+
+    /** The size of the log file before it is rotated */
+    size_t max_size = 16 * 1024 * 1024;
+
+    /** The number of rotated files kept */
+    size_t files = 4;
+  };
+
+  /** Where the stdout and stderr of the workload go. */
+  struct Output_Options
+  {
+    /** "inherit" the supervisor stdio, or capture into a "file" or a unix "socket" */
+    std::string mode = "inherit";
+
+    /** The socket, or the files prefix (<path>.stdout and <path>.stderr),
+     ** .bonding/log/<name> by default */
+    std::string path;
+
+    /** The size of an output file before it is rotated */
+    size_t max_size = 64 * 1024 * 1024;
+
+    /** The number of rotated files kept */
+    size_t files = 4;
+
+    /** Discard the output the socket cannot take instead of blocking the workload */
+    bool drop = false;
+  };
+
+  /** Memory-backed filesystems of a container, sizes in bytes. */
+  struct Tmpfs_Options
+  {
+    /** The size of the tmpfs holding the writes to the root of the container (an
+     ** overlay over `mount_dir`, discarded on exit) and to the batch overlays,
+     ** 0 binds `mount_dir` itself */
+    size_t scratch = 0;
+
+    /** The size of a private /dev/shm, 0 for none */
+    size_t shm = 0;
+
+    /** The `huge=` policy of /dev/shm: "never", "always", "within_size" or "advise" */
+    std::string huge_pages = "never";
+  };
+
   /** Extract the command line arguments into this class
    ** and initialize a Container struct that will have to perform
    ** the container work. */
@@ -56,18 +159,80 @@ namespace bonding::config
     /** socket for IPC */
     std::pair<int, int> ipc;
 
-    /** identifies machine */
+    /** The UTS hostname of the container, several containers may share it */
     std::string hostname;
 
     /** Additional mount path */
     std::vector<std::pair<std::string, std::string>> mounts;
 
+    /** The additional mounts bound with the uid / gid mapping of the container, so
+     ** that their files keep their ownership inside it */
+    std::vector<std::string> idmapped;
+
     /** The child process clone flags mask */
     int clone_flags = CLONE_NEWNS | CLONE_NEWCGROUP | CLONE_NEWPID | CLONE_NEWIPC
                       | CLONE_NEWNET | CLONE_NEWUTS;
 
     /** Cgroups-v1 control options */
     std::vector<CgroupsV1::Control> cgroups_options;
+
+    /** Addresses the supervisor listens on and hands to the workload */
+    std::vector<std::string> listen;
+
+    /** The workload reports its readiness by itself (READY=1) */
+    bool notify = false;
+
+    /** The seconds a replacing container has to be ready, before it is killed and the
+     ** container it replaces keeps running */
+    uint32_t ready_timeout = 60;
+
+    /** Namespaces shared with other containers or processes */
+    std::vector<Namespace_Join> namespaces;
+
+    /** Defaults of the jobs run in batch mode */
+    Batch_Options batch;
+
+    /** Run a minimal init as PID 1, which reaps the zombies and forwards signals */
+    bool init = false;
+
+    /** Structured logging options */
+    Log_Options log;
+
+    /** Capture of the workload output */
+    Output_Options output;
+
+    /** Scratch and /dev/shm in memory */
+    Tmpfs_Options tmpfs;
+
+    /** The seconds of the first launch recorded into a prefetch manifest, read ahead by
+     ** the next launches, 0 for none */
+    uint32_t prefetch = 0;
+
+    /** The unique id of the container, keys its state directory and cgroups */
+    std::string id;
+
+    /** How other bonding commands find the container (control socket, logs),
+     ** its id unless given on the command line */
+    std::string name;
+
+    /** The namespaces to join, opened by the supervisor */
+    std::vector<Joined_Namespace> joined_namespaces;
+
+    /** A user namespace holding the mapping of the container, for the idmapped mounts */
+    int idmap_userns = -1;
+
+    /** The job queue in batch mode, empty otherwise */
+    std::string batch_queue;
+
+    /** Descriptors passed to the workload starting from fd 3 (LISTEN_FDS protocol) */
+    std::vector<Passed_Fd> fds;
+
+    /** socket for readiness and fd store messages from the workload */
+    std::pair<int, int> notify_socket = {-1, -1};
+
+    /** The stdout and stderr pipes of the workload (read end, write end) when captured */
+    std::pair<int, int> stdout_pipe = {-1, -1};
+    std::pair<int, int> stderr_pipe = {-1, -1};
   };
 }; // namespace bonding::config
 
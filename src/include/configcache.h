@@ -0,0 +1,44 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_CONFIGCACHE_H
+#define BONDING_CONFIGCACHE_H
+
+#include "config.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace bonding::configfile
+{
+  /** The validated options of a configuration file, compiled into a flat binary
+   ** blob: a header followed by the fields in a fixed order, integers in host
+   ** order, strings and lists prefixed by their length. It is keyed by the hash
+   ** of the JSON content, so an edited configuration is simply compiled again,
+   ** and is loaded with one mmap() and no parsing.
+   ** The runtime fields (sockets, descriptors) are not part of it. */
+  class Config_Cache
+  {
+  public:
+    /** The hash of a configuration file content, and of the format of the cache. */
+    static uint64_t hash_of(const std::string & content) noexcept;
+
+    /** Nothing when the configuration was never compiled, or its blob is unusable. */
+    static std::optional<config::Container_Options> load(uint64_t hash) noexcept;
+
+    /** Best effort: a configuration which cannot be compiled is parsed again next time. */
+    static void store(uint64_t hash, const config::Container_Options & options) noexcept;
+
+  private:
+    static std::string path_of(uint64_t hash) noexcept;
+
+  private:
+    inline static const std::string CACHE_DIR = ".bonding/cache/";
+
+    /** Bumped whenever the fields or their encoding change */
+    inline static const uint32_t FORMAT = 6;
+
+    inline static const char MAGIC[8] = {'B', 'O', 'N', 'D', 'C', 'F', 'G', '\0'};
+  };
+} // namespace bonding::configfile
+
+#endif /* BONDING_CONFIGCACHE_H */
@@ -28,8 +28,30 @@ namespace bonding::configfile
     static std::expected<std::vector<std::pair<std::string, std::string>>, error::Err>
       read_mounts(const nlohmann::json & data) noexcept;
 
+    /** The mounts to bind with an idmapping, each of them one of the `mounts` */
+    static std::expected<std::vector<std::string>, error::Err>
+      read_idmapped(const nlohmann::json & data) noexcept;
+
     static std::expected<int, error::Err> read_clone(const nlohmann::json & data) noexcept;
 
+    static std::expected<std::vector<std::string>, error::Err>
+      read_listen(const nlohmann::json & data) noexcept;
+
+    static std::expected<std::vector<config::Namespace_Join>, error::Err>
+      read_namespaces(const nlohmann::json & data) noexcept;
+
+    static std::expected<config::Batch_Options, error::Err>
+      read_batch(const nlohmann::json & data) noexcept;
+
+    static std::expected<config::Tmpfs_Options, error::Err>
+      read_tmpfs(const nlohmann::json & data) noexcept;
+
+    static std::expected<config::Log_Options, error::Err>
+      read_log(const nlohmann::json & data) noexcept;
+
+    static std::expected<config::Output_Options, error::Err>
+      read_output(const nlohmann::json & data) noexcept;
+
     static std::expected<std::vector<config::CgroupsV1::Control>, error::Err>
       read_cgroups_options(const nlohmann::json & data) noexcept;
 
@@ -6,8 +6,15 @@
 #include "child.h"
 #include "cli.h"
 #include "config.h"
+#include "control.h"
 #include "error.h"
+#include "events.h"
+#include "output.h"
+#include "prefetch.h"
+#include "store.h"
+#include <chrono>
 #include <expected>
+#include <optional>
 
 namespace bonding::container
 {
@@ -18,13 +25,21 @@ namespace bonding::container
       : m_config(config::Container_Options())
       , m_sockets(std::make_pair(-1, -1))
       , m_child_process(child::Child())
+      , m_control("")
+      , m_output(config::Container_Options())
     {
       std::terminate();
     }
 
   private:
-    explicit Container(const config::Container_Options & config)
-      : m_config(config), m_sockets(config.ipc), m_child_process(child::Child(config))
+    /** The options are moved in before the child is created from them. */
+    Container(config::Container_Options config, std::optional<control::Client> predecessor)
+      : m_config(std::move(config))
+      , m_sockets(m_config.ipc)
+      , m_child_process(m_config)
+      , m_control(control::Server::path_of(m_config.name))
+      , m_output(m_config)
+      , m_predecessor(std::move(predecessor))
     {}
 
   public:
@@ -37,12 +52,60 @@ namespace bonding::container
     /** get the args from the commandline and handle everything
      ** from the struct Container creation to the exit.
      ** returns a Result that will inform if an error happened during the process. */
-    static std::expected<void, error::Err> start(const config::Container_Options & argv) noexcept;
+    static std::expected<void, error::Err> start(config::Container_Options options) noexcept;
+
+    /** Start a new container which takes over the listeners and stored state of the
+     ** running container with the same name, and drain the old one as soon as
+     ** the new one is ready, so that no connection is refused in between. */
+    static std::expected<void, error::Err> replace(config::Container_Options options) noexcept;
+
+    /** Build the sandbox once and run every job of the queue inside it. */
+    static std::expected<void, error::Err>
+      batch(config::Container_Options options, const std::string & queue) noexcept;
+
+  private:
+    /** Publish the container in the state store, a failure only hides it from list. */
+    void record() noexcept;
+
+    /** Publish the start of the container, and watch its cgroups. */
+    void announce() noexcept;
+
+    /** Shared by every way of starting a container, before the child is created: give
+     ** it an id, then prepare its logging, the inherited and new descriptors, its
+     ** output, its image and the namespaces it joins. */
+    static void prepare(config::Container_Options &   options,
+                        std::vector<config::Passed_Fd> inherited) noexcept;
+
+    /** Tag the records with the container, and open its JSON log file if configured. */
+    static void setup_logging(const config::Container_Options & options) noexcept;
+
+    static std::expected<void, error::Err> launch(
+      config::Container_Options options, std::optional<control::Client> predecessor) noexcept;
 
   private:
     const config::Container_Options m_config;
     const std::pair<int, int>       m_sockets;
     const child::Child              m_child_process;
+    control::Server                 m_control;
+    output::Capture                 m_output;
+    std::optional<control::Client>  m_predecessor;
+
+    /** The record of the container in the state store, while it runs */
+    std::optional<store::Store> m_store;
+    size_t                      m_slot = 0;
+
+    /** The lifecycle events of the container */
+    std::optional<events::Publisher> m_events;
+    events::Monitor                  m_monitor;
+
+    /** Records the prefetch manifest of the first launch of the configuration */
+    prefetch::Recorder m_recorder;
+
+    /** How long the predecessor may take to finish its in-flight work */
+    inline static const std::chrono::milliseconds DRAIN_GRACE{10000};
+
+    /** Where the JSON log files of the containers live */
+    inline static const std::string LOG_DIR = ".bonding/log/";
   };
 
   class Container_Cleaner
@@ -52,4 +115,4 @@ namespace bonding::container
   };
 }; // namespace bonding::container
 
-#endif /* BONDING_CONTAINER_H */
\ No newline at end of file
+#endif /* BONDING_CONTAINER_H */
@@ -0,0 +1,124 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_CONTROL_H
+#define BONDING_CONTROL_H
+
+#include "config.h"
+#include "error.h"
+#include <chrono>
+#include <condition_variable>
+#include <expected>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+namespace bonding::control
+{
+  /** The control socket of a running container. Other bonding processes talk to
+   ** its supervisor through it, one request per datagram:
+   **   STATUS          -> "OK pid=<pid> ready=<0|1>"
+   **   HANDOFF         -> the listeners and stored state descriptors (SCM_RIGHTS)
+   **   DRAIN <ms>      -> SIGTERM the workload, SIGKILL it after <ms> */
+  class Server
+  {
+  public:
+    explicit Server(std::string path) : m_path(std::move(path)) {}
+
+    Server(const Server &) = delete;
+
+    /** Bind the control socket and serve it from a background thread. When taking
+     ** over from a predecessor the socket is bound to a temporary path, until publish(). */
+    std::expected<void, error::Err> start(
+      pid_t                          child,
+      const config::Container_Options & options,
+      bool                           takeover) noexcept;
+
+    /** The container setup is complete, the workload is ready unless it reports
+     ** its readiness by itself. */
+    void mark_ready() noexcept;
+
+    /** Block until the workload is ready, fails if it exited before or is not ready
+     ** within the timeout. */
+    std::expected<void, error::Err> wait_ready(std::chrono::seconds timeout) noexcept;
+
+    /** Atomically replace the control socket of the predecessor by ours. */
+    std::expected<void, error::Err> publish() noexcept;
+
+    /** The workload was reaped, stop serving and release the descriptors. */
+    std::expected<void, error::Err> stop() noexcept;
+
+    /** Where the control socket of a container lives. */
+    static std::string path_of(const std::string & name) noexcept;
+
+  private:
+    void loop() noexcept;
+    void handle_request(int connection) noexcept;
+    void handle_notify() noexcept;
+    void drain(std::chrono::milliseconds grace) noexcept;
+
+    /** Unlink the control socket, unless a successor already replaced it. */
+    void unlink_if_owned() noexcept;
+
+  private:
+    const std::string m_path;
+    std::string       m_bound_path;
+    ino_t             m_bound_inode = 0;
+
+    int m_listen = -1;
+    int m_notify = -1;
+    int m_wakeup[2] = {-1, -1};
+
+    pid_t                          m_child = -1;
+    bool                           m_notify_ready = false;
+    std::vector<config::Passed_Fd> m_fds;
+    std::vector<int>               m_connections;
+
+    std::optional<std::chrono::steady_clock::time_point> m_kill_deadline;
+
+    std::mutex              m_mutex;
+    std::condition_variable m_ready_cond;
+    bool                    m_ready = false;
+    bool                    m_exited = false;
+
+    std::thread m_thread;
+  };
+
+  /** Talks to the control socket of another container. */
+  class Client
+  {
+  public:
+    /** What the STATUS request reports */
+    struct Status
+    {
+      pid_t pid;
+      bool  ready;
+    };
+
+    Client(const Client &) = delete;
+    Client(Client && other) noexcept : m_socket(other.m_socket) { other.m_socket = -1; }
+    ~Client();
+
+    static std::expected<Client, error::Err> connect(const std::string & path) noexcept;
+
+    std::expected<std::string, error::Err> request(const std::string & command) noexcept;
+
+    std::expected<Status, error::Err> status() noexcept;
+
+    /** Receive duplicates of the listeners and state descriptors of the container. */
+    std::expected<std::vector<config::Passed_Fd>, error::Err> handoff() noexcept;
+
+    /** Ask the container to stop its workload gracefully. */
+    std::expected<void, error::Err> drain(std::chrono::milliseconds grace) noexcept;
+
+  private:
+    explicit Client(int socket) : m_socket(socket) {}
+
+  private:
+    int m_socket;
+  };
+} // namespace bonding::control
+
+#endif /* BONDING_CONTROL_H */
@@ -0,0 +1,62 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_ENTER_H
+#define BONDING_ENTER_H
+
+#include "error.h"
+#include <expected>
+#include <sched.h>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+namespace bonding::enter
+{
+  /** Run a command inside a running container, e.g. a health probe: the process
+   ** enters every namespace of the container with a single setns() on a pidfd,
+   ** joins its cgroups, and gets the uid, capabilities and (cached) seccomp
+   ** filter of the workload before exec. */
+  class Enter
+  {
+  public:
+    /** Returns the exit code of the command, 128 + the signal if it was killed. */
+    static std::expected<int, error::Err>
+      exec(const std::string & container, const std::vector<std::string> & argv) noexcept;
+
+  private:
+    /** The namespaces of pid which differ from ours: joining a namespace we are
+     ** already a member of is refused by the kernel. */
+    static std::expected<int, error::Err> namespaces_of(pid_t pid) noexcept;
+
+    /** The uid and gid of pid, as seen inside its user namespace. */
+    static std::expected<std::pair<uid_t, gid_t>, error::Err> ids_of(pid_t pid) noexcept;
+
+    /** The environment of pid, read before joining it: the command gets the one of
+     ** the workload, completed with a default PATH and HOME. */
+    static std::vector<std::string> environ_of(pid_t pid) noexcept;
+
+    static std::expected<void, error::Err> enter(pid_t pid, int pidfd, int flags) noexcept;
+
+    /** Runs in the forked process, which lives in the pid namespace of the container. */
+    [[noreturn]] static void run(const std::vector<std::string> & argv,
+                                 const std::vector<std::string> & env,
+                                 uid_t                            uid,
+                                 gid_t                            gid) noexcept;
+
+  private:
+    /** In the order they can be joined one by one: the user namespace last, since the
+     ** other ones are owned by the initial user namespace. */
+    inline static const std::vector<std::pair<std::string, int>> NAMESPACES = {
+      {"cgroup", CLONE_NEWCGROUP},
+      {"ipc", CLONE_NEWIPC},
+      {"net", CLONE_NEWNET},
+      {"pid", CLONE_NEWPID},
+      {"uts", CLONE_NEWUTS},
+      {"mnt", CLONE_NEWNS},
+      {"user", CLONE_NEWUSER},
+    };
+  };
+} // namespace bonding::enter
+
+#endif /* BONDING_ENTER_H */
@@ -6,6 +6,9 @@
 #include <expected>
 #include "unix.h"
 #include <map>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
 #include <sys/utsname.h>
 #include <vector>
 
@@ -56,6 +59,43 @@ namespace bonding::environment
       checking_if_controller_supported(const std::string & controller) noexcept;
   };
 
+  /** The kernel facilities bonding has a faster path for. Probing them costs a few
+   ** system calls each, so they are probed once per boot of a kernel: the table is
+   ** cached in .bonding/cache/features, keyed by the kernel release and the boot id,
+   ** a `<name>=0|1` line per feature. */
+  struct Features
+  {
+    bool pidfd = false;
+
+    /** mount_setattr() with MOUNT_ATTR_IDMAP */
+    bool idmapped_mounts = false;
+
+    /** /sys/fs/cgroup is the unified hierarchy */
+    bool cgroup_v2 = false;
+
+    bool io_uring = false;
+
+    /** The features of the running kernel, from the cache or probed. */
+    static const Features & get() noexcept;
+
+    nlohmann::json to_json() const noexcept;
+
+  private:
+    static Features probe() noexcept;
+
+    /** "<release> <boot id>" */
+    static std::string key() noexcept;
+
+    static std::optional<Features> load(const std::string & key) noexcept;
+    static void store(const std::string & key, const Features & features) noexcept;
+
+  private:
+    /** The name of each feature, its `<name>=0|1` line in the cache */
+    static const std::vector<std::pair<const char *, bool Features::*>> & fields() noexcept;
+
+    inline static const std::string CACHE = ".bonding/cache/features";
+  };
+
   class Info
   {
   public:
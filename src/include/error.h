@@ -31,6 +31,9 @@ namespace bonding::error
     Environment,
     Cli,
     Configfile,
+    Batch,
+    Manifest,
+    Image,
   };
 
   inline const std::map<Code, std::string> CODE_TO_STRING = {
@@ -49,6 +52,9 @@ namespace bonding::error
     {Code::Capabilities, "Capabilities Error"},
     {Code::Unix, "Unix Error"},
     {Code::Configfile, "Config File Error"},
+    {Code::Batch, "Batch Error"},
+    {Code::Manifest, "Manifest Error"},
+    {Code::Image, "Image Error"},
   };
 
   class Err
@@ -0,0 +1,167 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_EVENTS_H
+#define BONDING_EVENTS_H
+
+#include "config.h"
+#include "error.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+
+namespace bonding::events
+{
+  /** A lifecycle event of a container, fixed-size so that it is copied straight
+   ** out of the ring. */
+  struct Event
+  {
+    enum class Type : uint32_t
+    {
+      /** The container is set up, its workload runs */
+      Started,
+
+      /** The workload exited, `value` is its exit code or 128 + its signal */
+      Exited,
+
+      /** The memory cgroup hit its limit, `value` is the number of OOM events */
+      Oom,
+
+      /** The cpu cgroup was throttled, `value` is the number of throttled periods */
+      Throttled
+    };
+
+    Type     type;
+    pid_t    pid;
+    int64_t  value;
+
+    /** CLOCK_REALTIME, in nanoseconds */
+    int64_t time;
+
+    char id[24];
+    char name[72];
+
+    static const char * to_string(Type type) noexcept;
+
+    nlohmann::json to_json() const noexcept;
+  };
+
+  /** The ring of the events of the containers of the current directory, a file mapped
+   ** by the supervisors and by the subscribers. Every supervisor publishes into it,
+   ** so the producers take their sequence number with a fetch-and-add, then fill the
+   ** slot under a sequence counter like the state store. The subscribers read without
+   ** any lock, and sleep on a futex in the shared mapping: the producers only make
+   ** a system call when a subscriber sleeps. A subscriber too slow for the ring skips
+   ** the events it lost, the producers never wait. */
+  class Ring
+  {
+  public:
+    Ring(const Ring &) = delete;
+    Ring(Ring && other) noexcept : m_map(other.m_map) { other.m_map = nullptr; }
+    ~Ring();
+
+    static std::expected<Ring, error::Err> open() noexcept;
+
+  protected:
+    struct Header;
+    struct Slot;
+
+    explicit Ring(void * map) noexcept : m_map(map) {}
+
+    Header & header() const noexcept;
+    Slot &   slot(uint64_t sequence) const noexcept;
+
+  protected:
+    void * m_map;
+
+    inline static const std::string PATH = ".bonding/events";
+
+    /** A power of two */
+    inline static const size_t SLOTS = 4096;
+
+    inline static const size_t   HEADER_SIZE = 4096;
+    inline static const uint64_t MAGIC = 0x3130545645444e42; /* "BNDEVT01" */
+  };
+
+  /** Executed by the supervisor of a container */
+  class Publisher : public Ring
+  {
+  public:
+    static std::expected<Publisher, error::Err>
+      open(const config::Container_Options & options) noexcept;
+
+    void publish(Event::Type type, pid_t pid, int64_t value) noexcept;
+
+  private:
+    Publisher(Ring ring, const config::Container_Options & options) noexcept;
+
+  private:
+    std::string m_id;
+    std::string m_name;
+  };
+
+  /** The client side: receives the events published from the time it subscribed. */
+  class Subscriber : public Ring
+  {
+  public:
+    static std::expected<Subscriber, error::Err> open() noexcept;
+
+    /** The next event, nothing when none came within the timeout. */
+    std::optional<Event> next(std::chrono::milliseconds timeout) noexcept;
+
+    /** The events overwritten before this subscriber could read them */
+    uint64_t lost() const noexcept { return m_lost; }
+
+  private:
+    explicit Subscriber(Ring ring) noexcept;
+
+    /** Sleep until a producer publishes past `m_next`, false on timeout. */
+    bool wait(std::chrono::steady_clock::time_point deadline) noexcept;
+
+  private:
+    uint64_t m_next = 0;
+    uint64_t m_lost = 0;
+
+    /** How long a slot may stay half-written before its producer is deemed dead */
+    inline static const int STALLED_SPINS = 100000;
+  };
+
+  /** Watches the cgroups of a container from a thread of its supervisor, and publishes
+   ** its OOM events (notified through cgroup.event_control) and throttling (from
+   ** cpu.stat, once a second). */
+  class Monitor
+  {
+  public:
+    Monitor() = default;
+    Monitor(const Monitor &) = delete;
+
+    std::expected<void, error::Err> start(
+      const config::Container_Options & options, Publisher & publisher, pid_t pid) noexcept;
+
+    void stop() noexcept;
+
+  private:
+    void loop(Publisher & publisher, pid_t pid) noexcept;
+
+    /** Register an eventfd for the OOM events of the memory cgroup. */
+    int watch_oom(const std::string & cgroup) noexcept;
+
+    static uint64_t throttled(const std::string & cpu_stat) noexcept;
+
+  private:
+    int         m_oom = -1;
+    int         m_wakeup[2] = {-1, -1};
+    std::string m_cpu_stat;
+
+    std::thread m_thread;
+
+    inline static const std::chrono::milliseconds THROTTLE_INTERVAL{1000};
+  };
+} // namespace bonding::events
+
+#endif /* BONDING_EVENTS_H */
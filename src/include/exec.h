@@ -3,24 +3,79 @@
 #ifndef BONDING_EXEC_H
 #define BONDING_EXEC_H
 
+#include "config.h"
 #include "error.h"
+#include <cstddef>
 #include <expected>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace bonding::exec
 {
+  /** The argv and envp arrays of an exec, null-terminated, in a single allocation
+   ** with their strings. */
+  class Arguments
+  {
+  public:
+    Arguments(const std::vector<std::string> & argv,
+              const std::vector<std::string> & env) noexcept;
+
+    char * const * argv() const noexcept { return m_argv; }
+    char * const * envp() const noexcept { return m_envp; }
+
+  private:
+    std::unique_ptr<char[]> m_block;
+    char **                 m_argv = nullptr;
+    char **                 m_envp = nullptr;
+  };
 
   class Execve
   {
   public:
+    /** The PATH of a command whose environment has none */
+    inline static const std::string DEFAULT_PATH =
+      "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin";
+
+    /** Complete an environment with a PATH and a HOME, when it has none. */
+    static std::vector<std::string> with_defaults(std::vector<std::string> env) noexcept;
+
+    /** Executed by the child process right before pivot_root: open the executable of
+     ** the container with O_PATH, resolved under the new root in the mount namespace of
+     ** the container, so that it is executed without looking its path up again. A
+     ** script is left to be executed by name, its interpreter could not open a
+     ** descriptor closed on exec. */
+    static void prepare(const config::Container_Options & options,
+                        const std::string &               new_root) noexcept;
+
     /** The execve systemcall wrapper */
+    static std::expected<void, error::Err> call(
+      const std::string &              path,
+      const std::vector<std::string> & argv,
+      const std::vector<std::string> & env) noexcept;
+
+    /** Execute the executable opened by `prepare()`, by name when it has none or when
+     ** the kernel cannot execute it from its descriptor. */
+    static std::expected<void, error::Err> call(
+      const config::Container_Options & options,
+      const std::vector<std::string> &  argv,
+      const std::vector<std::string> &  env) noexcept;
+
+    /** Execute argv[0] as execvpe() does: a name without a slash is looked up in the
+     ** PATH of `env`, DEFAULT_PATH without one, but a script without a shebang is not
+     ** handed to the shell. */
     static std::expected<void, error::Err>
-      call(const std::string &path, const std::vector<std::string> &argv) noexcept;
+      search(const std::vector<std::string> & argv,
+             const std::vector<std::string> & env) noexcept;
+
+  private:
+    static bool script(int file) noexcept;
 
   private:
-    inline static std::vector<char *> args;
+    /** The executable opened by `prepare()`, -1 to execute it by name */
+    inline static int executable = -1;
   };
 
 }; // namespace bonding::exec
 
-#endif /* BONDING_EXEC_H */
\ No newline at end of file
+#endif /* BONDING_EXEC_H */
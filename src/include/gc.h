@@ -0,0 +1,45 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_GC_H
+#define BONDING_GC_H
+
+#include "error.h"
+#include "reaper.h"
+#include <chrono>
+#include <cstddef>
+#include <expected>
+#include <string>
+#include <vector>
+
+namespace bonding::gc
+{
+  /** Finds what crashed supervisors and reapers left behind in the current directory,
+   ** and tears it down. A container is an orphan when its owner marker names a process
+   ** which no longer runs and no record of the state store refers to it: the records
+   ** are the business of `bonding adopt`, which watches their workloads. The idle
+   ** cgroups of the pool no entry refers to, and those idle for too long, go too, and so
+   ** do the mounts of the images no supervisor uses. */
+  class Collector
+  {
+  public:
+    /** Collect the orphans, a bounded batch at a time, with a teardown per thread. */
+    static std::expected<void, error::Err> collect() noexcept;
+
+  private:
+    static std::vector<reaper::Job> orphans() noexcept;
+
+    /** The roots of the mounted cgroup hierarchies */
+    static std::vector<std::string> hierarchies() noexcept;
+
+  private:
+    inline static const std::string CGROUP_ROOT = "/sys/fs/cgroup/";
+
+    inline static const size_t BATCH = 256;
+    inline static const size_t MAX_WORKERS = 16;
+
+    /** A marker without a readable owner is being written, unless it is older */
+    inline static const std::chrono::seconds GRACE{60};
+  };
+} // namespace bonding::gc
+
+#endif /* BONDING_GC_H */
@@ -0,0 +1,59 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_HANDOFF_H
+#define BONDING_HANDOFF_H
+
+#include "config.h"
+#include "error.h"
+#include <expected>
+#include <string>
+#include <vector>
+
+namespace bonding::handoff
+{
+  /** Listening sockets are owned by the supervisor rather than by the workload,
+   ** so they survive a workload replacement and no connection is ever refused. */
+  class Listener
+  {
+  public:
+    /** Open a listening socket, the address is one of:
+     **   "unix:/path/to/socket", "[::]:8080", "0.0.0.0:8080" or "tcp:host:port" */
+    static std::expected<int, error::Err> open(const std::string & address) noexcept;
+
+  private:
+    static std::expected<int, error::Err> open_unix(const std::string & path) noexcept;
+    static std::expected<int, error::Err>
+      open_tcp(const std::string & host, const std::string & port) noexcept;
+
+  private:
+    inline static const int BACKLOG = 4096;
+  };
+
+  /** Hands descriptors to the workload following the systemd socket activation
+   ** protocol: they are numbered from 3 and described by LISTEN_FDS, LISTEN_PID
+   ** and LISTEN_FDNAMES. The workload reports its readiness by sending "READY=1"
+   ** to BONDING_NOTIFY_FD, and can keep state descriptors in the supervisor
+   ** with "FDSTORE=1\nFDNAME=<name>" and SCM_RIGHTS. */
+  class Handoff
+  {
+  public:
+    /** Executed by the supervisor before the child is created: reuse the handed
+     ** over listeners (if any), open the missing ones and create the notify socket. */
+    static std::expected<void, error::Err> prepare(
+      config::Container_Options & options, std::vector<config::Passed_Fd> inherited) noexcept;
+
+    /** Executed by the child process right before exec: move the descriptors to
+     ** their final numbers and return the environment describing them. */
+    static std::expected<std::vector<std::string>, error::Err>
+      install(const config::Container_Options & options) noexcept;
+
+    /** The first descriptor above those handed to the workload, which `install()`
+     ** leaves alone */
+    static int end_of(const config::Container_Options & options) noexcept;
+
+  private:
+    inline static const int LISTEN_FDS_START = 3;
+  };
+} // namespace bonding::handoff
+
+#endif /* BONDING_HANDOFF_H */
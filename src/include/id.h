@@ -0,0 +1,94 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_ID_H
+#define BONDING_ID_H
+
+#include "config.h"
+#include "error.h"
+#include <chrono>
+#include <cstddef>
+#include <expected>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace bonding::id
+{
+  /** Every container gets a unique id, which keys its state directory and its cgroups,
+   ** so that any number of containers may share a hostname. An id is 16 random hex
+   ** digits, claimed by creating its owner marker: no lock and no shared counter,
+   ** a collision only retries. The state directories and cgroups are sharded by the
+   ** first digits of the id, no directory grows past a few thousand entries.
+   ** The marker <shard>/<id>.owner holds the pid and start time of the process in
+   ** charge of the container, and outlives its state directory and cgroups: whatever
+   ** a crash leaves behind is found from it. */
+  class Id
+  {
+  public:
+    enum class Owner
+    {
+      Running,
+
+      /** The owner is gone, whatever is left of the container leaked */
+      Gone,
+
+      /** No marker, or one still being written */
+      Unknown
+    };
+
+    /** Executed by the supervisor before the child is created: claim a new id, and
+     ** name the container after it unless it was named. */
+    static std::expected<void, error::Err>
+      prepare(config::Container_Options & options) noexcept;
+
+    /** Make the calling process the owner of the id. */
+    static void mark(const std::string & id) noexcept;
+
+    /** Everything of the container is gone, forget its id. */
+    static void unmark(const std::string & id) noexcept;
+
+    static Owner owner_of(const std::string & id) noexcept;
+
+    /** How long ago the id was claimed or changed hands, nothing if it is gone */
+    static std::optional<std::chrono::seconds> age(const std::string & id) noexcept;
+
+    /** Every id with an owner marker or a state directory in the current directory */
+    static std::vector<std::string> claimed() noexcept;
+
+    /** The directory the root of the container is mounted on */
+    static std::string state_dir(const std::string & id) noexcept;
+
+    /** The parent of the shards of the cgroups, relative to the root of a hierarchy */
+    static std::string cgroup_root() noexcept;
+
+    /** The cgroup of the container, relative to the root of a hierarchy */
+    static std::string cgroup_of(const std::string & id) noexcept;
+
+    /** A name ends up in file names, it cannot hold a path. */
+    static bool valid_name(const std::string & name) noexcept;
+
+  private:
+    static std::string generate() noexcept;
+
+    /** <shard>/<id> */
+    static std::string sharded(const std::string & id) noexcept;
+
+    static std::string marker_of(const std::string & id) noexcept;
+
+    /** "<pid> <start time>" of the calling process */
+    static std::string owner() noexcept;
+
+  private:
+    inline static const std::string STATE_DIR = ".bonding/tmp/";
+    inline static const std::string CGROUP_DIR = "bonding/";
+    inline static const std::string MARKER = ".owner";
+
+    /** 256 shards */
+    inline static const size_t SHARD_DIGITS = 2;
+
+    /** A collision is already unlikely with 64 random bits */
+    inline static const int ATTEMPTS = 8;
+  };
+} // namespace bonding::id
+
+#endif /* BONDING_ID_H */
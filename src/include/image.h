@@ -0,0 +1,80 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_IMAGE_H
+#define BONDING_IMAGE_H
+
+#include "config.h"
+#include "error.h"
+#include "unix.h"
+#include <expected>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace bonding::image
+{
+  /** A compressed read-only image (EROFS or squashfs) as the root of containers,
+   ** one file to copy to a host instead of a tree of small ones. The image is attached
+   ** to a loop device with LOOP_CONFIGURE, with direct I/O where the kernel can so
+   ** that its pages are cached once by the mounted filesystem, and mounted read-only
+   ** under `.bonding/images/<key>/`: every container of the same image binds that
+   ** mount, and shares its loop device and page cache. The layers of an image imported
+   ** by `bonding import` (`"mount_dir": "oci:<name>"`) are shared the same way,
+   ** stacked by a read-only overlay.
+   ** Every supervisor holds a shared lock on `<key>.users` for as long as it runs, and
+   ** `bonding gc` unmounts the images which nobody holds. The loop device is freed
+   ** once the image is unmounted from the host and from the last container using it. */
+  class Image
+  {
+  public:
+    /** Executed by the supervisor: a `mount_dir` which is an image file is replaced
+     ** by the directory it is mounted on, mounting it first unless it already is. */
+    static std::expected<void, error::Err>
+      prepare(config::Container_Options & options) noexcept;
+
+    /** Unmount the images which no supervisor uses anymore. */
+    static void collect() noexcept;
+
+  private:
+    /** The filesystem type of the image from its superblock, nothing if unknown */
+    static std::optional<std::string> type_of(const unix::Fd & image) noexcept;
+
+    /** Keyed by the device, inode, size and modification time of the image: an image
+     ** replaced by another one is mounted again. */
+    static std::string key_of(const std::string & path) noexcept;
+
+    /** Keyed by the layers of an imported image */
+    static std::string key_of(const std::vector<std::string> & layers) noexcept;
+
+    static std::string hash_of(const std::string & content) noexcept;
+
+    /** Attach the image to a free loop device, read-only. */
+    static std::expected<unix::Fd, error::Err> attach(const unix::Fd & image) noexcept;
+
+    static std::expected<void, error::Err>
+      mount(const std::string & path, const std::string & dir) noexcept;
+
+    /** Stack the layer directories, from the bottom up, read-only. */
+    static std::expected<void, error::Err>
+      mount_layers(const std::vector<std::string> & layers, const std::string & dir) noexcept;
+
+    /** The directory is a mount point rather than a directory of its parent */
+    static bool mounted(const std::string & dir) noexcept;
+
+  private:
+    /** The `<key>.users` locks of the images used by this process, released on exit */
+    inline static std::vector<unix::Fd> users;
+
+    inline static const std::string IMAGES_DIR = ".bonding/images/";
+    inline static const std::string OCI_PREFIX = "oci:";
+
+    /** Another process may take the free loop device first */
+    inline static const int ATTEMPTS = 8;
+
+    inline static const uint32_t SQUASHFS_MAGIC = 0x73717368;
+    inline static const uint32_t EROFS_MAGIC = 0xe0f5e1e2;
+    inline static const off_t    EROFS_OFFSET = 1024;
+  };
+} // namespace bonding::image
+
+#endif /* BONDING_IMAGE_H */
@@ -0,0 +1,44 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_INIT_H
+#define BONDING_INIT_H
+
+#include "config.h"
+#include "error.h"
+#include <csignal>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace bonding::init
+{
+  /** The first process of a pid namespace is its init: the orphans are reparented
+   ** to it, and the kernel only delivers it the signals it has a handler for.
+   ** Most workloads are not written to be an init, so the child process stays
+   ** PID 1 and runs the workload as its only child: it reaps every zombie and
+   ** forwards the signals it receives to the workload. */
+  class Init
+  {
+  public:
+    /** Fork and execute the workload, then reap until it exits.
+     ** Returns the exit code of the workload, 128 + signal if it was killed. */
+    static int
+      run(const config::Container_Options & options, std::vector<std::string> env) noexcept;
+
+  private:
+    /** Executed by the workload process. */
+    [[noreturn]] static void exec(const config::Container_Options & options,
+                                  std::vector<std::string>          env,
+                                  const sigset_t &                  mask) noexcept;
+
+    /** Reap every exited child, returns true when the workload is one of them. */
+    static bool reap(pid_t workload, int & status) noexcept;
+
+  private:
+    /** Synchronous signals are raised by the faulty code itself, they are not forwarded. */
+    inline static const int SYNCHRONOUS[] = {
+      SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV, SIGSYS, SIGTRAP};
+  };
+} // namespace bonding::init
+
+#endif /* BONDING_INIT_H */
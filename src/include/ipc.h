@@ -5,6 +5,9 @@
 
 #include "error.h"
 #include <expected>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace bonding::ipc
 {
@@ -15,6 +18,27 @@ namespace bonding::ipc
   public:
     static std::expected<void, error::Err> send_boolean(int socket, bool data) noexcept;
     static std::expected<bool, error::Err> recv_boolean(int socket) noexcept;
+
+    /** Send a message together with a set of file descriptors (SCM_RIGHTS),
+     ** the receiver gets its own duplicates of the descriptors. */
+    static std::expected<void, error::Err> send_fds(
+      int socket, const std::string & message, const std::vector<int> & fds) noexcept;
+
+    /** Receive a message and the file descriptors attached to it. */
+    static std::expected<std::pair<std::string, std::vector<int>>, error::Err>
+      recv_fds(int socket) noexcept;
+
+    /** Send a string of any size: a datagram is bounded by the socket buffer,
+     ** so the string goes as its size followed by chunks. */
+    static std::expected<void, error::Err>
+      send_string(int socket, const std::string & data) noexcept;
+    static std::expected<std::string, error::Err> recv_string(int socket) noexcept;
+
+  private:
+    /** The kernel refuses more than SCM_MAX_FD (253) descriptors in one message. */
+    inline static const size_t MAX_FDS = 253;
+    inline static const size_t MAX_MESSAGE = 4096;
+    inline static const size_t CHUNK = 32 * 1024;
   };
 } // namespace bonding::ipc
 
@@ -0,0 +1,128 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_MANIFEST_H
+#define BONDING_MANIFEST_H
+
+#include "error.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <expected>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace bonding::manifest
+{
+  /** A container of the manifest: the directory holding its bonding.json, how many
+   ** replicas of it run, and the containers which must be ready before it starts. */
+  struct Service
+  {
+    std::string              name;
+    std::string              dir;
+    size_t                   replicas;
+    std::vector<std::string> depends_on;
+
+    /** How long a replica may take to be ready before it is given up */
+    std::chrono::seconds ready_timeout;
+  };
+
+  /** Describes the containers of a host:
+   **   {"workers": 8,
+   **    "containers": {
+   **      "db":  {"dir": "Bonding.db"},
+   **      "web": {"dir": "Bonding.web", "replicas": 4, "depends_on": ["db"],
+   **              "ready_timeout": 30}}} */
+  struct Manifest
+  {
+    /** The containers launched at once, the number of CPUs by default */
+    size_t workers;
+
+    /** Sorted so that every service comes after its dependencies */
+    std::vector<Service> services;
+
+    static std::expected<Manifest, error::Err> read(const std::string & path) noexcept;
+
+    static std::expected<Manifest, error::Err> of_json(const nlohmann::json & json) noexcept;
+
+  private:
+    /** Order the services by their dependencies, fails on a cycle or an unknown name. */
+    static std::expected<std::vector<Service>, error::Err>
+      sort(std::vector<Service> services) noexcept;
+
+  private:
+    inline static const std::chrono::seconds READY_TIMEOUT{60};
+  };
+
+  /** Brings up every replica of a manifest: each one is a `bonding run` of its own,
+   ** started by a pool of workers as soon as all the replicas of its dependencies
+   ** are ready, then waits for all of them to exit. */
+  class Launcher
+  {
+  public:
+    static std::expected<void, error::Err> up(const Manifest & manifest) noexcept;
+
+  private:
+    /** A replica of a service, with its unique name */
+    struct Replica
+    {
+      std::string name;
+      size_t      service;
+      pid_t       pid = -1;
+    };
+
+    enum class State
+    {
+      Waiting,
+      Ready,
+      Failed
+    };
+
+    explicit Launcher(const Manifest & manifest) noexcept;
+
+    void worker() noexcept;
+
+    /** Start the replica and wait until it is ready, or exited. */
+    bool launch(Replica & replica) noexcept;
+
+    /** fork and exec `bonding run name <name>` in the directory of the service. */
+    pid_t spawn(const std::string & dir, const std::string & name) noexcept;
+
+    /** Until the control socket of the replica reports it ready, it exits, or its
+     ** ready_timeout expires. The pid of the replica is reset once it is reaped, a
+     ** replica which is late keeps running and is waited for with the others. */
+    bool wait_ready(const Service & service, Replica & replica) noexcept;
+
+    /** The service is done, release the services depending on it. */
+    void finish(size_t service, bool ready) noexcept;
+
+  private:
+    const Manifest & m_manifest;
+
+    std::vector<Replica> m_replicas;
+
+    /** Per service: the replicas not ready yet, and the dependencies not ready yet */
+    std::vector<size_t> m_pending_replicas;
+    std::vector<size_t> m_pending_dependencies;
+    std::vector<State>  m_states;
+
+    /** Per service: the services depending on it */
+    std::vector<std::vector<size_t>> m_dependents;
+
+    /** The replicas whose dependencies are ready, not launched yet */
+    std::deque<size_t> m_queue;
+
+    /** The replicas not launched, nor skipped yet */
+    size_t m_remaining;
+
+    std::mutex              m_mutex;
+    std::condition_variable m_cond;
+
+    inline static const std::chrono::milliseconds POLL_INTERVAL{20};
+  };
+} // namespace bonding::manifest
+
+#endif /* BONDING_MANIFEST_H */
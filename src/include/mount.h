@@ -3,8 +3,10 @@
 #ifndef BONDING_MOUNT_H
 #define BONDING_MOUNT_H
 
+#include "config.h"
 #include "error.h"
 #include <expected>
+#include <string>
 
 namespace bonding::mounts
 {
@@ -14,11 +16,10 @@ namespace bonding::mounts
   {
   public:
     /** Mount user-provided m_mount_dir to
-     ** the mountpoint /tmp/bonding.<random_letters> */
-    static std::expected<void, error::Err> setup(
-      const std::string &                                      mount_dir,
-      const std::string &                                      hostname,
-      const std::vector<std::pair<std::string, std::string>> & mounts_paths) noexcept;
+     ** the state directory of the container, the `idmapped` mounts with the
+     ** mapping of the user namespace opened by the supervisor */
+    static std::expected<void, error::Err>
+      setup(const config::Container_Options & options) noexcept;
 
     static std::expected<void, error::Err> clean() noexcept;
 
@@ -29,6 +30,21 @@ namespace bonding::mounts
       const std::string & mount_point,
       unsigned long       flags) noexcept;
 
+    /** Bind a clone of the path with an idmapping: the ownership of its files is
+     ** translated at access time, whatever their number. False when the filesystem
+     ** cannot be idmapped. */
+    static bool _mount_idmapped(
+      const std::string & path, const std::string & mount_point, int userns) noexcept;
+
+    /** Mount a tmpfs of `size` bytes on the state directory, and an overlay of the
+     ** mount_dir with its upper layer in that tmpfs: the new root. */
+    static std::expected<std::string, error::Err>
+      _mount_scratch(const std::string & mount_dir, size_t size) noexcept;
+
+    /** Mount the private /dev/shm of the new root. */
+    static std::expected<void, error::Err> _mount_shm(
+      const std::string & new_root, const config::Tmpfs_Options & tmpfs) noexcept;
+
     /** Create directories recursively based on path */
     static std::expected<void, error::Err> _create(const std::string & path) noexcept;
 
@@ -36,7 +52,6 @@ namespace bonding::mounts
      ** “old root” has to be unmounted so the contained
      ** application cannot access to the whole filesystem.*/
     static std::expected<void, error::Err> _umount(const std::string & path) noexcept;
-    static std::expected<void, error::Err> _delete(const std::string & path) noexcept;
 
   private:
     inline static std::string root;
@@ -3,9 +3,13 @@
 #ifndef BONDING_NAMESPACE_H
 #define BONDING_NAMESPACE_H
 
+#include "config.h"
 #include "error.h"
+#include "unix.h"
 #include <expected>
+#include <map>
 #include <sched.h>
+#include <string>
 #include <sys/types.h>
 
 namespace bonding::ns
@@ -22,11 +26,59 @@ namespace bonding::ns
     /** Called by the container when it will perform UID / GID mapping. */
     static std::expected<void, error::Err> handle_child_uid_map(pid_t pid) noexcept;
 
+    /** Executed by the supervisor before the child process is created: open the
+     ** namespaces to join and stop creating them, and the user namespace of the
+     ** idmapped mounts. */
+    static std::expected<void, error::Err>
+      prepare_joins(config::Container_Options & options) noexcept;
+
+    /** The pid namespace is joined, see `enter_pid()` */
+    static bool joins_pid(const config::Container_Options & options) noexcept;
+
+    /** The pid namespace only applies to the children of a process, and a process
+     ** which entered one cannot create threads anymore: it is entered by a process
+     ** forked from the supervisor, which then clones the child process. */
+    static std::expected<void, error::Err>
+      enter_pid(const config::Container_Options & options) noexcept;
+
+    /** Executed by the child process before anything else, joins every namespace but
+     ** the pid one. */
+    static std::expected<void, error::Err>
+      join(const config::Container_Options & options) noexcept;
+
+    /** The child process has its own copies of the namespace descriptors. */
+    static std::expected<void, error::Err>
+      close_joins(const config::Container_Options & options) noexcept;
+
+  public:
+    /** The namespaces a container can join instead of creating them. The mount
+     ** namespace is not shareable: the container root is set up in it. */
+    inline static const std::map<std::string, int> KINDS = {
+      {"cgroup", CLONE_NEWCGROUP},
+      {"ipc", CLONE_NEWIPC},
+      {"net", CLONE_NEWNET},
+      {"pid", CLONE_NEWPID},
+      {"uts", CLONE_NEWUTS},
+    };
+
   private:
+    /** The user namespace of the container does not exist yet when its root is
+     ** mounted, but an idmapping is only the mapping of a user namespace: a throwaway
+     ** namespace with the same mapping stands in for it. */
+    static std::expected<void, error::Err>
+      prepare_idmap(config::Container_Options & options) noexcept;
+
     /** If that call is successful, then user namespaces are supported. */
     static std::expected<bool, error::Err> has_user_namespace() noexcept;
 
-    static std::expected<void, error::Err> create_map(int id, std::string map) noexcept;
+    /** Queue the write of the map file of the process, relative to its /proc directory. */
+    static void
+      create_map(unix::Batch & batch, const unix::Fd & proc, const std::string & map) noexcept;
+
+    /** setns() with a pidfd needs Linux 5.8, older kernels take one namespace file
+     ** per namespace. */
+    static std::expected<void, error::Err>
+      join_one_by_one(pid_t pid, int flags) noexcept;
 
   private:
     inline static gid_t groups[1];
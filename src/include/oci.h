@@ -0,0 +1,92 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_OCI_H
+#define BONDING_OCI_H
+
+#include "error.h"
+#include "unix.h"
+#include <cstddef>
+#include <expected>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace bonding::oci
+{
+  /** A layer of an image, as listed by its manifest */
+  struct Layer
+  {
+    /** "<algorithm>:<hex>", of the compressed blob */
+    std::string digest;
+
+    std::string media_type;
+  };
+
+  /** Imports the images of a local OCI image layout (oci-layout, index.json and
+   ** blobs/) so that containers run them with `"mount_dir": "oci:<name>"`. Every
+   ** layer is unpacked once under `.bonding/layers/<algorithm>/<hex>/`, keyed by the
+   ** digest of its blob: the images sharing a layer share its directory, and the
+   ** layers already there are not unpacked again. The layers are decompressed and
+   ** unpacked in parallel, one per thread, each into a directory of its own, and
+   ** their whiteouts are turned into those of overlayfs so that the directories are
+   ** stacked as they are. The image itself is recorded in `.bonding/oci/<name>.json`,
+   ** its layers from the bottom up. */
+  class Importer
+  {
+  public:
+    /** Import the manifest of the layout named `name` (its
+     ** org.opencontainers.image.ref.name annotation), the first one when the name is
+     ** empty, and return the name of the image. */
+    static std::expected<std::string, error::Err>
+      import(const std::string & layout, const std::string & name) noexcept;
+
+    /** The layer directories of an imported image, from the bottom up */
+    static std::expected<std::vector<std::string>, error::Err>
+      layers_of(const std::string & name) noexcept;
+
+  private:
+    /** The manifest of the image, through the index of the platform when the
+     ** layout holds a multi-platform image. */
+    static std::expected<nlohmann::json, error::Err> manifest_of(
+      const std::string & layout, const std::string & name, std::string & ref) noexcept;
+
+    static std::expected<nlohmann::json, error::Err>
+      read_json(const std::string & path) noexcept;
+
+    /** The path of a blob of the layout, nothing for a malformed digest */
+    static std::optional<std::string>
+      blob_of(const std::string & layout, const std::string & digest) noexcept;
+
+    /** "<algorithm>/<hex>" */
+    static std::string dir_of(const std::string & digest) noexcept;
+
+    /** A layer digest names its directory and is verified while the layer is unpacked:
+     ** it is refused unless it is a SHA-256 of 64 lowercase hex digits. */
+    static std::expected<void, error::Err>
+      check_digest(const std::string & digest) noexcept;
+
+    /** Unpack a layer into a directory of its own, then move it in place. */
+    static std::expected<void, error::Err>
+      unpack(const std::string & layout, const Layer & layer) noexcept;
+
+    /** The GOARCH name of the architecture of the kernel */
+    static std::string architecture() noexcept;
+
+  private:
+    inline static const std::string LAYERS_DIR = ".bonding/layers/";
+    inline static const std::string IMAGES_DIR = ".bonding/oci/";
+
+    /** The only algorithm of the layer digests */
+    inline static const std::string SHA256 = "sha256";
+
+    inline static const std::string INDEX_TYPE = "application/vnd.oci.image.index.v1+json";
+    inline static const std::string DOCKER_LIST_TYPE =
+      "application/vnd.docker.distribution.manifest.list.v2+json";
+    inline static const std::string REF_NAME = "org.opencontainers.image.ref.name";
+
+    inline static const size_t MAX_WORKERS = 16;
+  };
+} // namespace bonding::oci
+
+#endif /* BONDING_OCI_H */
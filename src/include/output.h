@@ -0,0 +1,100 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_OUTPUT_H
+#define BONDING_OUTPUT_H
+
+#include "config.h"
+#include "error.h"
+#include <cstdint>
+#include <expected>
+#include <string>
+#include <thread>
+
+namespace bonding::output
+{
+  /** The workload writes its stdout and stderr into pipes of its own instead of the
+   ** supervisor stdio, so that the output of containers is not interleaved. */
+  class Output
+  {
+  public:
+    /** Executed by the supervisor before the child is created: create the pipes
+     ** unless the output is inherited. */
+    static std::expected<void, error::Err>
+      prepare(config::Container_Options & options) noexcept;
+
+    /** Executed by the child process before the exec: plug the pipes as stdout and stderr. */
+    static std::expected<void, error::Err>
+      install(const config::Container_Options & options) noexcept;
+
+  private:
+    /** A larger pipe means fewer wakeups of the supervisor for a chatty workload. */
+    inline static const int PIPE_SIZE = 1024 * 1024;
+  };
+
+  /** Moves the output of the workload from its pipes to the output files or socket
+   ** with splice(), in a thread of the supervisor: the bytes never go through a
+   ** userspace buffer, and a chatty workload never slows down the supervisor. The
+   ** socket takes a connection per stream, which starts with the name of the stream.
+   ** With the "block" backpressure the workload waits when the destination is slow,
+   ** with "drop" the output the socket cannot take is discarded. */
+  class Capture
+  {
+  public:
+    explicit Capture(const config::Container_Options & options)
+      : m_options(options.output)
+      , m_prefix(
+          options.output.path.empty() ? LOG_DIR + options.name : options.output.path)
+    {}
+
+    Capture(const Capture &) = delete;
+
+    /** Open the destinations and start moving the output, the child is created. */
+    std::expected<void, error::Err> start(const config::Container_Options & options) noexcept;
+
+    /** The workload exited: move what is left and release the descriptors. */
+    std::expected<void, error::Err> stop() noexcept;
+
+  private:
+    /** One of the captured streams */
+    struct Stream
+    {
+      const char * name;
+      int          pipe = -1;
+      int          fd = -1;
+      std::string  path;
+      size_t       written = 0;
+      uint64_t     dropped = 0;
+    };
+
+    void loop() noexcept;
+
+    /** Move everything available in the pipe, returns false once the pipe is closed. */
+    bool forward(Stream & stream) noexcept;
+
+    /** Copy through a buffer, for the destinations which do not support splice(). */
+    ssize_t copy(Stream & stream) noexcept;
+
+    std::expected<void, error::Err> open_file(Stream & stream) noexcept;
+    std::expected<void, error::Err> open_socket(Stream & stream) noexcept;
+
+    /** <path> becomes <path>.1, <path>.1 becomes <path>.2, and so on. */
+    void rotate(Stream & stream) noexcept;
+
+  private:
+    const config::Output_Options m_options;
+    const std::string            m_prefix;
+
+    Stream m_streams[2] = {{.name = "stdout"}, {.name = "stderr"}};
+    int    m_null = -1;
+    int    m_wakeup[2] = {-1, -1};
+
+    std::thread m_thread;
+
+    /** The bytes moved by a single splice() */
+    inline static const size_t CHUNK = 1024 * 1024;
+
+    inline static const std::string LOG_DIR = ".bonding/log/";
+  };
+} // namespace bonding::output
+
+#endif /* BONDING_OUTPUT_H */
@@ -0,0 +1,130 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_PREFETCH_H
+#define BONDING_PREFETCH_H
+
+#include "config.h"
+#include "error.h"
+#include <chrono>
+#include <cstddef>
+#include <expected>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace bonding::prefetch
+{
+  /** A file of the root filesystem or of the mounts read at startup, and the ranges of
+   ** it that were in the page cache at the end of the recording. */
+  struct File
+  {
+    std::string path;
+
+    /** (offset, length) in bytes */
+    std::vector<std::pair<off_t, size_t>> ranges;
+  };
+
+  /** The prefetch manifest of a configuration, `.bonding/prefetch/<key>.json`: the files
+   ** its workload opened during the first `prefetch` seconds of a launch, in the order
+   ** it opened them. The next launches of the configuration read them ahead, from the
+   ** supervisor and in parallel, while the child process still sets up its mounts, so
+   ** that the workload does not fault them in one page at a time on a cold cache. The
+   ** manifest is recorded again once deleted. */
+  class Manifest
+  {
+  public:
+    /** Keyed by the root, the mounts and the command of the configuration */
+    static std::string path_of(const config::Container_Options & options) noexcept;
+
+    static std::expected<std::vector<File>, error::Err>
+      read(const std::string & path) noexcept;
+
+    static std::expected<void, error::Err>
+      write(const std::string & path, const std::vector<File> & files) noexcept;
+
+  private:
+    inline static const std::string PREFETCH_DIR = ".bonding/prefetch/";
+  };
+
+  /** Executed by the supervisor */
+  class Prefetcher
+  {
+  public:
+    /** Start reading ahead the files of the manifest of the configuration, if it has
+     ** one, on threads of their own: the launch does not wait for them. */
+    static void replay(const config::Container_Options & options) noexcept;
+
+  private:
+    static void read_ahead(const File & file) noexcept;
+
+  private:
+    inline static const size_t MAX_WORKERS = 8;
+  };
+
+  /** Records the manifest from a thread of the supervisor. The files are learnt from
+   ** the open events of fanotify on the filesystems of the root and of the mounts,
+   ** those of the processes of other mount namespaces left out, and their ranges
+   ** from mincore() once the recording ends. */
+  class Recorder
+  {
+  public:
+    Recorder() = default;
+    Recorder(const Recorder &) = delete;
+
+    /** Nothing to record when the configuration already has its manifest. */
+    std::expected<void, error::Err>
+      start(const config::Container_Options & options, pid_t pid) noexcept;
+
+    /** Ends the recording early when the container exits first, its manifest is
+     ** written all the same. */
+    void stop() noexcept;
+
+  private:
+    /** A file opened by the container, its ranges are sampled once the recording ends */
+    struct Opened
+    {
+      File  file;
+      dev_t dev;
+      ino_t ino;
+    };
+
+    void loop(std::chrono::steady_clock::time_point deadline) noexcept;
+
+    /** Keep the file of an open event if a process of the container opened it under
+     ** the root or one of the mounts, and close its descriptor. */
+    void accept(int fd, pid_t pid) noexcept;
+
+    /** The host paths the file may be at, from its path in the container */
+    std::vector<std::string> candidates(const std::string & link) const noexcept;
+
+    /** The ranges of the file in the page cache */
+    static std::vector<std::pair<off_t, size_t>> resident(int fd, size_t size) noexcept;
+
+    /** The opening process is in the mount namespace of the container, a process
+     ** already gone cannot be told apart and is left out. */
+    bool inside(pid_t pid) const noexcept;
+
+  private:
+    int                      m_fanotify = -1;
+    int                      m_wakeup[2] = {-1, -1};
+    ino_t                    m_namespace = 0;
+    std::string              m_path;
+
+    std::string                                      m_mount_dir;
+    std::vector<std::pair<std::string, std::string>> m_mounts;
+
+    std::vector<Opened>               m_opened;
+    std::set<std::pair<dev_t, ino_t>> m_seen;
+
+    std::thread m_thread;
+
+    /** Bounds the files recorded */
+    inline static const size_t MAX_FILES = 4096;
+  };
+} // namespace bonding::prefetch
+
+#endif /* BONDING_PREFETCH_H */
@@ -0,0 +1,75 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_REAPER_H
+#define BONDING_REAPER_H
+
+#include "config.h"
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace bonding::reaper
+{
+  /** What is left of a container once its workload exited. */
+  struct Job
+  {
+    /** The cgroup directories, one per hierarchy */
+    std::vector<std::string> cgroups;
+
+    /** The id of the container, keys its state directory and owner marker */
+    std::string id;
+
+    /** The pool key of the cgroups, empty when they are removed */
+    std::string pool;
+
+    /** The slot of the container in the state store, released last */
+    std::optional<size_t> slot;
+
+    /** The process owning the slot until the reaper takes it over */
+    pid_t owner;
+
+    static Job of(const config::Container_Options & options, std::optional<size_t> slot) noexcept;
+  };
+
+  /** Tears down the cgroups and directories of exited containers off the critical path:
+   ** the supervisor hands its job to a detached process and exits at once. The processes
+   ** left in the cgroups are killed (cgroup.kill on cgroups v2, freeze then SIGKILL on
+   ** v1), then every directory is removed in parallel, retrying with a backoff while
+   ** the kernel still reports it busy. */
+  class Reaper
+  {
+  public:
+    /** Run the job in a detached process, or in place when it cannot be forked. */
+    static void detach(const Job & job) noexcept;
+
+    /** Run the job in the calling process. */
+    static void run(const Job & job) noexcept;
+
+  private:
+    /** Kill every process of the cgroups, with a single write where the kernel can. */
+    static void kill(const std::vector<std::string> & cgroups) noexcept;
+
+    static void kill_procs(const std::string & cgroup) noexcept;
+
+    /** Wait for the cgroups to hold no process, false if they still do. */
+    static bool drain(const std::vector<std::string> & cgroups) noexcept;
+
+    static bool write_file(const std::string & path, const std::string & value) noexcept;
+
+    /** rmdir(), retried with an exponential backoff while busy. */
+    static bool remove(const std::string & dir, bool cgroup) noexcept;
+
+  private:
+    inline static const std::chrono::milliseconds FIRST_BACKOFF{1};
+    inline static const std::chrono::milliseconds MAX_BACKOFF{500};
+    inline static const std::chrono::milliseconds GIVE_UP{10000};
+
+    /** A cgroup slow to drain is not worth keeping */
+    inline static const std::chrono::milliseconds DRAIN{1000};
+  };
+} // namespace bonding::reaper
+
+#endif /* BONDING_REAPER_H */
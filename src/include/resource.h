@@ -5,9 +5,15 @@
 
 #include "config.h"
 #include "error.h"
+#include "unix.h"
 #include <expected>
 
+#include <chrono>
 #include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
 
 namespace bonding::resource
 {
@@ -19,29 +25,106 @@ namespace bonding::resource
   {
   public:
     static std::expected<void, error::Err>
-      setup(const bonding::config::Container_Options & config) noexcept;
+      setup(const bonding::config::Container_Options & config, pid_t pid) noexcept;
 
-    /** After the child process exited, container need to clean
-     ** all the cgroups restriction added.
-     ** NOTE: This is very simple as cgroups v2 centralises everything in a directory
-     **       under /sys/fs/cgroup/<groupname>/ */
+    /** Reset the resettable usage counters (peak memory, failures, cpu time). */
     static std::expected<void, error::Err>
-      clean(const config::Container_Options & config) noexcept;
+      reset_counters(const config::Container_Options & config) noexcept;
+
+    /** Read the usage counters of the container, keyed by "<controller>.<file>". */
+    static std::map<std::string, uint64_t>
+      read_counters(const config::Container_Options & config) noexcept;
+
+    /** The cgroup directories of the container, one per controller. They are
+     ** torn down by the reaper once the container exited. */
+    static std::vector<std::string>
+      directories(const config::Container_Options & config) noexcept;
 
   private:
     static std::expected<void, error::Err> write_settings(
-      const std::string &                         dir,
+      const unix::Fd &                            dir,
       const config::CgroupsV1::Control::Setting & setting) noexcept;
 
+    /** Create the nested cgroup <group> of the controller hierarchy, with its parents. */
+    static std::expected<void, error::Err>
+      create_group(const std::string & control, const std::string & group) noexcept;
+
+    /** Queue the creation of the cgroup of the controller, its settings and the task. */
     static std::expected<void, error::Err> write_contorl(
-      const std::string hostname, const config::CgroupsV1::Control & cgroup) noexcept;
+      unix::Batch &                      batch,
+      const unix::Fd &                   root,
+      const std::string &                id,
+      const config::CgroupsV1::Control & cgroup,
+      pid_t                              pid) noexcept;
 
-    static std::expected<void, error::Err>
-      clean_control_task(const config::CgroupsV1::Control & control) noexcept;
+  private:
+    /** The counters cleared by writing 0, and the read-only ones */
+    inline static const std::vector<std::pair<std::string, std::string>> RESETTABLE = {
+      {"memory", "memory.max_usage_in_bytes"},
+      {"memory", "memory.failcnt"},
+      {"cpuacct", "cpuacct.usage"}};
+
+    inline static const std::vector<std::pair<std::string, std::string>> COUNTERS = {
+      {"memory", "memory.max_usage_in_bytes"},
+      {"memory", "memory.failcnt"},
+      {"memory", "memory.usage_in_bytes"},
+      {"cpuacct", "cpuacct.usage"},
+      {"pids", "pids.current"}};
+  };
+
+  /** Creating a cgroup, and even more removing it, is costly in the kernel. The drained
+   ** cgroups of an exited container are kept for the next container with the same
+   ** controllers and settings, which rewrites every setting: its limits are its own.
+   ** The pool is indexed by .bonding/pool/<key>/<id>, a cgroup is claimed by unlinking
+   ** its entry, which only one process can. cgroups v1 only renames a cgroup within
+   ** its parent, a container reusing one takes an id of the same shard. The entries
+   ** idle for too long are removed by whoever recycles next, or by the collector. */
+  class Pool
+  {
+  public:
+    /** The controllers and setting names of the container, nothing without cgroups */
+    static std::string key_of(const config::Container_Options & options) noexcept;
+
+    /** Claim the cgroups of an exited container, and tell its id. The entry stays
+     ** indexed as claimed until `adopt()`, or until it is idle for too long. */
+    static std::optional<std::string> take(const std::string & key) noexcept;
+
+    /** Rename the claimed cgroups of the exited container `from` after the container,
+     ** false when the container is to create fresh cgroups instead. */
+    static bool adopt(const std::string & from, const config::Container_Options & options) noexcept;
+
+    /** Keep the cgroups of an exited container once drained, false if they are to be
+     ** removed instead. */
+    static bool recycle(
+      const std::string &              key,
+      const std::string &              id,
+      const std::vector<std::string> & cgroups) noexcept;
+
+    /** Remove the cgroups idle for too long, of every key when empty. */
+    static void shrink(const std::string & key = "") noexcept;
+
+    /** The exited container whose cgroup this is, if it is idle */
+    static std::optional<std::string> idle_id(const std::string & name) noexcept;
+
+    /** Its cgroups are indexed, and may be claimed. */
+    static bool pooled(const std::string & id) noexcept;
+
+  private:
+    /** The idle name of a cgroup directory, in the same parent */
+    static std::string idle_of(const std::string & dir, const std::string & id) noexcept;
+
+    /** Claim the entry of the index and remove its cgroups. */
+    static void destroy(const std::string & entry) noexcept;
 
   private:
-    inline static const struct config::CgroupsV1::Control::Setting TASK = {
-      .name = "tasks", .value = "0"};
+    inline static const std::string POOL_DIR = ".bonding/pool/";
+    inline static const std::string IDLE_PREFIX = "idle.";
+    inline static const std::string CLAIMED_SUFFIX = ".claimed";
+
+    /** The cgroups kept per key */
+    inline static const size_t MAX_IDLE = 64;
+
+    inline static const std::chrono::seconds IDLE_TIMEOUT{60};
   };
 
   /** Rlimit is a system used to restrict a single process.
@@ -61,10 +144,13 @@ namespace bonding::resource
   class Resource
   {
   public:
+    /** Restrict the resources of the container process pid. */
     static std::expected<void, error::Err>
-      setup(const config::Container_Options & config) noexcept;
-    static std::expected<void, error::Err>
-      clean(const config::Container_Options & config) noexcept;
+      setup(const config::Container_Options & config, pid_t pid) noexcept;
+
+    /** Move the calling process into every cgroup of the process pid,
+     ** so that it shares the limits of that container. */
+    static std::expected<void, error::Err> join(pid_t pid) noexcept;
   };
 }; // namespace bonding::resource
 
@@ -0,0 +1,153 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#ifndef BONDING_STORE_H
+#define BONDING_STORE_H
+
+#include "config.h"
+#include "error.h"
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace bonding::store
+{
+  /** What is known about a running container, fixed-size so that it is read
+   ** straight from the store. The strings are truncated and always terminated. */
+  struct Record
+  {
+    char id[24];
+    char name[72];
+    char hostname[72];
+
+    /** The workload, and its start time in clock ticks since boot, which tells it
+     ** apart from a later process reusing its pid */
+    pid_t    pid;
+    uint64_t pid_start;
+
+    /** CLOCK_REALTIME, in nanoseconds */
+    int64_t started_at;
+
+    /** The cgroup, relative to the root of each hierarchy of `controllers` */
+    char cgroup[64];
+    char controllers[128];
+
+    char rootfs[256];
+    char command[256];
+
+    /** <controller>.<setting>=<value>, separated by blanks */
+    char limits[384];
+
+    static Record of(const config::Container_Options & options, pid_t pid) noexcept;
+
+    nlohmann::json to_json() const noexcept;
+  };
+
+  /** The records of the containers of the current directory, in a file of fixed
+   ** slots mapped by every bonding process. A supervisor claims a free slot with a
+   ** compare-and-swap and owns it until the container exits. The record of a slot is
+   ** guarded by a sequence counter: the owner makes it odd while writing, the readers
+   ** retry when it is odd or moved under them. Readers take no lock and parse nothing.
+   ** The pidfd of a container is not stored, it would mean nothing in another process:
+   ** the readers open their own from the pid and its start time. */
+  class Store
+  {
+  public:
+    enum class State : uint32_t
+    {
+      Free,
+      Claimed,
+      Running
+    };
+
+    /** How a reader sees a container */
+    struct Entry
+    {
+      enum class Status
+      {
+        Running,
+
+        /** The supervisor died, the workload still runs */
+        Orphaned,
+
+        /** The workload is gone, its supervisor is cleaning up or died */
+        Exited
+      };
+
+      size_t slot;
+      pid_t  owner;
+      Record record;
+      Status status;
+
+      static const char * to_string(Status status) noexcept;
+    };
+
+    Store(const Store &) = delete;
+    Store(Store && other) noexcept : m_map(other.m_map), m_slots(other.m_slots)
+    {
+      other.m_map = nullptr;
+    }
+    ~Store();
+
+    static std::expected<Store, error::Err> open() noexcept;
+
+    /** Publish the record of a new container, owned by the calling process. */
+    std::expected<size_t, error::Err> claim(const Record & record) noexcept;
+
+    void release(size_t slot) noexcept;
+
+    /** Take over a slot whose owner died, fails if another process did it first. */
+    bool adopt(size_t slot, pid_t previous) noexcept;
+
+    /** Every claimed slot, with the status of its container */
+    std::vector<Entry> list() const noexcept;
+
+    std::optional<Entry> find(const std::string & name) const noexcept;
+
+    /** The start time of a process, 0 if it does not exist */
+    static uint64_t start_time(pid_t pid) noexcept;
+
+  private:
+    /** The owner of a slot and its record, 64 bytes aligned */
+    struct Slot;
+
+    explicit Store(void * map) noexcept : m_map(map), m_slots(SLOTS) {}
+
+    Slot & slot(size_t index) const noexcept;
+
+    /** A consistent copy of the slot, nothing if it is free */
+    std::optional<Entry> read(size_t index) const noexcept;
+
+  private:
+    void * m_map;
+    size_t m_slots;
+
+    inline static const std::string PATH = ".bonding/state";
+
+    inline static const size_t SLOTS = 4096;
+
+    /** How long a slot may stay odd before its owner is deemed dead while releasing it */
+    inline static const int STALLED_SPINS = 100000;
+
+    /** The first page holds the magic number, which carries the format version */
+    inline static const size_t   HEADER_SIZE = 4096;
+    inline static const uint64_t MAGIC = 0x3130545342444e42; /* "BNDBST01" */
+  };
+
+  /** Executed by a restarted supervisor: watch the containers whose supervisor died,
+   ** and clean up after them (cgroups, state directory, slot) once they exit. */
+  class Adopter
+  {
+  public:
+    static std::expected<void, error::Err> adopt() noexcept;
+
+  private:
+    static void clean(Store & store, const Store::Entry & entry) noexcept;
+  };
+} // namespace bonding::store
+
+#endif /* BONDING_STORE_H */
@@ -9,8 +9,11 @@
 #include <asm-generic/ioctls.h>
 #include <cstdint>
 #include <fcntl.h>
+#include <linux/filter.h>
 #include <sched.h>
+#include <string>
 #include <tuple>
+#include <vector>
 
 #if __has_include(<libseccomp/seccomp.h>)
 #include <libseccomp/seccomp.h>
@@ -26,10 +29,32 @@ namespace bonding::syscall
   class Syscall
   {
   public:
+    /** Executed by the supervisor: load the compiled BPF filter from the cache,
+     ** compiling it with libseccomp (and caching it) only when it is missing or
+     ** cannot be trusted. */
+    static std::expected<void, error::Err> prepare() noexcept;
+
+    /** Executed by the child process: install the prepared filter. */
     static std::expected<void, error::Err> setup() noexcept;
     static std::expected<void, error::Err> clean() noexcept;
 
   private:
+    /** The cache holds a header (magic, policy, checksum of the program) followed by
+     ** the program. */
+    static std::expected<void, error::Err> compile(const std::string & cache) noexcept;
+
+    /** Load the cached filter if it is owned by the effective user, writable by nobody
+     ** else, compiled from the current rules and intact. */
+    static bool load(const std::string & cache) noexcept;
+
+    /** The filter only depends on the rules below, they identify the cache. */
+    static uint64_t policy() noexcept;
+
+    static std::string cache_path() noexcept;
+
+    /** FNV-1a */
+    static uint64_t checksum(const void * data, size_t size) noexcept;
+
     /** Totally deny any attempt to call that syscall in the child process. */
     static std::expected<void, error::Err> refuse_syscall() noexcept;
 
@@ -39,6 +64,20 @@ namespace bonding::syscall
   private:
     inline static scmp_filter_ctx ctx = nullptr;
 
+    /** The compiled filter, ready for prctl(PR_SET_SECCOMP) */
+    inline static std::vector<sock_filter> program;
+
+    inline static const std::string CACHE_DIR = ".bonding/cache/";
+
+    struct Header
+    {
+      uint64_t magic;
+      uint64_t policy;
+      uint64_t checksum;
+    };
+
+    inline static const uint64_t MAGIC = 0x3130465042444e42; /* "BNDBPF01" */
+
     inline static const std::array<int, 10> default_refuse_syscalls = {
       SCMP_SYS(keyctl),
       SCMP_SYS(add_key),
@@ -9,6 +9,9 @@
 #include <sys/prctl.h>
 #include <sys/utsname.h>
 #include <expected>
+#include <string>
+#include <sys/types.h>
+#include <vector>
 
 /** Auto generate wrapper function for system calls function  */
 #define GENERATE_SYSTEM_CALL_WRAPPER(                                                    \
@@ -34,6 +37,41 @@
 
 namespace bonding::unix
 {
+  /** An owning file descriptor, closed when it goes out of scope. */
+  class Fd
+  {
+  public:
+    Fd() noexcept = default;
+    explicit Fd(const int fd) noexcept : m_fd(fd) {}
+    Fd(const Fd &) = delete;
+    Fd(Fd && other) noexcept : m_fd(other.release()) {}
+    ~Fd() { reset(); }
+
+    Fd & operator=(const Fd &) = delete;
+    Fd & operator=(Fd && other) noexcept
+    {
+      reset(other.release());
+      return *this;
+    }
+
+    int get() const noexcept { return m_fd; }
+
+    /** Give up the ownership of the descriptor */
+    int release() noexcept
+    {
+      const int fd = m_fd;
+      m_fd = -1;
+      return fd;
+    }
+
+    void reset(int fd = -1) noexcept;
+
+    explicit operator bool() const noexcept { return -1 != m_fd; }
+
+  private:
+    int m_fd = -1;
+  };
+
   class Filesystem
   {
   public:
@@ -49,6 +87,74 @@ namespace bonding::unix
     static std::expected<void, error::Err> Write(int fd, const std::string & s) noexcept;
     static std::expected<void, error::Err>
       Write(const std::string & path, const std::string & s) noexcept;
+
+    /** Hold a directory, to resolve the files in it without walking its path again. */
+    static std::expected<Fd, error::Err>
+      Open_directory(const std::string & path) noexcept;
+
+    /** Write the file `file` of the directory `dir`, opened, written and closed. */
+    static std::expected<void, error::Err>
+      Write_at(const Fd & dir, const std::string & file, const std::string & s) noexcept;
+  };
+
+  /** A batch of small file operations of the setup of a container (cgroup directories
+   ** and files, /proc files), submitted to io_uring in a single system call when the
+   ** kernel supports it, one system call each otherwise. The operations of a chain run
+   ** in order, each write as an openat, write and close linked through a direct
+   ** descriptor; the chains run in any order. The directories must outlive submit(). */
+  class Batch
+  {
+  public:
+    /** Start a new chain, independent of the previous ones. */
+    void chain() noexcept;
+
+    /** mkdirat(), a directory which exists already is no error. */
+    void mkdir(const Fd & dir, const std::string & path, mode_t mode) noexcept;
+
+    /** Write the whole value to the file `path` of the directory. */
+    void
+      write(const Fd & dir, const std::string & path, const std::string & value) noexcept;
+
+    /** Run every operation, fails on the first one which did. */
+    std::expected<void, error::Err> submit() noexcept;
+
+    size_t size() const noexcept { return m_ops.size(); }
+
+  private:
+    struct Op
+    {
+      enum class Kind
+      {
+        Mkdir,
+        Write
+      };
+
+      Kind        kind;
+      int         dir;
+      std::string path;
+      std::string value;
+      mode_t      mode;
+      size_t      chain;
+
+      /** 0 or -errno */
+      int result;
+
+      /** Completed by the ring, failed or not: it is not executed again. */
+      bool done;
+    };
+
+    /** Through io_uring, false if it is unavailable. */
+    bool submit_ring() noexcept;
+
+    /** The operations which the ring did not complete, through the system calls */
+    void submit_sync() noexcept;
+
+  private:
+    std::vector<Op> m_ops;
+    size_t          m_chain = 0;
+
+    /** Below, setting up the ring costs more system calls than it saves */
+    inline static const size_t MIN_RING_OPS = 4;
   };
 
   class Capabilities
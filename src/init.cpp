@@ -0,0 +1,101 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/init.h"
+#include "include/exec.h"
+#include "logging.h"
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace bonding::init
+{
+  void Init::exec(const config::Container_Options & options,
+                  std::vector<std::string>          env,
+                  const sigset_t &                  mask) noexcept
+  {
+    /* Own process group, so that job control signals do not reach the init. */
+    setpgid(0, 0);
+    sigprocmask(SIG_SETMASK, &mask, nullptr);
+
+    /* The descriptors were handed to the init, LISTEN_PID names the workload. */
+    for (auto & var : env)
+      if (var.starts_with("LISTEN_PID="))
+        var = "LISTEN_PID=" + std::to_string(getpid());
+
+    exec::Execve::call(options, options.argv, env);
+    _exit(127);
+  }
+
+  bool Init::reap(const pid_t workload, int & status) noexcept
+  {
+    bool exited = false;
+
+    for (int reaped_status = 0;;)
+      {
+        const pid_t reaped = waitpid(-1, &reaped_status, WNOHANG | __WALL);
+        if (reaped <= 0)
+          break;
+
+        if (reaped == workload)
+          {
+            status = reaped_status;
+            exited = true;
+          }
+      }
+
+    return exited;
+  }
+
+  int Init::run(const config::Container_Options & options,
+                std::vector<std::string>          env) noexcept
+  {
+    /* Outside of a new pid namespace, the orphans of the workload still come to us. */
+    if (1 != getpid() && -1 == prctl(PR_SET_CHILD_SUBREAPER, 1))
+      LOG_WARNING << "Cannot become the subreaper of the workload";
+
+    sigset_t forwarded;
+    sigset_t previous;
+    sigfillset(&forwarded);
+    for (const int signal : SYNCHRONOUS)
+      sigdelset(&forwarded, signal);
+
+    /* Every signal is taken synchronously from sigwaitinfo(), before the fork so
+     * that none is lost in between. */
+    sigprocmask(SIG_SETMASK, &forwarded, &previous);
+
+    const pid_t workload = fork();
+    if (-1 == workload)
+      {
+        LOG_ERROR << "Cannot fork the workload";
+        return EXIT_FAILURE;
+      }
+
+    if (0 == workload)
+      exec(options, std::move(env), previous);
+
+    /* The init has no use of the descriptors handed to the workload. */
+    ::syscall(SYS_close_range, 3, ~0U, 0);
+
+    LOG_DEBUG << "Init running the workload on process " << workload << "...✓";
+
+    int status = 0;
+    for (;;)
+      {
+        siginfo_t info = {};
+        const int signal = sigwaitinfo(&forwarded, &info);
+        if (-1 == signal)
+          continue;
+
+        if (SIGCHLD == signal)
+          {
+            if (reap(workload, status))
+              break;
+          }
+        else
+          kill(workload, signal);
+      }
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  }
+} // namespace bonding::init
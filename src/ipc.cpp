@@ -1,7 +1,10 @@
 /** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
 
 #include "include/ipc.h"
+#include <algorithm>
+#include <cstring>
 #include <sys/socket.h>
+#include <unistd.h>
 
 namespace bonding::ipc
 {
@@ -31,4 +34,127 @@ namespace bonding::ipc
 
     return static_cast<bool>(buf[0]);
   }
-} // namespace bonding::ipc
\ No newline at end of file
+
+  std::expected<void, error::Err> IPC::send_fds(
+    const int socket, const std::string & message, const std::vector<int> & fds) noexcept
+  {
+    if (fds.size() > MAX_FDS)
+      return std::unexpected(ERR_MSG(
+        error::Code::Socket, "Too many descriptors: " + std::to_string(fds.size())));
+
+    /* An empty datagram cannot carry ancillary data, always send at least one byte. */
+    const std::string payload = message.empty() ? std::string(1, '\0') : message;
+    iovec             iov = {const_cast<char *>(payload.data()), payload.size()};
+    msghdr            msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+    if (!fds.empty())
+      {
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+      }
+
+    if (-1 == sendmsg(socket, &msg, MSG_NOSIGNAL))
+      return std::unexpected(ERR_MSG(
+        error::Code::Socket,
+        "Cannot send descriptors through socket: " + std::to_string(socket)));
+
+    return {};
+  }
+
+  std::expected<std::pair<std::string, std::vector<int>>, error::Err>
+    IPC::recv_fds(const int socket) noexcept
+  {
+    std::string       payload(MAX_MESSAGE, '\0');
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * MAX_FDS));
+    iovec             iov = {payload.data(), payload.size()};
+    msghdr            msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+    const ssize_t received = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+    if (-1 == received)
+      return std::unexpected(ERR_MSG(
+        error::Code::Socket,
+        "Cannot receive descriptors from socket: " + std::to_string(socket)));
+
+    std::vector<int> fds;
+    for (cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); nullptr != cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg))
+      if (SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type)
+        {
+          const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+          const size_t first = fds.size();
+          fds.resize(first + count);
+          memcpy(&fds[first], CMSG_DATA(cmsg), sizeof(int) * count);
+        }
+
+    if (0 != (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+      {
+        for (const int fd : fds)
+          close(fd);
+
+        return std::unexpected(
+          ERR_MSG(error::Code::Socket, "Truncated message from socket"));
+      }
+
+    payload.resize(received);
+    if (payload.size() == 1 && payload[0] == '\0')
+      payload.clear();
+
+    return std::make_pair(payload, fds);
+  }
+
+  std::expected<void, error::Err>
+    IPC::send_string(const int socket, const std::string & data) noexcept
+  {
+    const uint64_t size = data.size();
+    if (-1 == send(socket, &size, sizeof(size), MSG_NOSIGNAL))
+      return std::unexpected(ERR_MSG(
+        error::Code::Socket, "Cannot send string through socket: " + std::to_string(socket)));
+
+    for (size_t offset = 0; offset < data.size(); offset += CHUNK)
+      if (
+        -1
+        == send(
+          socket, data.data() + offset, std::min(CHUNK, data.size() - offset), MSG_NOSIGNAL))
+        return std::unexpected(ERR_MSG(
+          error::Code::Socket,
+          "Cannot send string through socket: " + std::to_string(socket)));
+
+    return {};
+  }
+
+  std::expected<std::string, error::Err> IPC::recv_string(const int socket) noexcept
+  {
+    uint64_t size = 0;
+    if (sizeof(size) != recv(socket, &size, sizeof(size), 0))
+      return std::unexpected(ERR_MSG(
+        error::Code::Socket, "Cannot receive string from socket " + std::to_string(socket)));
+
+    std::string data(size, '\0');
+    for (size_t offset = 0; offset < size;)
+      {
+        const ssize_t received =
+          recv(socket, data.data() + offset, std::min<size_t>(CHUNK, size - offset), 0);
+        if (received <= 0)
+          return std::unexpected(ERR_MSG(
+            error::Code::Socket,
+            "Cannot receive string from socket " + std::to_string(socket)));
+
+        offset += received;
+      }
+
+    return data;
+  }
+} // namespace bonding::ipc
@@ -0,0 +1,183 @@
+#include "private/async.h"
+#include <unistd.h>
+
+namespace bonding::logging::async
+{
+  AsyncAppender::~AsyncAppender() { stop(); }
+
+  auto AsyncAppender::write(const Record & record) noexcept -> void
+  {
+    if (!m_running.load(std::memory_order_acquire))
+      {
+        m_sink.write(record);
+        if (json::JsonFileAppender * json = m_json.load(); nullptr != json)
+          json->write(record);
+        return;
+      }
+
+    Entry entry{
+      record.getSeverity(), record.getTime(), context::phase.load(), record.getMessage()};
+
+    // Writing it synchronously would reorder the records of this thread: wait for room.
+    while (!m_ring.try_push(std::move(entry)))
+      {
+        wake();
+        std::this_thread::yield();
+      }
+
+    wake();
+  }
+
+  auto AsyncAppender::wake() noexcept -> void
+  {
+    // Only the first record after the thread went to sleep costs a system call.
+    if (m_sleeping.load())
+      {
+        m_signal.fetch_add(1);
+        m_signal.notify_one();
+      }
+  }
+
+  auto AsyncAppender::drain() noexcept -> size_t
+  {
+    json::JsonFileAppender * json = m_json.load();
+    util::nstring            lines;
+    util::nstring            json_lines;
+    Entry                    entry;
+    size_t                   count = 0;
+
+    while (count < BATCH && m_ring.try_pop(entry))
+      {
+        lines += m_sink.render(entry.severity, entry.time, entry.message.c_str());
+        if (nullptr != json)
+          json_lines += json->render(entry.severity, entry.time, entry.phase, entry.message.c_str());
+        ++count;
+      }
+
+    if (0 != count)
+      {
+        m_sink.write_lines(lines);
+        if (nullptr != json)
+          json->write_lines(json_lines);
+        m_written.fetch_add(count, std::memory_order_release);
+        m_written.notify_all();
+      }
+
+    return count;
+  }
+
+  auto AsyncAppender::loop() noexcept -> void
+  {
+    m_thread_id.store(std::this_thread::get_id());
+
+    for (;;)
+      {
+        if (0 != drain())
+          continue;
+
+        if (m_stopping.load())
+          break;
+
+        // Announce the sleep before checking the ring a last time: a producer either
+        // sees the announcement and signals, or pushed before the last check.
+        const uint32_t signal = m_signal.load();
+        m_sleeping.store(true);
+
+        if (0 == drain() && !m_stopping.load())
+          m_signal.wait(signal);
+
+        m_sleeping.store(false);
+      }
+  }
+
+  auto AsyncAppender::attach(json::JsonFileAppender & json) noexcept -> void
+  {
+    m_json.store(&json);
+  }
+
+  auto AsyncAppender::start() noexcept -> void
+  {
+    if (m_running.load())
+      return;
+
+    m_stopping.store(false);
+    m_thread = std::make_unique<std::thread>([this]() { loop(); });
+    m_running.store(true, std::memory_order_release);
+  }
+
+  auto AsyncAppender::flush() noexcept -> void
+  {
+    if (!m_running.load())
+      return;
+
+    const size_t pushed = m_ring.pushed();
+    for (size_t written = m_written.load(); written < pushed; written = m_written.load())
+      {
+        wake();
+        m_written.wait(written);
+      }
+  }
+
+  auto AsyncAppender::flush_on_terminate() noexcept -> void
+  {
+    if (!m_running.load())
+      return;
+
+    // The background thread cannot wait for itself.
+    if (std::this_thread::get_id() == m_thread_id.load())
+      {
+        salvage();
+        return;
+      }
+
+    // It may wait for a lock this thread holds: it is given a bounded time, then the
+    // records left are given up. The ring has a single consumer, they cannot be taken.
+    const size_t pushed = m_ring.pushed();
+    const auto   deadline = std::chrono::steady_clock::now() + TERMINATE_GRACE;
+    while (m_written.load() < pushed && std::chrono::steady_clock::now() < deadline)
+      {
+        wake();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+  }
+
+  auto AsyncAppender::salvage() noexcept -> void
+  {
+    Entry entry;
+    while (m_ring.try_pop(entry))
+      {
+        const util::nstring line = m_sink.render(entry.severity, entry.time, entry.message.c_str());
+        if (-1 == ::write(STDOUT_FILENO, line.data(), line.size()))
+          return;
+      }
+  }
+
+  auto AsyncAppender::stop() noexcept -> void
+  {
+    if (!m_running.load())
+      return;
+
+    // New records are written synchronously, the pending ones by the thread.
+    m_running.store(false);
+    m_stopping.store(true);
+    m_signal.fetch_add(1);
+    m_signal.notify_one();
+
+    m_thread->join();
+    m_thread.reset();
+
+    // A record pushed while the thread was exiting.
+    while (0 != drain())
+      ;
+  }
+
+  auto AsyncAppender::forget() noexcept -> void
+  {
+    if (!m_running.load())
+      return;
+
+    // The thread does not exist in this process, its handle cannot be joined.
+    m_running.store(false);
+    static_cast<void>(m_thread.release());
+  }
+} // namespace bonding::logging::async
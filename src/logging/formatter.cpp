@@ -1,5 +1,5 @@
 #include "private/formatter.h"
-#include "iomanip"
+#include <cstdio>
 
 namespace bonding::logging::formatter
 {
@@ -7,22 +7,55 @@ namespace bonding::logging::formatter
 
   [[nodiscard]] auto Formatter::header() noexcept -> util::nstring { return {}; }
 
+  [[nodiscard]] auto Formatter::prefix(const util::Time & time) noexcept
+    -> const util::nstring &
+  {
+    thread_local time_t         cached_second = -1;
+    thread_local unsigned short cached_millisecond = 0;
+    thread_local char           date[32] = {};
+    thread_local util::nstring  cached;
+
+    if (time.time == cached_second && time.millitm == cached_millisecond)
+      return cached;
+
+    if (time.time != cached_second)
+      {
+        tm t{};
+        util::localtime_s(&t, &time.time);
+        snprintf(
+          date,
+          sizeof(date),
+          "| %d-%02d-%02d %02d:%02d:%02d.",
+          t.tm_year + 1900,
+          t.tm_mon + 1,
+          t.tm_mday,
+          t.tm_hour,
+          t.tm_min,
+          t.tm_sec);
+      }
+
+    char millisecond[8] = {};
+    snprintf(millisecond, sizeof(millisecond), "%03d > ", static_cast<int>(time.millitm));
+
+    cached_second = time.time;
+    cached_millisecond = time.millitm;
+    cached.assign(date).append(millisecond);
+
+    return cached;
+  }
+
+  [[nodiscard]] auto Formatter::format(const util::Time & time, const util::nchar * message) noexcept
+    -> util::nstring
+  {
+    util::nstring line = prefix(time);
+    line.append(message).append(PLOG_NSTR("\n"));
+
+    return line;
+  }
+
   [[nodiscard]] auto Formatter::format(const plog::Record & record) noexcept
     -> util::nstring
   {
-    tm t{};
-    util::localtime_s(&t, &record.getTime().time);
-    util::nostringstream ss;
-
-    ss << "| " << t.tm_year + 1900 << "-" << std::setfill(PLOG_NSTR('0')) << std::setw(2)
-       << t.tm_mon + 1 << PLOG_NSTR("-") << std::setfill(PLOG_NSTR('0')) << std::setw(2)
-       << t.tm_mday << PLOG_NSTR(" ") << std::setfill(PLOG_NSTR('0')) << std::setw(2)
-       << t.tm_hour << PLOG_NSTR(":") << std::setfill(PLOG_NSTR('0')) << std::setw(2)
-       << t.tm_min << PLOG_NSTR(":") << std::setfill(PLOG_NSTR('0')) << std::setw(2)
-       << t.tm_sec << PLOG_NSTR(".") << std::setfill(PLOG_NSTR('0')) << std::setw(3)
-       << static_cast<int>(record.getTime().millitm) << PLOG_NSTR(" > ")
-       << record.getMessage() << PLOG_NSTR("\n");
-
-    return ss.str();
+    return format(record.getTime(), record.getMessage());
   }
-} // namespace bonding::logging::formatter
\ No newline at end of file
+} // namespace bonding::logging::formatter
@@ -0,0 +1,179 @@
+#include "private/json.h"
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bonding::logging::json
+{
+  JsonFileAppender::~JsonFileAppender()
+  {
+    if (-1 != m_fd)
+      close(m_fd);
+
+    if (-1 != m_dir)
+      close(m_dir);
+  }
+
+  auto JsonFileAppender::open(const std::string & path, const size_t max_size, const size_t files) noexcept
+    -> bool
+  {
+    util::MutexLock lock(m_mutex);
+
+    // The directory is held: the child process still rotates the files once it moved
+    // into its own root.
+    const size_t      slash = path.rfind('/');
+    const std::string dir = std::string::npos == slash ? "." : path.substr(0, slash + 1);
+
+    const int dir_fd = ::open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (-1 == dir_fd)
+      return false;
+
+    if (-1 != m_dir)
+      close(m_dir);
+
+    m_dir = dir_fd;
+    m_name = std::string::npos == slash ? path : path.substr(slash + 1);
+    m_max_size = max_size;
+    m_files = files;
+    reopen();
+
+    return -1 != m_fd;
+  }
+
+  auto JsonFileAppender::reopen() noexcept -> void
+  {
+    const int fd = openat(m_dir, m_name.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    // The current file is kept rather than losing every record.
+    if (-1 == fd)
+      return;
+
+    if (-1 != m_fd)
+      close(m_fd);
+
+    m_fd = fd;
+  }
+
+  auto JsonFileAppender::rotate_if_needed(const size_t incoming) noexcept -> void
+  {
+    struct stat ours = {};
+    struct stat current = {};
+    if (-1 == fstat(m_fd, &ours))
+      return;
+
+    // Another process sharing the file rotated it already.
+    if (-1 == fstatat(m_dir, m_name.c_str(), &current, 0) || current.st_ino != ours.st_ino
+        || current.st_dev != ours.st_dev)
+      {
+        reopen();
+        return;
+      }
+
+    if (0 == ours.st_size || static_cast<size_t>(ours.st_size) + incoming <= m_max_size)
+      return;
+
+    for (size_t i = m_files; i > 1; --i)
+      renameat(m_dir,
+               (m_name + "." + std::to_string(i - 1)).c_str(),
+               m_dir,
+               (m_name + "." + std::to_string(i)).c_str());
+
+    if (0 == m_files)
+      unlinkat(m_dir, m_name.c_str(), 0);
+    else
+      renameat(m_dir, m_name.c_str(), m_dir, (m_name + ".1").c_str());
+
+    reopen();
+  }
+
+  auto JsonFileAppender::write_lines(const util::nstring & lines) noexcept -> void
+  {
+    util::MutexLock lock(m_mutex);
+    if (-1 == m_fd || lines.empty())
+      return;
+
+    rotate_if_needed(lines.size());
+
+    for (size_t offset = 0; offset < lines.size() && -1 != m_fd;)
+      {
+        const ssize_t written = ::write(m_fd, lines.data() + offset, lines.size() - offset);
+        if (-1 == written && EINTR == errno)
+          continue;
+
+        if (written <= 0)
+          break;
+
+        offset += written;
+      }
+  }
+
+  auto JsonFileAppender::escape(util::nstring & out, const util::nchar * text) noexcept -> void
+  {
+    out += '"';
+
+    for (const util::nchar * c = text; '\0' != *c; ++c)
+      switch (*c)
+        {
+        case '"':
+          out += "\\\"";
+          break;
+        case '\\':
+          out += "\\\\";
+          break;
+        case '\n':
+          out += "\\n";
+          break;
+        case '\r':
+          out += "\\r";
+          break;
+        case '\t':
+          out += "\\t";
+          break;
+        default:
+          if (static_cast<unsigned char>(*c) < 0x20)
+            {
+              char code[8] = {};
+              snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned char>(*c));
+              out += code;
+            }
+          else
+            out += *c;
+        }
+
+    out += '"';
+  }
+
+  auto JsonFileAppender::render(
+    const Severity            severity,
+    const util::Time &        time,
+    const char *              phase,
+    const util::nchar *       message) noexcept -> util::nstring
+  {
+    util::nstring line;
+    line.reserve(128);
+
+    line += "{\"ts\":";
+    line += std::to_string(static_cast<int64_t>(time.time) * 1000 + time.millitm);
+    line += ",\"level\":\"";
+    line += severityToString(severity);
+    line += "\",\"container\":";
+    const std::string * container = context::container.load();
+    escape(line, nullptr == container ? "" : container->c_str());
+    line += ",\"phase\":";
+    escape(line, phase);
+    line += ",\"pid\":";
+    line += std::to_string(getpid());
+    line += ",\"msg\":";
+    escape(line, message);
+    line += "}\n";
+
+    return line;
+  }
+
+  auto JsonFileAppender::write(const Record & record) noexcept -> void
+  {
+    write_lines(render(record.getSeverity(), record.getTime(), context::phase.load(), record.getMessage()));
+  }
+} // namespace bonding::logging::json
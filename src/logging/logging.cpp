@@ -1,14 +1,81 @@
 #include "public/logging.h"
+#include "private/async.h"
+#include <exception>
 
 namespace bonding::logging
 {
+  /// The JSON lines file, outlives the AsyncAppender which writes to it until exit.
+  static auto json_appender() noexcept -> json::JsonFileAppender &
+  {
+    static json::JsonFileAppender json;
+    return json;
+  }
+
+  /// The ColorConsoleAppender that formats log messages with colors based on their
+  /// severity, behind the AsyncAppender which decides when they are written.
+  static auto async_appender() noexcept -> async::AsyncAppender &
+  {
+    json_appender();
+    static appender::ColorConsoleAppender<formatter::Formatter> console;
+    static async::AsyncAppender                                 appender(console);
+    return appender;
+  }
+
   /// Sets the logging level for the application.
-  /// This initializes the logger with a ColorConsoleAppender that formats log messages
-  /// with colors based on their severity.
+  /// This initializes the logger the first time, init() would register the appender
+  /// again on every call.
   /// @param _level The desired logging level to set.
   auto set_level(const LOG_LEVEL & _level) noexcept -> void
   {
-    static appender::ColorConsoleAppender<formatter::Formatter> appender;
-    init(_level, &appender);
+    static bool initialized = false;
+
+    if (initialized)
+      plog::get()->setMaxSeverity(_level);
+    else
+      init(_level, &async_appender());
+
+    initialized = true;
   }
+
+  auto set_async(const bool enabled) noexcept -> void
+  {
+    if (!enabled)
+      {
+        async_appender().stop();
+        return;
+      }
+
+    // The records of an error are written before the program is aborted, even when the
+    // logging thread or a lock of the appenders is the culprit.
+    static const std::terminate_handler previous = std::set_terminate([]() {
+      async_appender().flush_on_terminate();
+      if (nullptr != previous)
+        previous();
+      std::abort();
+    });
+
+    async_appender().start();
+  }
+
+  auto set_container(const std::string & container) noexcept -> void
+  {
+    /* A previous name is left allocated, a record may still be rendered with it. */
+    context::container.store(new std::string(container));
+  }
+
+  auto set_phase(const char * phase) noexcept -> void { context::phase.store(phase); }
+
+  auto open_json(const std::string & path, const size_t max_size, const size_t files) noexcept
+    -> bool
+  {
+    if (!json_appender().open(path, max_size, files))
+      return false;
+
+    async_appender().attach(json_appender());
+    return true;
+  }
+
+  auto flush() noexcept -> void { async_appender().flush(); }
+
+  auto after_fork() noexcept -> void { async_appender().forget(); }
 } // namespace bonding::logging
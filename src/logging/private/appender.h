@@ -34,6 +34,17 @@ namespace bonding::logging::appender
     /// @param record The log record to write.
     auto write(const Record & record) noexcept -> void PLOG_OVERRIDE;
 
+    /// Formats a message with the color of its severity, without writing it.
+    /// @param severity The severity level of the log record.
+    /// @param time The time the message was logged at.
+    /// @param message The message of the log record.
+    [[nodiscard]] auto render(Severity severity, const util::Time & time, const util::nchar * message) noexcept
+      -> util::nstring;
+
+    /// Writes already rendered lines to the console at once.
+    /// @param lines The rendered lines.
+    auto write_lines(const util::nstring & lines) noexcept -> void;
+
   protected:
     /// Returns the color code for the specified severity level.
     /// @param severity The severity level of the log record.
@@ -50,11 +61,23 @@ namespace bonding::logging::appender
   template <typename T>
   auto ColorConsoleAppender<T>::write(const Record & record) noexcept -> void
   {
-    util::nstring   str = Formatter::format(record);
-    util::MutexLock lock(this->m_mutex);
+    write_lines(render(record.getSeverity(), record.getTime(), record.getMessage()));
+  }
+
+  template <typename T>
+  [[nodiscard]] auto ColorConsoleAppender<T>::render(
+    Severity severity, const util::Time & time, const util::nchar * message) noexcept
+    -> util::nstring
+  {
+    // The formatted string with the appropriate color.
+    return this->get_color(severity) + T::format(time, message) + "\033[0m";
+  }
 
-    // Write the formatted string with the appropriate color.
-    this->writestr(this->get_color(record.getSeverity()) + str + "\033[0m");
+  template <typename T>
+  auto ColorConsoleAppender<T>::write_lines(const util::nstring & lines) noexcept -> void
+  {
+    util::MutexLock lock(this->m_mutex);
+    this->writestr(lines);
   }
 
   template <typename T>
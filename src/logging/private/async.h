@@ -0,0 +1,106 @@
+#pragma once
+
+#include "appender.h"
+#include "context.h"
+#include "formatter.h"
+#include "json.h"
+#include "ring.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+namespace bonding::logging::async
+{
+  using namespace plog;
+
+  /// A record waiting in the ring: only what formatting needs is kept.
+  struct Entry
+  {
+    Severity      severity;
+    util::Time    time;
+    const char *  phase;
+    util::nstring message;
+  };
+
+  /// Hands the records to a background thread, which formats them and writes them
+  /// to the console, and to the JSON file when there is one, in batches. The logging threads only copy the message into a
+  /// lock-free ring, they never format, lock or write.
+  /// When stopped, the records are written synchronously.
+  class AsyncAppender : public IAppender
+  {
+  public:
+    /// @param sink The appender the records are eventually written to.
+    explicit AsyncAppender(appender::ColorConsoleAppender<formatter::Formatter> & sink)
+      : m_sink(sink)
+    {
+    }
+
+    /// Writes the pending records and stops the background thread.
+    ~AsyncAppender() override;
+
+    auto write(const Record & record) noexcept -> void PLOG_OVERRIDE;
+
+    /// Also writes the records to a JSON file from now on.
+    /// @param json The opened JSON file appender.
+    auto attach(json::JsonFileAppender & json) noexcept -> void;
+
+    /// Starts the background thread.
+    auto start() noexcept -> void;
+
+    /// Writes the pending records, then stops the background thread.
+    auto stop() noexcept -> void;
+
+    /// Blocks until every record pushed so far is written.
+    auto flush() noexcept -> void;
+
+    /// Writes what it can of the pending records from std::terminate, which may run on
+    /// the background thread itself or hold a lock it waits for. On the background
+    /// thread, they are written straight to the console without taking any lock.
+    /// Elsewhere, the background thread is waited for a grace period only.
+    auto flush_on_terminate() noexcept -> void;
+
+    /// Called in a process created by fork() or clone(): the background thread
+    /// only exists in the parent process, and the pending records are written by it.
+    auto forget() noexcept -> void;
+
+  private:
+    /// The body of the background thread.
+    auto loop() noexcept -> void;
+
+    /// Formats and writes the records available in the ring.
+    /// @return The number of records written.
+    auto drain() noexcept -> size_t;
+
+    /// Wakes the background thread up if it waits for records.
+    auto wake() noexcept -> void;
+
+    /// Writes the records left in the ring to the standard output, without the lock of
+    /// the console: only from the background thread.
+    auto salvage() noexcept -> void;
+
+  private:
+    /// The records of a launch fit, a burst beyond waits for the background thread.
+    inline static constexpr size_t CAPACITY = 4096;
+
+    /// Upper bound of the records written at once.
+    inline static constexpr size_t BATCH = 256;
+
+    /// How long std::terminate waits for the background thread.
+    inline static constexpr std::chrono::milliseconds TERMINATE_GRACE{500};
+
+    appender::ColorConsoleAppender<formatter::Formatter> & m_sink;
+    std::atomic<json::JsonFileAppender *>                  m_json{nullptr};
+    ring::Ring<Entry, CAPACITY>                            m_ring;
+
+    std::atomic<bool>     m_running{false};
+    std::atomic<bool>     m_stopping{false};
+    std::atomic<bool>     m_sleeping{false};
+    std::atomic<uint32_t> m_signal{0};
+    std::atomic<size_t>   m_written{0};
+
+    std::atomic<std::thread::id> m_thread_id;
+
+    std::unique_ptr<std::thread> m_thread;
+  };
+} // namespace bonding::logging::async
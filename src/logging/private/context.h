@@ -0,0 +1,14 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+namespace bonding::logging::context
+{
+  /// The container the records of this process belong to, read by the logging
+  /// thread: published with a single store, and never freed.
+  inline std::atomic<const std::string *> container{nullptr};
+
+  /// The phase of the container life the process is in, a string literal.
+  inline std::atomic<const char *> phase{"start"};
+} // namespace bonding::logging::context
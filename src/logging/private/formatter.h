@@ -21,5 +21,20 @@ namespace bonding::logging::formatter
     /// @return A formatted string representation of the log record.
     [[nodiscard]] static auto format(const plog::Record & record) noexcept
       -> util::nstring;
+
+    /// Formats a message logged at the given time, the record itself may be gone
+    /// when the message is formatted by the background thread.
+    /// @param time The time the message was logged at.
+    /// @param message The message of the log record.
+    /// @return A formatted string representation of the message.
+    [[nodiscard]] static auto format(const util::Time & time, const util::nchar * message) noexcept
+      -> util::nstring;
+
+  private:
+    /// Returns the timestamp prefix of the lines logged at the given time.
+    /// It is cached and only rebuilt when the millisecond changes, and localtime
+    /// is only called when the second changes.
+    /// @param time The time the message was logged at.
+    [[nodiscard]] static auto prefix(const util::Time & time) noexcept -> const util::nstring &;
   }; // namespace bonding::logging::formatter
-} // namespace bonding::logging::formatter
\ No newline at end of file
+} // namespace bonding::logging::formatter
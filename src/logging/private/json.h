@@ -0,0 +1,63 @@
+#pragma once
+
+#include "context.h"
+#include <plog/Log.h>
+#include <plog/Util.h>
+#include <string>
+#include <sys/types.h>
+
+namespace bonding::logging::json
+{
+  using namespace plog;
+
+  /// Writes the records as JSON lines, tagged with the container and the phase:
+  ///   {"ts":1700000000123,"level":"INFO","container":"web","phase":"setup","pid":42,"msg":"..."}
+  /// The file is opened with O_APPEND, so that the supervisor and the child process
+  /// share it without interleaving, and rotated once it exceeds its maximum size:
+  /// <path> becomes <path>.1, <path>.1 becomes <path>.2, and so on.
+  class JsonFileAppender : public IAppender
+  {
+  public:
+    ~JsonFileAppender() override;
+
+    /// Opens the log file, returns false when it cannot be opened.
+    /// @param path The log file.
+    /// @param max_size The size of the file before it is rotated.
+    /// @param files The number of rotated files kept.
+    [[nodiscard]] auto open(const std::string & path, size_t max_size, size_t files) noexcept
+      -> bool;
+
+    auto write(const Record & record) noexcept -> void PLOG_OVERRIDE;
+
+    /// Formats a record as a JSON line, without writing it.
+    [[nodiscard]] static auto
+      render(Severity severity, const util::Time & time, const char * phase, const util::nchar * message) noexcept
+      -> util::nstring;
+
+    /// Writes already rendered lines with a single write.
+    /// @param lines The rendered lines.
+    auto write_lines(const util::nstring & lines) noexcept -> void;
+
+  private:
+    /// Rotates the files when the next write would exceed the maximum size, or
+    /// reopens the file when another process rotated it.
+    auto rotate_if_needed(size_t incoming) noexcept -> void;
+
+    /// Opens the file m_name of m_dir in place of the current one, which is kept when
+    /// the file cannot be opened.
+    auto reopen() noexcept -> void;
+
+    /// Appends a JSON string literal.
+    static auto escape(util::nstring & out, const util::nchar * text) noexcept -> void;
+
+  private:
+    util::Mutex m_mutex;
+    int         m_dir = -1;
+
+    /// The name of the file in m_dir
+    std::string m_name;
+    size_t      m_max_size = 0;
+    size_t      m_files = 0;
+    int         m_fd = -1;
+  };
+} // namespace bonding::logging::json
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace bonding::logging::ring
+{
+  /// A bounded lock-free queue with many producers and a single consumer.
+  /// Every cell carries a sequence number telling whose turn it is: a producer
+  /// claims a position with one compare-and-swap and publishes the cell by
+  /// bumping its sequence, the consumer never writes the shared position.
+  /// @tparam T The type of the queued values.
+  /// @tparam N The capacity, a power of two.
+  template <class T, size_t N>
+  class Ring
+  {
+    static_assert(N > 1 && 0 == (N & (N - 1)), "The capacity must be a power of two");
+
+    struct Cell
+    {
+      std::atomic<size_t> sequence;
+      T                   value;
+    };
+
+  public:
+    Ring() : m_cells(std::make_unique<Cell[]>(N))
+    {
+      for (size_t i = 0; i < N; ++i)
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /// Pushes a value, from any thread.
+    /// @return false when the ring is full.
+    [[nodiscard]] auto try_push(T && value) noexcept -> bool
+    {
+      size_t position = m_enqueue.load(std::memory_order_relaxed);
+
+      for (;;)
+        {
+          Cell &         cell = m_cells[position & (N - 1)];
+          const size_t   sequence = cell.sequence.load(std::memory_order_acquire);
+          const intptr_t difference =
+            static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+          if (0 == difference)
+            {
+              if (m_enqueue.compare_exchange_weak(
+                    position, position + 1, std::memory_order_relaxed))
+                {
+                  cell.value = std::move(value);
+                  cell.sequence.store(position + 1, std::memory_order_release);
+                  return true;
+                }
+            }
+          else if (difference < 0)
+            return false;
+          else
+            position = m_enqueue.load(std::memory_order_relaxed);
+        }
+    }
+
+    /// Pops the oldest value, from the consumer thread only.
+    /// @return false when the ring is empty.
+    [[nodiscard]] auto try_pop(T & value) noexcept -> bool
+    {
+      Cell &       cell = m_cells[m_dequeue & (N - 1)];
+      const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+
+      if (sequence != m_dequeue + 1)
+        return false;
+
+      value = std::move(cell.value);
+      cell.sequence.store(m_dequeue + N, std::memory_order_release);
+      ++m_dequeue;
+
+      return true;
+    }
+
+    /// The number of values claimed by the producers so far.
+    [[nodiscard]] auto pushed() const noexcept -> size_t
+    {
+      return m_enqueue.load(std::memory_order_acquire);
+    }
+
+  private:
+    std::unique_ptr<Cell[]> m_cells;
+
+    // On their own cache lines: the producers hammer the first one.
+    alignas(64) std::atomic<size_t> m_enqueue{0};
+    alignas(64) size_t m_dequeue = 0;
+  };
+} // namespace bonding::logging::ring
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../private/appender.h"
+#include <string>
 
 namespace bonding::logging
 {
@@ -8,4 +9,33 @@ namespace bonding::logging
   /// This function should be called to configure the logging behavior.
   /// @param _level The desired logging level to set.
   auto set_level(const LOG_LEVEL & _level) noexcept -> void;
-} // namespace bonding::logging
\ No newline at end of file
+
+  /// Switches between synchronous and asynchronous logging. In asynchronous mode the
+  /// records are formatted and written in batches by a background thread, and the
+  /// pending ones are written before the program exits.
+  /// @param enabled Whether the records are written by the background thread.
+  auto set_async(bool enabled) noexcept -> void;
+
+  /// Blocks until every record logged so far is written.
+  auto flush() noexcept -> void;
+
+  /// Tags the records of this process with the container they belong to.
+  /// @param container The hostname of the container.
+  auto set_container(const std::string & container) noexcept -> void;
+
+  /// Tags the records logged from now on with a phase of the container life.
+  /// @param phase A string literal: "prepare", "setup", "running", "clean"...
+  auto set_phase(const char * phase) noexcept -> void;
+
+  /// Also writes the records as JSON lines to a file, rotated by size.
+  /// @param path The log file.
+  /// @param max_size The size of the file before it is rotated.
+  /// @param files The number of rotated files kept.
+  /// @return false when the file cannot be opened.
+  auto open_json(const std::string & path, size_t max_size, size_t files) noexcept -> bool;
+
+  /// Must be called first by a process created by fork() or clone() while the
+  /// logging was asynchronous: the background thread does not exist in it,
+  /// so it logs synchronously.
+  auto after_fork() noexcept -> void;
+} // namespace bonding::logging
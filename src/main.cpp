@@ -9,6 +9,7 @@ using namespace bonding;
 int __main(int argc, char ** argv)
 {
   logging::set_level(LOG_LEVEL_INFO);
+  logging::set_async(true);
   try
     {
       cli::Command_Line_Args::make(argc, argv);
@@ -0,0 +1,336 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/manifest.h"
+#include "include/control.h"
+#include "include/unix.h"
+#include "logging.h"
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace bonding::manifest
+{
+  namespace
+  {
+    /** How a replica ended, from its wait status */
+    std::string describe(const int status) noexcept
+    {
+      if (WIFSIGNALED(status))
+        return "was killed by signal " + std::to_string(WTERMSIG(status));
+      return "exited with code " + std::to_string(WEXITSTATUS(status));
+    }
+  } // namespace
+
+  std::expected<Manifest, error::Err> Manifest::read(const std::string & path) noexcept
+  {
+    const std::string content = unix::Filesystem::read_entire_file(path).value();
+
+    try
+      {
+        return of_json(nlohmann::json::parse(content));
+      }
+    catch (const nlohmann::json::exception & e)
+      {
+        return std::unexpected(ERR_MSG(error::Code::Manifest, e.what()));
+      }
+  }
+
+  std::expected<Manifest, error::Err> Manifest::of_json(const nlohmann::json & json) noexcept
+  {
+    std::vector<Service> services;
+
+    try
+      {
+        for (const auto & [name, entry] : json.at("containers").items())
+          {
+            Service service{
+              .name = name,
+              .dir = entry.at("dir"),
+              .replicas = entry.value("replicas", size_t(1)),
+              .depends_on = entry.value("depends_on", std::vector<std::string>{}),
+              .ready_timeout = std::chrono::seconds(
+                entry.value("ready_timeout", READY_TIMEOUT.count()))};
+
+            if (0 == service.replicas)
+              return std::unexpected(
+                ERR_MSG(error::Code::Manifest, "No replica of the container " + name));
+
+            std::ranges::sort(service.depends_on);
+            const auto duplicates = std::ranges::unique(service.depends_on);
+            service.depends_on.erase(duplicates.begin(), duplicates.end());
+
+            services.push_back(std::move(service));
+          }
+
+        const size_t cpus = std::max(1U, std::thread::hardware_concurrency());
+        return sort(std::move(services)).transform([&](std::vector<Service> sorted) {
+          return Manifest{
+            .workers = std::max(size_t(1), json.value("workers", size_t(cpus))),
+            .services = std::move(sorted)};
+        });
+      }
+    catch (const nlohmann::json::exception & e)
+      {
+        return std::unexpected(ERR_MSG(error::Code::Manifest, e.what()));
+      }
+  }
+
+  std::expected<std::vector<Service>, error::Err>
+    Manifest::sort(std::vector<Service> services) noexcept
+  {
+    std::map<std::string, size_t> index;
+    for (size_t i = 0; i < services.size(); ++i)
+      index.emplace(services[i].name, i);
+
+    std::vector<size_t>              pending(services.size(), 0);
+    std::vector<std::vector<size_t>> dependents(services.size());
+    for (size_t i = 0; i < services.size(); ++i)
+      for (const auto & dependency : services[i].depends_on)
+        {
+          const auto it = index.find(dependency);
+          if (it == index.end())
+            return std::unexpected(ERR_MSG(
+              error::Code::Manifest,
+              services[i].name + " depends on the unknown container " + dependency));
+
+          dependents[it->second].push_back(i);
+          ++pending[i];
+        }
+
+    /* Kahn: a service is taken once all of its dependencies are. */
+    std::vector<size_t> order;
+    for (size_t i = 0; i < services.size(); ++i)
+      if (0 == pending[i])
+        order.push_back(i);
+
+    for (size_t next = 0; next < order.size(); ++next)
+      for (const size_t dependent : dependents[order[next]])
+        if (0 == --pending[dependent])
+          order.push_back(dependent);
+
+    if (order.size() != services.size())
+      {
+        std::string cycle;
+        for (size_t i = 0; i < services.size(); ++i)
+          if (0 != pending[i])
+            cycle += " " + services[i].name;
+
+        return std::unexpected(
+          ERR_MSG(error::Code::Manifest, "Circular dependencies between" + cycle));
+      }
+
+    std::vector<Service> sorted;
+    sorted.reserve(services.size());
+    for (const size_t i : order)
+      sorted.push_back(std::move(services[i]));
+
+    return sorted;
+  }
+
+  Launcher::Launcher(const Manifest & manifest) noexcept
+    : m_manifest(manifest)
+    , m_pending_replicas(manifest.services.size())
+    , m_pending_dependencies(manifest.services.size())
+    , m_states(manifest.services.size(), State::Waiting)
+    , m_dependents(manifest.services.size())
+  {
+    std::map<std::string, size_t> index;
+    for (size_t i = 0; i < manifest.services.size(); ++i)
+      index.emplace(manifest.services[i].name, i);
+
+    for (size_t i = 0; i < manifest.services.size(); ++i)
+      {
+        const Service & service = manifest.services[i];
+
+        /* A single replica keeps the name of its service, "container:<name>" finds it. */
+        for (size_t replica = 0; replica < service.replicas; ++replica)
+          m_replicas.push_back(Replica{
+            .name = 1 == service.replicas ? service.name
+                                        : service.name + "-" + std::to_string(replica + 1),
+            .service = i});
+
+        m_pending_replicas[i] = service.replicas;
+        m_pending_dependencies[i] = service.depends_on.size();
+        for (const auto & dependency : service.depends_on)
+          m_dependents[index.at(dependency)].push_back(i);
+      }
+
+    for (size_t i = 0; i < m_replicas.size(); ++i)
+      if (0 == m_pending_dependencies[m_replicas[i].service])
+        m_queue.push_back(i);
+
+    m_remaining = m_replicas.size();
+  }
+
+  pid_t Launcher::spawn(const std::string & dir, const std::string & name) noexcept
+  {
+    /* Built before the fork, the child of a threaded process only execs. */
+    const char * argv[] = {"bonding", "run", "name", name.c_str(), nullptr};
+
+    const pid_t pid = fork();
+    if (0 == pid)
+      {
+        if (-1 == chdir(dir.c_str()))
+          _exit(127);
+
+        execv("/proc/self/exe", const_cast<char * const *>(argv));
+        _exit(127);
+      }
+
+    return pid;
+  }
+
+  bool Launcher::wait_ready(const Service & service, Replica & replica) noexcept
+  {
+    const std::string socket = service.dir + "/" + control::Server::path_of(replica.name);
+    const auto        deadline = std::chrono::steady_clock::now() + service.ready_timeout;
+
+    for (;; std::this_thread::sleep_for(POLL_INTERVAL))
+      {
+        int status = 0;
+        if (replica.pid == waitpid(replica.pid, &status, WNOHANG))
+          {
+            LOG_ERROR << "Container " << replica.name << " " << describe(status)
+                      << " before being ready";
+            replica.pid = -1;
+            return false;
+          }
+
+        if (std::chrono::steady_clock::now() >= deadline)
+          {
+            LOG_ERROR << "Container " << replica.name << " is not ready after "
+                      << service.ready_timeout.count() << "s";
+            return false;
+          }
+
+        /* The control socket shows up once the container is created. */
+        if (-1 == access(socket.c_str(), F_OK))
+          continue;
+
+        auto client = control::Client::connect(socket);
+        if (!client.has_value())
+          continue;
+
+        const auto reply = client->request("STATUS");
+        if (reply.has_value() && std::string::npos != reply->find(" ready=1"))
+          return true;
+      }
+  }
+
+  bool Launcher::launch(Replica & replica) noexcept
+  {
+    const Service & service = m_manifest.services[replica.service];
+
+    replica.pid = spawn(service.dir, replica.name);
+    if (-1 == replica.pid)
+      {
+        LOG_ERROR << "Cannot start the container " << replica.name;
+        return false;
+      }
+
+    LOG_INFO << "Starting container " << replica.name << " in " << service.dir
+             << " on process " << replica.pid << "...";
+
+    if (!wait_ready(service, replica))
+      return false;
+
+    LOG_INFO << "Container " << replica.name << " is ready...✓";
+    return true;
+  }
+
+  void Launcher::finish(const size_t service, const bool ready) noexcept
+  {
+    m_states[service] = ready ? State::Ready : State::Failed;
+
+    for (const size_t dependent : m_dependents[service])
+      {
+        if (State::Waiting != m_states[dependent])
+          continue;
+
+        if (ready)
+          {
+            if (0 == --m_pending_dependencies[dependent])
+              for (size_t i = 0; i < m_replicas.size(); ++i)
+                if (dependent == m_replicas[i].service)
+                  m_queue.push_back(i);
+
+            continue;
+          }
+
+        /* The replicas of a service are only queued once its dependencies are ready. */
+        LOG_ERROR << "Not starting " << m_manifest.services[dependent].name << ", "
+                  << m_manifest.services[service].name << " is not ready";
+
+        m_remaining -= m_manifest.services[dependent].replicas;
+        finish(dependent, false);
+      }
+
+    m_cond.notify_all();
+  }
+
+  void Launcher::worker() noexcept
+  {
+    std::unique_lock lock(m_mutex);
+
+    while (true)
+      {
+        m_cond.wait(lock, [this]() { return !m_queue.empty() || 0 == m_remaining; });
+        if (m_queue.empty())
+          return;
+
+        const size_t index = m_queue.front();
+        m_queue.pop_front();
+        --m_remaining;
+
+        lock.unlock();
+        const bool ready = launch(m_replicas[index]);
+        lock.lock();
+
+        const size_t service = m_replicas[index].service;
+        if (State::Waiting != m_states[service])
+          continue;
+
+        if (!ready)
+          finish(service, false);
+        else if (0 == --m_pending_replicas[service])
+          finish(service, true);
+      }
+  }
+
+  std::expected<void, error::Err> Launcher::up(const Manifest & manifest) noexcept
+  {
+    Launcher launcher(manifest);
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(manifest.workers, launcher.m_replicas.size()); ++i)
+      workers.emplace_back(&Launcher::worker, &launcher);
+
+    for (auto & worker : workers)
+      worker.join();
+
+    const size_t failed = std::ranges::count(launcher.m_states, State::Failed);
+    if (0 == failed)
+      LOG_INFO << "All the " << launcher.m_replicas.size() << " containers are ready...✓";
+
+    /* The containers keep running in the foreground, SIGINT reaches them all. */
+    for (const auto & replica : launcher.m_replicas)
+      {
+        if (-1 == replica.pid)
+          continue;
+
+        int status = 0;
+        if (-1 != waitpid(replica.pid, &status, 0))
+          LOG_INFO << "Container " << replica.name << " " << describe(status);
+      }
+
+    if (0 != failed)
+      return std::unexpected(ERR_MSG(
+        error::Code::Manifest,
+        std::to_string(failed) + " of the " + std::to_string(manifest.services.size())
+          + " containers of the manifest could not be started"));
+
+    return {};
+  }
+} // namespace bonding::manifest
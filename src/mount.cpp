@@ -1,9 +1,14 @@
 /** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
 
 #include "include/mount.h"
+#include "include/exec.h"
+#include "include/id.h"
 
+#include <algorithm>
+#include <fcntl.h>
 #include <filesystem>
 #include <sys/mount.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 
@@ -22,52 +27,48 @@ namespace bonding::mounts
     return {};
   }
 
-  std::expected<void, error::Err> Mount::_delete(const std::string & path) noexcept
-  {
-    if (-1 == remove(path.c_str()))
-      {
-        LOG_ERROR << "Unable to remove " << path;
-        return std::unexpected(ERR(error::Code::Mounts));
-      }
-
-    return {};
-  }
-
-  std::expected<void, error::Err> Mount::setup(
-    const std::string &                                      mount_dir,
-    const std::string &                                      hostname,
-    const std::vector<std::pair<std::string, std::string>> & mounts_paths) noexcept
+  std::expected<void, error::Err>
+    Mount::setup(const config::Container_Options & options) noexcept
   {
     LOG_INFO << "Setting mount points...✓";
     _mount("", "/", MS_REC | MS_PRIVATE).value();
 
-    root = ".bonding/tmp/" + hostname + "/";
-    const std::string old_root_tail = "oldroot." + hostname + "/";
-    const std::string put_old = root + old_root_tail;
-
+    root = id::Id::state_dir(options.id);
     _create(root).value();
-    _mount(mount_dir, root, MS_BIND | MS_PRIVATE).value();
-    _create(put_old).value();
 
-    for (const auto & [real_path, mount_path] : mounts_paths)
+    /* The writes to the root land in memory, the mount_dir is left untouched. */
+    std::string new_root = root;
+    if (0 != options.tmpfs.scratch)
+      new_root = _mount_scratch(options.mount_dir, options.tmpfs.scratch).value();
+    else
+      _mount(options.mount_dir, root, MS_BIND | MS_PRIVATE).value();
+
+    for (const auto & [real_path, mount_path] : options.mounts)
       {
-        const std::string mount_dir = root + mount_path;
+        const std::string mount_dir = new_root + mount_path;
         _create(mount_dir).value();
-        _mount(real_path, mount_dir, MS_BIND | MS_PRIVATE).value();
+
+        const bool idmap = -1 != options.idmap_userns
+                           && options.idmapped.end()
+                                != std::ranges::find(options.idmapped, real_path);
+        if (!idmap || !_mount_idmapped(real_path, mount_dir, options.idmap_userns))
+          _mount(real_path, mount_dir, MS_BIND | MS_PRIVATE).value();
       }
 
-    if (-1 == syscall(SYS_pivot_root, root.c_str(), put_old.c_str()))
+    _mount_shm(new_root, options.tmpfs).value();
+    exec::Execve::prepare(options, new_root);
+
+    /* The old root is stacked under the new one instead of being moved into a
+     * directory of it: a read-only image has none to spare. */
+    if (-1 == chdir(new_root.c_str()) || -1 == ::syscall(SYS_pivot_root, ".", "."))
       return std::unexpected(ERR(error::Code::Mounts));
 
-    const std::string old_root = "/" + old_root_tail;
+    _umount(".").value();
 
-    /* Ensure not inside the directory we want to umount. */
+    /* Ensure not inside the directory we umounted. */
     if (-1 == chdir("/"))
       return std::unexpected(ERR(error::Code::Mounts));
 
-    _umount(old_root).value();
-    _delete(old_root).value();
-
     return {};
   }
 
@@ -103,6 +104,95 @@ namespace bonding::mounts
     return {};
   }
 
+  std::expected<std::string, error::Err>
+    Mount::_mount_scratch(const std::string & mount_dir, const size_t size) noexcept
+  {
+    const std::string upper = root + "upper";
+    const std::string work = root + "work";
+    const std::string merged = root + "merged/";
+    const std::string tmpfs = "mode=0755,size=" + std::to_string(size);
+    const std::string data =
+      "lowerdir=" + mount_dir + ",upperdir=" + upper + ",workdir=" + work;
+
+    if (-1 == mount("tmpfs", root.c_str(), "tmpfs", 0, tmpfs.c_str()))
+      return std::unexpected(
+        ERR_MSG(error::Code::Mounts, "Cannot mount the scratch tmpfs"));
+
+    for (const auto & dir : {upper, work, merged})
+      if (-1 == mkdir(dir.c_str(), 0755))
+        return std::unexpected(ERR_MSG(error::Code::Mounts, "Cannot create " + dir));
+
+    if (-1 == mount("overlay", merged.c_str(), "overlay", 0, data.c_str()))
+      return std::unexpected(
+        ERR_MSG(error::Code::Mounts, "Cannot mount an overlay of " + mount_dir));
+
+    LOG_INFO << "Mount " << mount_dir << " over a " << size << " bytes scratch...✓";
+    return merged;
+  }
+
+  std::expected<void, error::Err> Mount::_mount_shm(
+    const std::string & new_root, const config::Tmpfs_Options & tmpfs) noexcept
+  {
+    if (0 == tmpfs.shm)
+      return {};
+
+    const std::string   shm = new_root + "dev/shm";
+    const std::string   data = "mode=1777,size=" + std::to_string(tmpfs.shm);
+    const unsigned long flags = MS_NOSUID | MS_NODEV | MS_NOEXEC;
+    _create(shm).value();
+
+    /* tmpfs refuses huge= when the kernel has no transparent huge pages for shmem. */
+    if (tmpfs.huge_pages != "never")
+      {
+        const std::string huge = data + ",huge=" + tmpfs.huge_pages;
+        if (0 == mount("shm", shm.c_str(), "tmpfs", flags, huge.c_str()))
+          {
+            LOG_INFO << "Mount /dev/shm with huge pages...✓";
+            return {};
+          }
+
+        LOG_WARNING << "No huge pages for /dev/shm, mounting it with regular pages";
+      }
+
+    if (-1 == mount("shm", shm.c_str(), "tmpfs", flags, data.c_str()))
+      return std::unexpected(ERR_MSG(error::Code::Mounts, "Cannot mount /dev/shm"));
+
+    LOG_INFO << "Mount /dev/shm...✓";
+    return {};
+  }
+
+  bool Mount::_mount_idmapped(
+    const std::string & path, const std::string & mount_point, const int userns) noexcept
+  {
+    const int tree = ::syscall(
+      SYS_open_tree, AT_FDCWD, path.c_str(), OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC);
+    if (-1 == tree)
+      {
+        LOG_WARNING << "Cannot clone " << path << ", binding it without idmapping";
+        return false;
+      }
+
+    /* Only a detached mount takes an idmapping, then it is attached as a bind mount. */
+    mount_attr attr = {};
+    attr.attr_set = MOUNT_ATTR_IDMAP;
+    attr.userns_fd = userns;
+
+    const char * target = mount_point.c_str();
+    const bool   mounted =
+      0 == ::syscall(SYS_mount_setattr, tree, "", AT_EMPTY_PATH, &attr, sizeof(attr))
+      && 0 == ::syscall(SYS_move_mount, tree, "", AT_FDCWD, target, MOVE_MOUNT_F_EMPTY_PATH);
+    close(tree);
+
+    if (!mounted)
+      {
+        LOG_WARNING << "Cannot idmap " << path << ", binding it without idmapping";
+        return false;
+      }
+
+    LOG_INFO << "Mount " << path << " to " << mount_point << " with idmapping...✓";
+    return true;
+  }
+
   std::expected<void, error::Err> Mount::_create(const std::string & path) noexcept
   {
     try
@@ -1,10 +1,16 @@
 /** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
 
 #include "include/namespace.h"
+#include "include/control.h"
+#include "include/environment.h"
 #include "include/ipc.h"
+#include <algorithm>
+#include <cerrno>
 #include <fcntl.h>
 #include <grp.h>
 #include <sched.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 namespace bonding::ns
@@ -53,32 +59,227 @@ namespace bonding::ns
     return {};
   }
 
+  void Namespace::create_map(
+    unix::Batch & batch, const unix::Fd & proc, const std::string & map) noexcept
+  {
+    batch.write(
+      proc, map, "0 " + std::to_string(USERNS_OFFSET) + " " + std::to_string(USERNS_COUNT));
+  }
+
+  std::expected<void, error::Err> Namespace::handle_child_uid_map(const pid_t pid) noexcept
+  {
+    /* Both maps are written relative to the /proc directory of the child, resolved once. */
+    const unix::Fd proc =
+      unix::Filesystem::Open_directory("/proc/" + std::to_string(pid))
+        .transform_error([&](const auto & e) {
+      return ERR_MSG(error::Code::Namespace, "Cannot open /proc/" + std::to_string(pid));
+    }).value();
+
+    unix::Batch batch;
+    create_map(batch, proc, "uid_map");
+    create_map(batch, proc, "gid_map");
+
+    batch.submit()
+      .transform_error([&](const auto & e) {
+      return ERR_MSG(error::Code::Namespace, "Cannot write the uid and gid maps");
+    }).value();
+
+    return {};
+  }
+
   std::expected<void, error::Err>
-    Namespace::create_map(const int id, const std::string map) noexcept
+    Namespace::prepare_idmap(config::Container_Options & options) noexcept
   {
-    const std::string path = "/proc/" + std::to_string(id) + "/" + map;
-    const std::string data =
-      "0 " + std::to_string(USERNS_OFFSET) + " " + std::to_string(USERNS_COUNT);
+    if (options.idmapped.empty())
+      return {};
 
-    const int fd =
-      creat(path.c_str(), S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+    if (!environment::Features::get().idmapped_mounts)
+      {
+        LOG_WARNING << "No idmapped mounts on this kernel, the mounts are bound as they are";
+        return {};
+      }
+
+    int ready[2], done[2];
+    if (-1 == pipe2(ready, O_CLOEXEC))
+      return std::unexpected(ERR(error::Code::Namespace));
 
-    if (-1 == fd)
+    const unix::Fd ready_read(ready[0]);
+    unix::Fd       ready_write(ready[1]);
+    if (-1 == pipe2(done, O_CLOEXEC))
       return std::unexpected(ERR(error::Code::Namespace));
 
-    if (-1 == write(fd, data.c_str(), data.size()))
+    const unix::Fd done_read(done[0]);
+    unix::Fd       done_write(done[1]);
+
+    const pid_t helper = fork();
+    if (-1 == helper)
       return std::unexpected(ERR(error::Code::Namespace));
 
+    if (0 == helper)
+      {
+        /* Holds the namespace until the supervisor closes its end of the pipe. */
+        close(done[1]);
+        char unshared = 0 == unshare(CLONE_NEWUSER) ? 1 : 0;
+        if (1 == write(ready[1], &unshared, 1))
+          while (-1 == read(done[0], &unshared, 1) && EINTR == errno)
+            ;
+        _exit(0);
+      }
+
+    /* Only the helper writes: its death reads as EOF instead of blocking forever. */
+    ready_write.reset();
+
+    char unshared = 0;
+    if (1 == read(ready_read.get(), &unshared, 1) && 1 == unshared
+        && handle_child_uid_map(helper).has_value())
+      options.idmap_userns =
+        open(("/proc/" + std::to_string(helper) + "/ns/user").c_str(), O_RDONLY | O_CLOEXEC);
+
+    done_write.reset();
+    while (-1 == waitpid(helper, nullptr, 0) && EINTR == errno)
+      ;
+
+    if (-1 == options.idmap_userns)
+      return std::unexpected(
+        ERR_MSG(error::Code::Namespace, "Cannot create the user namespace of the idmapping"));
+
+    LOG_DEBUG << "Creating the user namespace of the idmapped mounts...✓";
     return {};
   }
 
-  std::expected<void, error::Err> Namespace::handle_child_uid_map(const pid_t pid) noexcept
+  std::expected<void, error::Err>
+    Namespace::prepare_joins(config::Container_Options & options) noexcept
   {
+    prepare_idmap(options).value();
+
+    std::map<pid_t, int> containers;
+
+    for (const auto & join : options.namespaces)
+      {
+        options.clone_flags &= ~join.flag;
+
+        if (join.target.starts_with("container:"))
+          {
+            const std::string name = join.target.substr(10);
+            const pid_t       pid = control::Client::connect(control::Server::path_of(name))
+                                .and_then([](control::Client client) { return client.status(); })
+                                .transform_error([&](const error::Err & e) {
+              return ERR_MSG(error::Code::Namespace, "No running container " + name);
+            }).value().pid;
+
+            containers[pid] |= join.flag;
+            continue;
+          }
 
-    create_map(pid, "uid_map").value();
-    create_map(pid, "gid_map").value();
+        const int fd = open(join.target.c_str(), O_RDONLY | O_CLOEXEC);
+        if (-1 == fd)
+          return std::unexpected(
+            ERR_MSG(error::Code::Namespace, "Cannot open namespace " + join.target));
+
+        options.joined_namespaces.push_back(config::Joined_Namespace{join.flag, fd, 0});
+      }
+
+    /* A single pidfd enters every namespace shared with a container at once, -1 lets
+     * the child process fall back to the namespace files. */
+    const bool pidfd = environment::Features::get().pidfd;
+    for (const auto & [pid, flags] : containers)
+      options.joined_namespaces.push_back(config::Joined_Namespace{
+        flags, pidfd ? static_cast<int>(::syscall(SYS_pidfd_open, pid, 0)) : -1, pid});
+
+    if (!options.joined_namespaces.empty())
+      LOG_DEBUG << "Opening " << options.joined_namespaces.size()
+                << " namespaces to join...✓";
 
     return {};
   }
 
+  bool Namespace::joins_pid(const config::Container_Options & options) noexcept
+  {
+    return std::ranges::any_of(options.joined_namespaces, [](const auto & ns) {
+      return 0 != (ns.flags & CLONE_NEWPID);
+    });
+  }
+
+  std::expected<void, error::Err>
+    Namespace::enter_pid(const config::Container_Options & options) noexcept
+  {
+    for (const auto & ns : options.joined_namespaces)
+      {
+        if (0 == (ns.flags & CLONE_NEWPID))
+          continue;
+
+        if (-1 != ns.fd && 0 == setns(ns.fd, CLONE_NEWPID))
+          continue;
+
+        if (0 == ns.pid)
+          return std::unexpected(
+            ERR_MSG(error::Code::Namespace, "Cannot join pid namespace"));
+
+        join_one_by_one(ns.pid, CLONE_NEWPID).value();
+      }
+
+    return {};
+  }
+
+  std::expected<void, error::Err>
+    Namespace::join(const config::Container_Options & options) noexcept
+  {
+    for (const auto & ns : options.joined_namespaces)
+      {
+        /* Already entered by the process which cloned the child process. */
+        const int flags = ns.flags & ~CLONE_NEWPID;
+        if (0 == flags)
+          continue;
+
+        if (-1 != ns.fd && 0 == setns(ns.fd, flags))
+          continue;
+
+        if (0 == ns.pid)
+          return std::unexpected(ERR_MSG(error::Code::Namespace, "Cannot join namespace"));
+
+        /* EINVAL: the kernel does not take a pidfd */
+        join_one_by_one(ns.pid, flags).value();
+      }
+
+    for (const auto & join : options.namespaces)
+      LOG_INFO << "Joining " << join.kind << " namespace of " << join.target << "...✓";
+
+    return {};
+  }
+
+  std::expected<void, error::Err>
+    Namespace::close_joins(const config::Container_Options & options) noexcept
+  {
+    for (const auto & ns : options.joined_namespaces)
+      if (-1 != ns.fd)
+        close(ns.fd);
+
+    if (-1 != options.idmap_userns)
+      close(options.idmap_userns);
+
+    return {};
+  }
+
+  std::expected<void, error::Err>
+    Namespace::join_one_by_one(const pid_t pid, const int flags) noexcept
+  {
+    for (const auto & [kind, flag] : KINDS)
+      {
+        if (0 == (flags & flag))
+          continue;
+
+        const std::string path = "/proc/" + std::to_string(pid) + "/ns/" + kind;
+        const int         fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (-1 == fd)
+          return std::unexpected(ERR_MSG(error::Code::Namespace, "Cannot open " + path));
+
+        const int result = setns(fd, flag);
+        close(fd);
+
+        if (-1 == result)
+          return std::unexpected(ERR_MSG(error::Code::Namespace, "Cannot join " + path));
+      }
+
+    return {};
+  }
 } // namespace bonding::ns
@@ -0,0 +1,910 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/oci.h"
+#include "include/id.h"
+#include "logging.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/utsname.h>
+#include <sys/xattr.h>
+#include <thread>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace bonding::oci
+{
+  namespace
+  {
+    /** SHA-256 of the raw bytes of a blob, checked against the digest of its descriptor */
+    class Sha256
+    {
+    public:
+      void update(const void * data, size_t size) noexcept
+      {
+        const auto * bytes = static_cast<const uint8_t *>(data);
+        m_length += size;
+
+        while (0 < size)
+          {
+            const size_t n = std::min(size, sizeof(m_block) - m_used);
+            memcpy(m_block + m_used, bytes, n);
+            m_used += n;
+            bytes += n;
+            size -= n;
+
+            if (sizeof(m_block) == m_used)
+              {
+                compress(m_block);
+                m_used = 0;
+              }
+          }
+      }
+
+      /** The lowercase hex of the hash, the state is spent. */
+      std::string hex() noexcept
+      {
+        const uint64_t bits = m_length * 8;
+        const uint8_t  one = 0x80, zero = 0;
+
+        update(&one, 1);
+        while (56 != m_used)
+          update(&zero, 1);
+        for (int i = 7; i >= 0; --i)
+          {
+            const uint8_t byte = bits >> (i * 8);
+            update(&byte, 1);
+          }
+
+        char hex[65] = {0};
+        for (size_t i = 0; i < 8; ++i)
+          snprintf(hex + i * 8, 9, "%08x", m_state[i]);
+        return hex;
+      }
+
+    private:
+      static uint32_t rotate(const uint32_t x, const int n) noexcept
+      {
+        return (x >> n) | (x << (32 - n));
+      }
+
+      void compress(const uint8_t * block) noexcept
+      {
+        static constexpr uint32_t K[64] = {
+          0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+          0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+          0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+          0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+          0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+          0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+          0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+          0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+          0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+          0xc67178f2};
+
+        uint32_t w[64];
+        for (size_t i = 0; i < 16; ++i)
+          w[i] = static_cast<uint32_t>(block[i * 4]) << 24 | block[i * 4 + 1] << 16
+                 | block[i * 4 + 2] << 8 | block[i * 4 + 3];
+        for (size_t i = 16; i < 64; ++i)
+          w[i] = w[i - 16] + (rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3))
+                 + w[i - 7] + (rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+        uint32_t v[8];
+        std::copy(m_state, m_state + 8, v);
+        for (size_t i = 0; i < 64; ++i)
+          {
+            const uint32_t t1 = v[7] + (rotate(v[4], 6) ^ rotate(v[4], 11) ^ rotate(v[4], 25))
+                                + ((v[4] & v[5]) ^ (~v[4] & v[6])) + K[i] + w[i];
+            const uint32_t t2 = (rotate(v[0], 2) ^ rotate(v[0], 13) ^ rotate(v[0], 22))
+                                + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+            std::copy_backward(v, v + 7, v + 8);
+            v[4] += t1;
+            v[0] = t1 + t2;
+          }
+
+        for (size_t i = 0; i < 8; ++i)
+          m_state[i] += v[i];
+      }
+
+    private:
+      uint32_t m_state[8] = {0x6a09e667,
+                             0xbb67ae85,
+                             0x3c6ef372,
+                             0xa54ff53a,
+                             0x510e527f,
+                             0x9b05688c,
+                             0x1f83d9ab,
+                             0x5be0cd19};
+      uint8_t  m_block[64] = {};
+      size_t   m_used = 0;
+      uint64_t m_length = 0;
+    };
+
+    /** The bytes of a layer blob, gzip-compressed or not: it is inflated as it is read,
+     ** and never held in memory as a whole. */
+    class Stream
+    {
+    public:
+      explicit Stream(const int fd) noexcept : m_fd(fd) {}
+
+      ~Stream()
+      {
+        if (m_gzip)
+          inflateEnd(&m_zstream);
+      }
+
+      Stream(const Stream &) = delete;
+
+      /** Sniff the compression of the blob, false if it is not supported. */
+      bool open() noexcept
+      {
+        if (!fill())
+          return true;
+
+        const auto * magic = reinterpret_cast<const unsigned char *>(m_in);
+        if (m_in_size >= 4 && 0x28 == magic[0] && 0xb5 == magic[1] && 0x2f == magic[2]
+            && 0xfd == magic[3])
+          return false;
+
+        /* The gzip header is parsed by zlib itself. */
+        if (m_in_size >= 2 && 0x1f == magic[0] && 0x8b == magic[1])
+          {
+            m_zstream.next_in = reinterpret_cast<Bytef *>(m_in);
+            m_zstream.avail_in = m_in_size;
+            m_gzip = Z_OK == inflateInit2(&m_zstream, 16 + MAX_WBITS);
+            return m_gzip;
+          }
+
+        return true;
+      }
+
+      /** Read exactly `size` bytes, false on a truncated or corrupted blob. */
+      bool read(char * out, size_t size) noexcept
+      {
+        while (0 < size)
+          {
+            const size_t n = m_gzip ? inflate_some(out, size) : copy_some(out, size);
+            if (0 == n)
+              return false;
+
+            out += n;
+            size -= n;
+          }
+
+        return true;
+      }
+
+      bool skip(size_t size) noexcept
+      {
+        char buffer[BUFFER_SIZE];
+        for (size_t n = 0; 0 < size; size -= n)
+          {
+            n = std::min(size, sizeof(buffer));
+            if (!read(buffer, n))
+              return false;
+          }
+
+        return true;
+      }
+
+      /** The digest of the whole blob, "sha256:<hex>", once the rest of it (the padding
+       ** after the end of the archive) is read. Empty on a read error. */
+      std::string digest() noexcept
+      {
+        while (fill())
+          ;
+
+        return m_failed ? std::string() : "sha256:" + m_sha256.hex();
+      }
+
+    private:
+      /** Every byte of the blob goes through here, and through the hash. */
+      bool fill() noexcept
+      {
+        ssize_t n = 0;
+        while (-1 == (n = ::read(m_fd, m_in, sizeof(m_in))) && EINTR == errno)
+          ;
+
+        m_failed = m_failed || -1 == n;
+        m_in_offset = 0;
+        m_in_size = std::max<ssize_t>(n, 0);
+        m_sha256.update(m_in, m_in_size);
+        return 0 < n;
+      }
+
+      size_t copy_some(char * out, const size_t size) noexcept
+      {
+        if (m_in_offset == m_in_size && !fill())
+          return 0;
+
+        const size_t n = std::min(size, m_in_size - m_in_offset);
+        memcpy(out, m_in + m_in_offset, n);
+        m_in_offset += n;
+        return n;
+      }
+
+      size_t inflate_some(char * out, const size_t size) noexcept
+      {
+        m_zstream.next_out = reinterpret_cast<Bytef *>(out);
+        m_zstream.avail_out = size;
+
+        while (size == m_zstream.avail_out)
+          {
+            if (0 == m_zstream.avail_in)
+              {
+                if (!fill())
+                  return 0;
+
+                m_zstream.next_in = reinterpret_cast<Bytef *>(m_in);
+                m_zstream.avail_in = m_in_size;
+              }
+
+            const int status = inflate(&m_zstream, Z_NO_FLUSH);
+
+            /* A blob may be made of several gzip members. */
+            if (Z_STREAM_END == status)
+              inflateReset(&m_zstream);
+            else if (Z_OK != status && Z_BUF_ERROR != status)
+              return 0;
+          }
+
+        return size - m_zstream.avail_out;
+      }
+
+    private:
+      static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+      int      m_fd;
+      bool     m_gzip = false;
+      z_stream m_zstream = {};
+      char     m_in[BUFFER_SIZE];
+      size_t   m_in_offset = 0;
+      size_t   m_in_size = 0;
+      Sha256   m_sha256;
+      bool     m_failed = false;
+    };
+
+    /** A tar entry, after the pax and GNU extensions of its name, link and size */
+    struct Entry
+    {
+      std::string path;
+      std::string link;
+      char        type;
+      mode_t      mode;
+      uid_t       uid;
+      gid_t       gid;
+      uint64_t    size;
+      time_t      mtime;
+      dev_t       device;
+    };
+
+    /** An octal field, or a base-256 one for the values which do not fit */
+    uint64_t number_of(const char * field, const size_t size) noexcept
+    {
+      if (0 != (field[0] & 0x80))
+        {
+          uint64_t value = field[0] & 0x7f;
+          for (size_t i = 1; i < size; ++i)
+            value = (value << 8) | static_cast<unsigned char>(field[i]);
+          return value;
+        }
+
+      uint64_t value = 0;
+      for (size_t i = 0; i < size && '\0' != field[i]; ++i)
+        if ('0' <= field[i] && field[i] <= '7')
+          value = value * 8 + (field[i] - '0');
+      return value;
+    }
+
+    std::string string_of(const char * field, const size_t size) noexcept
+    {
+      return std::string(field, strnlen(field, size));
+    }
+
+    /** Apply the records of a pax extended header ("<length> <key>=<value>\n"). */
+    void apply_pax(const std::string & records, Entry & entry) noexcept
+    {
+      for (size_t offset = 0; offset < records.size();)
+        {
+          const size_t length = strtoull(records.c_str() + offset, nullptr, 10);
+          const size_t space = records.find(' ', offset);
+          if (0 == length || std::string::npos == space || offset + length > records.size())
+            return;
+
+          const std::string record = records.substr(space + 1, offset + length - space - 2);
+          const size_t      equal = record.find('=');
+          const std::string key = record.substr(0, equal);
+          const std::string value = std::string::npos == equal ? "" : record.substr(equal + 1);
+
+          if ("path" == key)
+            entry.path = value;
+          else if ("linkpath" == key)
+            entry.link = value;
+          else if ("size" == key)
+            entry.size = strtoull(value.c_str(), nullptr, 10);
+          else if ("uid" == key)
+            entry.uid = strtoul(value.c_str(), nullptr, 10);
+          else if ("gid" == key)
+            entry.gid = strtoul(value.c_str(), nullptr, 10);
+          else if ("mtime" == key)
+            entry.mtime = strtoll(value.c_str(), nullptr, 10);
+
+          offset += length;
+        }
+    }
+
+    /** The components of an entry path, nothing when it climbs out of the layer */
+    std::optional<std::vector<std::string>> components_of(const std::string & path) noexcept
+    {
+      std::vector<std::string> components;
+      for (size_t begin = 0; begin <= path.size();)
+        {
+          size_t end = path.find('/', begin);
+          if (std::string::npos == end)
+            end = path.size();
+
+          const std::string component = path.substr(begin, end - begin);
+          if (".." == component)
+            return std::nullopt;
+
+          if (!component.empty() && "." != component)
+            components.push_back(component);
+
+          begin = end + 1;
+        }
+
+      return components;
+    }
+
+    /** Unpacks the entries of a layer under its root, never through a symbolic link:
+     ** every directory is opened one component at a time, without following any. */
+    class Unpacker
+    {
+    public:
+      explicit Unpacker(unix::Fd root) noexcept : m_root(std::move(root)) {}
+
+      /** The directory of the entry, created when missing */
+      int parent_of(const std::vector<std::string> & components) noexcept
+      {
+        const std::vector<std::string> parent(components.begin(), components.end() - 1);
+
+        /* The entries of a directory mostly follow each other. */
+        if (m_parent && parent == m_parent_components)
+          return m_parent.get();
+
+        m_parent.reset();
+        unix::Fd dir(dup(m_root.get()));
+        for (const auto & component : parent)
+          {
+            const int flags = O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+            int       next = openat(dir.get(), component.c_str(), flags);
+            if (-1 == next && ENOENT == errno
+                && (0 == mkdirat(dir.get(), component.c_str(), 0755) || EEXIST == errno))
+              next = openat(dir.get(), component.c_str(), flags);
+
+            if (-1 == next)
+              return -1;
+
+            dir.reset(next);
+          }
+
+        m_parent = std::move(dir);
+        m_parent_components = parent;
+        return m_parent.get();
+      }
+
+      bool unpack(Stream & stream, const Entry & entry) noexcept
+      {
+        const auto components = components_of(entry.path);
+        if (!components.has_value())
+          return false;
+
+        /* The root of the layer itself */
+        if (components->empty())
+          return stream.skip(padded(entry.size));
+
+        const int parent = parent_of(*components);
+        if (-1 == parent)
+          return false;
+
+        const std::string & name = components->back();
+
+        /* An opaque directory hides the content of the lower layers. */
+        if (".wh..wh..opq" == name)
+          {
+            const unix::Fd dir(openat(parent, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+            return dir && 0 == fsetxattr(dir.get(), "trusted.overlay.opaque", "y", 1, 0)
+                   && stream.skip(padded(entry.size));
+          }
+
+        /* A whiteout hides the file of the lower layers: a 0/0 device for overlayfs. */
+        if (name.starts_with(".wh."))
+          {
+            const std::string hidden = name.substr(4);
+            unlinkat(parent, hidden.c_str(), 0);
+            return 0 == mknodat(parent, hidden.c_str(), S_IFCHR, makedev(0, 0))
+                   && stream.skip(padded(entry.size));
+          }
+
+        /* A later entry replaces an earlier one, except for directories. */
+        if ('5' != entry.type && -1 == unlinkat(parent, name.c_str(), 0) && EISDIR == errno)
+          unlinkat(parent, name.c_str(), AT_REMOVEDIR);
+
+        switch (entry.type)
+          {
+          case '0':
+          case '\0':
+          case '7':
+            return file(stream, parent, name, entry);
+          case '1':
+            return link(parent, name, entry) && stream.skip(padded(entry.size));
+          case '2':
+            if (-1 == symlinkat(entry.link.c_str(), parent, name.c_str()))
+              return false;
+            break;
+          case '3':
+          case '4':
+            /* A layer does not bring devices of the host into the container, the 0/0
+             * whiteouts of overlayfs excepted. */
+            if (0 != entry.device)
+              {
+                LOG_WARNING << "Skipping the device node " << entry.path << " of a layer";
+                return stream.skip(padded(entry.size));
+              }
+            [[fallthrough]];
+          case '6':
+            {
+              const mode_t kind = '3' == entry.type ? S_IFCHR : '4' == entry.type ? S_IFBLK
+                                                                                  : S_IFIFO;
+              if (-1 == mknodat(parent, name.c_str(), kind | entry.mode, entry.device))
+                return false;
+              break;
+            }
+          case '5':
+            if (-1 == mkdirat(parent, name.c_str(), entry.mode) && EEXIST != errno)
+              return false;
+            break;
+          default:
+            break;
+          }
+
+        fchownat(parent, name.c_str(), entry.uid, entry.gid, AT_SYMLINK_NOFOLLOW);
+        if ('2' != entry.type)
+          fchmodat(parent, name.c_str(), entry.mode, 0);
+
+        const timespec times[2] = {{entry.mtime, 0}, {entry.mtime, 0}};
+        if ('5' != entry.type)
+          utimensat(parent, name.c_str(), times, AT_SYMLINK_NOFOLLOW);
+
+        return stream.skip(padded(entry.size));
+      }
+
+      static uint64_t padded(const uint64_t size) noexcept { return (size + 511) & ~511ULL; }
+
+    private:
+      bool file(
+        Stream & stream, const int parent, const std::string & name, const Entry & entry) noexcept
+      {
+        const unix::Fd fd(openat(
+          parent, name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600));
+        if (!fd)
+          return false;
+
+        char buffer[64 * 1024];
+        for (uint64_t left = entry.size; 0 < left;)
+          {
+            const size_t n = std::min<uint64_t>(left, sizeof(buffer));
+            if (!stream.read(buffer, n) || static_cast<ssize_t>(n) != write(fd.get(), buffer, n))
+              return false;
+            left -= n;
+          }
+
+        /* chown() clears the set-user-ID bit, the mode comes last. */
+        const timespec times[2] = {{entry.mtime, 0}, {entry.mtime, 0}};
+        fchown(fd.get(), entry.uid, entry.gid);
+        fchmod(fd.get(), entry.mode);
+        futimens(fd.get(), times);
+
+        return stream.skip(padded(entry.size) - entry.size);
+      }
+
+      bool link(const int parent, const std::string & name, const Entry & entry) noexcept
+      {
+        const auto target = components_of(entry.link);
+        if (!target.has_value() || target->empty())
+          return false;
+
+        /* The target directory is opened under the root as well. */
+        const std::vector<std::string> components = *target;
+        unix::Fd                       kept(dup(parent));
+        const int                      target_parent = parent_of(components);
+
+        return -1 != target_parent
+               && 0 == linkat(target_parent, components.back().c_str(), kept.get(), name.c_str(), 0);
+      }
+
+    private:
+      unix::Fd                 m_root;
+      unix::Fd                 m_parent;
+      std::vector<std::string> m_parent_components;
+    };
+
+    /** Read the entries of the tar stream until its end, false on a malformed one. */
+    bool extract(Stream & stream, Unpacker & unpacker) noexcept
+    {
+      Entry       pending = {};
+      bool        extended = false;
+      std::string long_name, long_link;
+
+      for (char header[512];;)
+        {
+          if (!stream.read(header, sizeof(header)))
+            return false;
+
+          /* The archive ends with zero blocks. */
+          if (std::all_of(header, header + sizeof(header), [](char c) { return '\0' == c; }))
+            return true;
+
+          Entry entry = {
+            .path = string_of(header, 100),
+            .link = string_of(header + 157, 100),
+            .type = header[156],
+            .mode = static_cast<mode_t>(number_of(header + 100, 8) & 07777),
+            .uid = static_cast<uid_t>(number_of(header + 108, 8)),
+            .gid = static_cast<gid_t>(number_of(header + 116, 8)),
+            .size = number_of(header + 124, 12),
+            .mtime = static_cast<time_t>(number_of(header + 136, 12)),
+            .device = makedev(number_of(header + 329, 8), number_of(header + 337, 8))};
+
+          /* POSIX ustar only, GNU tar keeps other fields there. */
+          if (0 == memcmp(header + 257, "ustar\0", 6) && '\0' != header[345])
+            entry.path = string_of(header + 345, 155) + "/" + entry.path;
+
+          /* The extensions describe the entry which follows them. */
+          if ('x' == entry.type || 'g' == entry.type || 'L' == entry.type
+              || 'K' == entry.type)
+            {
+              std::string data(entry.size, '\0');
+              if (!stream.read(data.data(), data.size())
+                  || !stream.skip(Unpacker::padded(entry.size) - entry.size))
+                return false;
+
+              if ('x' == entry.type)
+                {
+                  pending = {};
+                  apply_pax(data, pending);
+                  extended = true;
+                }
+              else if ('L' == entry.type)
+                long_name = data.c_str();
+              else if ('K' == entry.type)
+                long_link = data.c_str();
+              continue;
+            }
+
+          if (!long_name.empty())
+            entry.path = long_name;
+          if (!long_link.empty())
+            entry.link = long_link;
+
+          if (extended)
+            {
+              if (!pending.path.empty())
+                entry.path = pending.path;
+              if (!pending.link.empty())
+                entry.link = pending.link;
+              if (0 != pending.size)
+                entry.size = pending.size;
+              if (0 != pending.uid)
+                entry.uid = pending.uid;
+              if (0 != pending.gid)
+                entry.gid = pending.gid;
+              if (0 != pending.mtime)
+                entry.mtime = pending.mtime;
+            }
+
+          if (!unpacker.unpack(stream, entry))
+            {
+              LOG_ERROR << "Cannot unpack " << entry.path;
+              return false;
+            }
+
+          long_name.clear();
+          long_link.clear();
+          extended = false;
+        }
+    }
+  } // namespace
+
+  std::expected<std::string, error::Err>
+    Importer::import(const std::string & layout, const std::string & name) noexcept
+  {
+    std::string ref;
+    const nlohmann::json manifest = manifest_of(layout, name, ref).value();
+
+    std::vector<Layer> layers;
+    try
+      {
+        for (const auto & layer : manifest.at("layers"))
+          layers.push_back(Layer{
+            layer.at("digest").get<std::string>(), layer.value("mediaType", std::string())});
+      }
+    catch (const nlohmann::json::exception & e)
+      {
+        return std::unexpected(ERR_MSG(error::Code::Image, e.what()));
+      }
+
+    for (const auto & layer : layers)
+      if (const auto checked = check_digest(layer.digest); !checked.has_value())
+        return std::unexpected(checked.error());
+
+    const std::string image = !name.empty()  ? name
+                              : !ref.empty() ? ref
+                                             : std::filesystem::path(layout).filename().string();
+    if (!id::Id::valid_name(image))
+      return std::unexpected(ERR_MSG(error::Code::Image, "Invalid image name " + image));
+
+    /* The layers already unpacked, by this image or another one, are kept. */
+    std::vector<Layer> missing;
+    for (const auto & layer : layers)
+      if (!std::filesystem::exists(LAYERS_DIR + dir_of(layer.digest))
+          && missing.end()
+               == std::find_if(missing.begin(), missing.end(), [&](const Layer & other) {
+                    return other.digest == layer.digest;
+                  }))
+        missing.push_back(layer);
+
+    std::atomic<size_t>      next = 0;
+    std::mutex               failed_mutex;
+    std::vector<std::string> failed;
+    std::vector<std::thread> workers;
+
+    const size_t cores = std::max<size_t>(1, std::thread::hardware_concurrency());
+    const size_t count = std::min({missing.size(), MAX_WORKERS, cores});
+    for (size_t i = 0; i < count; ++i)
+      workers.emplace_back([&]() {
+        for (size_t index; (index = next.fetch_add(1)) < missing.size();)
+          if (!unpack(layout, missing[index]).has_value())
+            {
+              std::lock_guard lock(failed_mutex);
+              failed.push_back(missing[index].digest);
+            }
+      });
+
+    for (auto & worker : workers)
+      worker.join();
+
+    if (!failed.empty())
+      return std::unexpected(
+        ERR_MSG(error::Code::Image, "Cannot unpack the layer " + failed.front()));
+
+    nlohmann::json record = {{"layers", nlohmann::json::array()}};
+    for (const auto & layer : layers)
+      record["layers"].push_back(dir_of(layer.digest));
+
+    std::error_code ec;
+    std::filesystem::create_directories(IMAGES_DIR, ec);
+
+    /* Written aside then renamed: a container never reads half of a record. */
+    const std::string path = IMAGES_DIR + image + ".json";
+    const std::string temporary = path + "." + std::to_string(getpid());
+    std::ofstream(temporary) << record.dump(2);
+    if (-1 == rename(temporary.c_str(), path.c_str()))
+      return std::unexpected(ERR_MSG(error::Code::Image, "Cannot write " + path));
+
+    LOG_INFO << "Importing " << layers.size() << " layers (" << missing.size()
+             << " unpacked) as the image " << image << "...✓";
+    return image;
+  }
+
+  std::expected<std::vector<std::string>, error::Err>
+    Importer::layers_of(const std::string & name) noexcept
+  {
+    const nlohmann::json record = read_json(IMAGES_DIR + name + ".json")
+                                    .transform_error([&](const auto & e) {
+      return ERR_MSG(error::Code::Mounts, "No imported image " + name);
+    }).value();
+
+    std::vector<std::string> layers;
+    for (const auto & layer : record.value("layers", nlohmann::json::array()))
+      layers.push_back(LAYERS_DIR + layer.get<std::string>());
+
+    return layers;
+  }
+
+  std::expected<nlohmann::json, error::Err> Importer::manifest_of(
+    const std::string & layout, const std::string & name, std::string & ref) noexcept
+  {
+    const nlohmann::json index = read_json(layout + "/index.json").value();
+
+    try
+      {
+        const auto & manifests = index.at("manifests");
+        if (manifests.empty())
+          return std::unexpected(
+            ERR_MSG(error::Code::Image, "No manifest in " + layout + "/index.json"));
+
+        auto chosen = manifests.begin();
+        for (auto it = manifests.begin(); it != manifests.end(); ++it)
+          if (!name.empty() && it->contains("annotations")
+              && name == (*it)["annotations"].value(REF_NAME, std::string()))
+            chosen = it;
+
+        if (chosen->contains("annotations"))
+          ref = (*chosen)["annotations"].value(REF_NAME, std::string());
+
+        nlohmann::json descriptor = *chosen;
+
+        /* A multi-platform image lists a manifest per platform. */
+        for (int depth = 0; depth < 2; ++depth)
+          {
+            const std::string type = descriptor.value("mediaType", std::string());
+            const auto        blob = blob_of(layout, descriptor.at("digest"));
+            if (!blob.has_value())
+              return std::unexpected(ERR_MSG(error::Code::Image, "Malformed digest"));
+
+            const nlohmann::json content = read_json(*blob).value();
+            if (type != INDEX_TYPE && type != DOCKER_LIST_TYPE)
+              return content;
+
+            const auto & platforms = content.at("manifests");
+            const auto   platform =
+              std::find_if(platforms.begin(), platforms.end(), [](const auto & manifest) {
+                return manifest.contains("platform")
+                       && "linux" == manifest["platform"].value("os", std::string())
+                       && architecture()
+                            == manifest["platform"].value("architecture", std::string());
+              });
+            if (platforms.end() == platform)
+              return std::unexpected(
+                ERR_MSG(error::Code::Image, "No manifest for linux/" + architecture()));
+
+            descriptor = *platform;
+          }
+      }
+    catch (const nlohmann::json::exception & e)
+      {
+        return std::unexpected(ERR_MSG(error::Code::Image, e.what()));
+      }
+
+    return std::unexpected(ERR_MSG(error::Code::Image, "Nested image indexes"));
+  }
+
+  std::expected<nlohmann::json, error::Err>
+    Importer::read_json(const std::string & path) noexcept
+  {
+    try
+      {
+        return nlohmann::json::parse(unix::Filesystem::read_entire_file(path).value());
+      }
+    catch (const std::exception & e)
+      {
+        return std::unexpected(ERR_MSG(error::Code::Image, "Cannot read " + path));
+      }
+  }
+
+  std::optional<std::string>
+    Importer::blob_of(const std::string & layout, const std::string & digest) noexcept
+  {
+    const size_t colon = digest.find(':');
+    if (std::string::npos == colon || 0 == colon || colon + 1 == digest.size())
+      return std::nullopt;
+
+    /* The digest names a file of the layout, nothing else. */
+    const auto safe = [](const char c) {
+      return isalnum(static_cast<unsigned char>(c)) || '_' == c || '-' == c;
+    };
+    if (!std::all_of(digest.begin(), digest.end(), [&](char c) { return ':' == c || safe(c); })
+        || std::string::npos != digest.find(':', colon + 1))
+      return std::nullopt;
+
+    return layout + "/blobs/" + dir_of(digest);
+  }
+
+  std::string Importer::dir_of(const std::string & digest) noexcept
+  {
+    std::string dir = digest;
+    std::replace(dir.begin(), dir.end(), ':', '/');
+    return dir;
+  }
+
+  std::expected<void, error::Err>
+    Importer::check_digest(const std::string & digest) noexcept
+  {
+    if (!blob_of("", digest).has_value())
+      return std::unexpected(ERR_MSG(error::Code::Image, "Malformed digest " + digest));
+
+    const std::string algorithm = digest.substr(0, digest.find(':'));
+    if (SHA256 != algorithm)
+      return std::unexpected(ERR_MSG(
+        error::Code::Image,
+        "Unsupported digest algorithm " + algorithm + " of the layer " + digest
+          + ", only " + SHA256 + " is verified"));
+
+    const std::string hex = digest.substr(algorithm.size() + 1);
+    if (64 != hex.size() || !std::all_of(hex.begin(), hex.end(), [](const char c) {
+          return ('0' <= c && c <= '9') || ('a' <= c && c <= 'f');
+        }))
+      return std::unexpected(ERR_MSG(error::Code::Image, "Malformed digest " + digest));
+
+    return {};
+  }
+
+  std::expected<void, error::Err>
+    Importer::unpack(const std::string & layout, const Layer & layer) noexcept
+  {
+    const auto blob = blob_of(layout, layer.digest);
+    if (!blob.has_value())
+      return std::unexpected(ERR_MSG(error::Code::Image, "Malformed digest " + layer.digest));
+
+    const std::string target = LAYERS_DIR + dir_of(layer.digest);
+    const std::string temporary = LAYERS_DIR + "tmp/"
+                                  + std::filesystem::path(target).filename().string() + "."
+                                  + std::to_string(getpid());
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(target).parent_path(), ec);
+    std::filesystem::remove_all(temporary, ec);
+    std::filesystem::create_directories(temporary, ec);
+
+    const unix::Fd input(open(blob->c_str(), O_RDONLY | O_CLOEXEC));
+    unix::Fd       root(open(temporary.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (!input || !root)
+      return std::unexpected(ERR_MSG(error::Code::Image, "Cannot open " + *blob));
+
+    posix_fadvise(input.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    /* zstd layers are not supported yet, gzip and plain tar are. */
+    Stream   stream(input.get());
+    Unpacker unpacker(std::move(root));
+    if (!stream.open() || !extract(stream, unpacker))
+      {
+        std::filesystem::remove_all(temporary, ec);
+        return std::unexpected(
+          ERR_MSG(error::Code::Image, "Cannot unpack the layer " + layer.digest));
+      }
+
+    /* A blob which is not the one its descriptor names never reaches the layers. */
+    if (stream.digest() != layer.digest)
+      {
+        std::filesystem::remove_all(temporary, ec);
+        return std::unexpected(
+          ERR_MSG(error::Code::Image, "The blob of the layer " + layer.digest
+                                        + " does not match its digest"));
+      }
+
+    /* Another import may have unpacked the same layer meanwhile. */
+    if (-1 == rename(temporary.c_str(), target.c_str()))
+      std::filesystem::remove_all(temporary, ec);
+
+    LOG_DEBUG << "Unpacking the layer " << layer.digest << "...✓";
+    return {};
+  }
+
+  std::string Importer::architecture() noexcept
+  {
+    utsname name = {};
+    uname(&name);
+
+    const std::string machine = name.machine;
+    if ("x86_64" == machine)
+      return "amd64";
+    if ("aarch64" == machine)
+      return "arm64";
+    if ("i686" == machine || "i386" == machine)
+      return "386";
+
+    return machine;
+  }
+} // namespace bonding::oci
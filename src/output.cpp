@@ -0,0 +1,314 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/output.h"
+#include "include/unix.h"
+#include "logging.h"
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace bonding::output
+{
+  std::expected<void, error::Err>
+    Output::prepare(config::Container_Options & options) noexcept
+  {
+    if (options.output.mode == "inherit")
+      return {};
+
+    int out[2] = {-1, -1};
+    int err[2] = {-1, -1};
+    if (-1 == pipe2(out, O_CLOEXEC) || -1 == pipe2(err, O_CLOEXEC))
+      return std::unexpected(
+        ERR_MSG(error::Code::Container, "Cannot create the output pipes"));
+
+    /* Best effort, bounded by /proc/sys/fs/pipe-max-size. */
+    fcntl(out[0], F_SETPIPE_SZ, PIPE_SIZE);
+    fcntl(err[0], F_SETPIPE_SZ, PIPE_SIZE);
+
+    options.stdout_pipe = std::make_pair(out[0], out[1]);
+    options.stderr_pipe = std::make_pair(err[0], err[1]);
+    return {};
+  }
+
+  std::expected<void, error::Err>
+    Output::install(const config::Container_Options & options) noexcept
+  {
+    if (-1 == options.stdout_pipe.second)
+      return {};
+
+    LOG_DEBUG << "Redirecting the output to the supervisor...✓";
+
+    /* The duplicated descriptors do not inherit FD_CLOEXEC. */
+    if (-1 == dup2(options.stdout_pipe.second, STDOUT_FILENO)
+        || -1 == dup2(options.stderr_pipe.second, STDERR_FILENO))
+      return std::unexpected(ERR(error::Code::Exec));
+
+    return {};
+  }
+
+  std::expected<void, error::Err> Capture::open_file(Stream & stream) noexcept
+  {
+    /* Not O_APPEND: splice() refuses to write to an append-only file, the
+     * position is kept at the end by ourselves. */
+    stream.fd = open(stream.path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (-1 == stream.fd)
+      return std::unexpected(ERR_MSG(error::Code::Container, "Cannot open " + stream.path));
+
+    const off_t end = lseek(stream.fd, 0, SEEK_END);
+    stream.written = -1 == end ? 0 : end;
+
+    return {};
+  }
+
+  std::expected<void, error::Err> Capture::open_socket(Stream & stream) noexcept
+  {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (m_prefix.size() >= sizeof(addr.sun_path))
+      return std::unexpected(
+        ERR_MSG(error::Code::Socket, "Output socket path too long: " + m_prefix));
+
+    memcpy(addr.sun_path, m_prefix.c_str(), m_prefix.size());
+
+    stream.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == stream.fd)
+      return std::unexpected(ERR(error::Code::Socket));
+
+    if (-1 == connect(stream.fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)))
+      return std::unexpected(
+        ERR_MSG(error::Code::Socket, "Cannot connect to the output socket " + m_prefix));
+
+    /* A connection per stream, which names itself on its first line: the bytes are
+     * still spliced as they come, and the two streams are never mixed. */
+    const std::string header = std::string(stream.name) + "\n";
+    if (static_cast<ssize_t>(header.size()) != write(stream.fd, header.data(), header.size()))
+      return std::unexpected(
+        ERR_MSG(error::Code::Socket, "Cannot write to the output socket " + m_prefix));
+
+    if (m_options.drop)
+      fcntl(stream.fd, F_SETFL, fcntl(stream.fd, F_GETFL) | O_NONBLOCK);
+
+    return {};
+  }
+
+  void Capture::rotate(Stream & stream) noexcept
+  {
+    for (size_t i = m_options.files; i > 1; --i)
+      rename(
+        (stream.path + "." + std::to_string(i - 1)).c_str(),
+        (stream.path + "." + std::to_string(i)).c_str());
+
+    if (0 == m_options.files)
+      unlink(stream.path.c_str());
+    else
+      rename(stream.path.c_str(), (stream.path + ".1").c_str());
+
+    close(stream.fd);
+    if (!open_file(stream).has_value())
+      {
+        stream.fd = -1;
+        LOG_WARNING << "The " << stream.name << " of the workload is now discarded";
+      }
+  }
+
+  std::expected<void, error::Err>
+    Capture::start(const config::Container_Options & options) noexcept
+  {
+    if (m_options.mode == "inherit")
+      return {};
+
+    /* Only the workload keeps the write ends, so that its exit is seen as EOF. */
+    close(options.stdout_pipe.second);
+    close(options.stderr_pipe.second);
+    m_streams[0].pipe = options.stdout_pipe.first;
+    m_streams[1].pipe = options.stderr_pipe.first;
+
+    /* An empty pipe must not block the copy fallback. */
+    for (const auto & stream : m_streams)
+      fcntl(stream.pipe, F_SETFL, fcntl(stream.pipe, F_GETFL) | O_NONBLOCK);
+
+    m_null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (-1 == m_null || -1 == pipe2(m_wakeup, O_CLOEXEC))
+      return std::unexpected(ERR(error::Code::Container));
+
+    if (m_options.mode == "socket")
+      {
+        for (auto & stream : m_streams)
+          open_socket(stream).value();
+      }
+    else
+      {
+        unix::Filesystem::Mkdir(m_prefix.substr(0, m_prefix.find_last_of('/') + 1)).value();
+        for (auto & stream : m_streams)
+          {
+            stream.path = m_prefix + "." + stream.name;
+            open_file(stream).value();
+          }
+      }
+
+    m_thread = std::thread(&Capture::loop, this);
+
+    LOG_INFO << "Capturing the output of the workload to " << m_prefix << "...✓";
+    return {};
+  }
+
+  ssize_t Capture::copy(Stream & stream) noexcept
+  {
+    char          buffer[64 * 1024];
+    const ssize_t size = read(stream.pipe, buffer, sizeof(buffer));
+    if (size <= 0)
+      return size;
+
+    for (ssize_t offset = 0; offset < size;)
+      {
+        const ssize_t written = write(stream.fd, buffer + offset, size - offset);
+        if (written <= 0)
+          {
+            stream.dropped += size - offset;
+            break;
+          }
+
+        offset += written;
+      }
+
+    return size;
+  }
+
+  bool Capture::forward(Stream & stream) noexcept
+  {
+    while (true)
+      {
+        if (m_options.mode == "file" && -1 != stream.fd
+            && stream.written >= m_options.max_size)
+          rotate(stream);
+
+        /* Without a destination, a rotation failed to reopen it, everything is discarded. */
+        if (-1 != stream.fd)
+          {
+            ssize_t moved = splice(
+              stream.pipe,
+              nullptr,
+              stream.fd,
+              nullptr,
+              CHUNK,
+              SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+            if (-1 == moved && EINVAL == errno)
+              moved = copy(stream);
+
+            if (0 == moved)
+              return false;
+
+            if (moved > 0)
+              {
+                stream.written += moved;
+                continue;
+              }
+
+            if (EINTR == errno)
+              continue;
+
+            int pending = 0;
+            if (EAGAIN == errno)
+              {
+                /* Either the pipe is empty, or the non-blocking socket is full. */
+                if (-1 == ioctl(stream.pipe, FIONREAD, &pending) || 0 == pending
+                    || !m_options.drop)
+                  return true;
+              }
+          }
+
+        /* The destination cannot take it: discard it, without copying it either. */
+        const ssize_t discarded =
+          splice(stream.pipe, nullptr, m_null, nullptr, CHUNK, SPLICE_F_NONBLOCK);
+        if (0 == discarded)
+          return false;
+
+        if (discarded < 0)
+          return true;
+
+        stream.dropped += discarded;
+      }
+  }
+
+  void Capture::loop() noexcept
+  {
+    /* A closed output socket must not kill the supervisor, the EPIPE is enough. */
+    sigset_t pipe;
+    sigemptyset(&pipe);
+    sigaddset(&pipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe, nullptr);
+
+    bool stopping = false;
+    while (-1 != m_streams[0].pipe || -1 != m_streams[1].pipe)
+      {
+        pollfd fds[3] = {
+          {.fd = m_wakeup[0], .events = POLLIN, .revents = 0},
+          {.fd = m_streams[0].pipe, .events = POLLIN, .revents = 0},
+          {.fd = m_streams[1].pipe, .events = POLLIN, .revents = 0}};
+
+        /* Once stopping, only what is already in the pipes is moved. */
+        if (-1 == poll(fds, 3, stopping ? 0 : -1))
+          {
+            if (EINTR == errno)
+              continue;
+            break;
+          }
+
+        if (0 != fds[0].revents)
+          stopping = true;
+
+        bool moved = false;
+        for (int i = 0; i < 2; ++i)
+          if (0 != fds[i + 1].revents)
+            {
+              moved = true;
+              if (!forward(m_streams[i]))
+                {
+                  close(m_streams[i].pipe);
+                  m_streams[i].pipe = -1;
+                }
+            }
+
+        if (stopping && !moved)
+          break;
+      }
+  }
+
+  std::expected<void, error::Err> Capture::stop() noexcept
+  {
+    if (m_thread.joinable())
+      {
+        if (-1 == write(m_wakeup[1], "", 1))
+          return std::unexpected(ERR(error::Code::Container));
+
+        m_thread.join();
+      }
+
+    for (auto & stream : m_streams)
+      {
+        if (0 != stream.dropped)
+          LOG_WARNING << "Dropped " << stream.dropped << " bytes of the workload "
+                      << stream.name;
+
+        if (-1 != stream.pipe)
+          close(stream.pipe);
+        if (-1 != stream.fd)
+          close(stream.fd);
+
+        stream.pipe = stream.fd = -1;
+      }
+
+    for (const int fd : {m_null, m_wakeup[0], m_wakeup[1]})
+      if (-1 != fd)
+        close(fd);
+
+    m_null = m_wakeup[0] = m_wakeup[1] = -1;
+    return {};
+  }
+} // namespace bonding::output
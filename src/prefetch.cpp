@@ -0,0 +1,347 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/prefetch.h"
+#include "include/unix.h"
+#include "logging.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <poll.h>
+#include <sys/fanotify.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace bonding::prefetch
+{
+  std::string Manifest::path_of(const config::Container_Options & options) noexcept
+  {
+    std::string configuration = options.mount_dir + ":" + options.path + ":";
+    for (const auto & [real_path, mount_path] : options.mounts)
+      configuration += real_path + "=" + mount_path + ":";
+
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const char c : configuration)
+      hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+
+    char key[17] = {0};
+    snprintf(key, sizeof(key), "%016lx", hash);
+    return PREFETCH_DIR + key + ".json";
+  }
+
+  std::expected<std::vector<File>, error::Err>
+    Manifest::read(const std::string & path) noexcept
+  {
+    try
+      {
+        const nlohmann::json manifest =
+          nlohmann::json::parse(unix::Filesystem::read_entire_file(path).value());
+
+        std::vector<File> files;
+        for (const auto & entry : manifest.at("files"))
+          {
+            File file{entry.at("path"), {}};
+            for (const auto & range : entry.at("ranges"))
+              file.ranges.emplace_back(range.at(0), range.at(1));
+
+            files.push_back(std::move(file));
+          }
+
+        return files;
+      }
+    catch (const std::exception & e)
+      {
+        return std::unexpected(
+          ERR_MSG(error::Code::Container, "Cannot read the prefetch manifest " + path));
+      }
+  }
+
+  std::expected<void, error::Err>
+    Manifest::write(const std::string & path, const std::vector<File> & files) noexcept
+  {
+    nlohmann::json manifest = {{"files", nlohmann::json::array()}};
+    for (const auto & file : files)
+      {
+        nlohmann::json ranges = nlohmann::json::array();
+        for (const auto & [offset, length] : file.ranges)
+          ranges.push_back({offset, length});
+
+        manifest["files"].push_back({{"path", file.path}, {"ranges", ranges}});
+      }
+
+    std::error_code ec;
+    std::filesystem::create_directories(PREFETCH_DIR, ec);
+
+    /* Written aside then renamed: a launch never reads half of a manifest. */
+    const std::string temporary = path + "." + std::to_string(getpid());
+    std::ofstream(temporary) << manifest.dump();
+    if (-1 == rename(temporary.c_str(), path.c_str()))
+      return std::unexpected(
+        ERR_MSG(error::Code::Container, "Cannot write the prefetch manifest " + path));
+
+    return {};
+  }
+
+  void Prefetcher::replay(const config::Container_Options & options) noexcept
+  {
+    if (0 == options.prefetch)
+      return;
+
+    const std::string path = Manifest::path_of(options);
+    if (-1 == access(path.c_str(), R_OK))
+      return;
+
+    const auto manifest = Manifest::read(path);
+    if (!manifest.has_value())
+      return;
+
+    /* Shared by the workers, which outlive this call. */
+    const auto files = std::make_shared<const std::vector<File>>(std::move(*manifest));
+    const auto next = std::make_shared<std::atomic<size_t>>(0);
+
+    /* The files are taken in the order the workload opened them. */
+    const size_t count = std::min(files->size(), MAX_WORKERS);
+    for (size_t i = 0; i < count; ++i)
+      std::thread([files, next]() {
+        for (size_t index; (index = next->fetch_add(1)) < files->size();)
+          read_ahead((*files)[index]);
+      }).detach();
+
+    LOG_INFO << "Prefetching " << files->size() << " files from " << path << "...✓";
+  }
+
+  void Prefetcher::read_ahead(const File & file) noexcept
+  {
+    const unix::Fd fd(open(file.path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!fd)
+      return;
+
+    /* readahead() takes the filesystems with a page cache only. */
+    for (const auto & [offset, length] : file.ranges)
+      if (-1 == readahead(fd.get(), offset, length))
+        posix_fadvise(fd.get(), offset, static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+  }
+
+  std::expected<void, error::Err>
+    Recorder::start(const config::Container_Options & options, const pid_t pid) noexcept
+  {
+    if (0 == options.prefetch)
+      return {};
+
+    m_path = Manifest::path_of(options);
+    if (0 == access(m_path.c_str(), F_OK))
+      return {};
+
+    struct stat ns = {};
+    if (-1 == stat(("/proc/" + std::to_string(pid) + "/ns/mnt").c_str(), &ns))
+      return std::unexpected(ERR(error::Code::Container));
+    m_namespace = ns.st_ino;
+
+    m_fanotify = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK,
+                               O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+    if (-1 == m_fanotify)
+      return std::unexpected(ERR_MSG(error::Code::Container, "Cannot initialize fanotify"));
+
+    m_mount_dir = options.mount_dir;
+    m_mounts = options.mounts;
+
+    /* The container opens its files through mounts of its own, which are marked with
+     * the filesystems they belong to only. */
+    std::vector<std::string> roots = {m_mount_dir};
+    for (const auto & [real_path, mount_path] : m_mounts)
+      roots.push_back(real_path);
+
+    for (const auto & root : roots)
+      if (-1 == fanotify_mark(m_fanotify,
+                              FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                              FAN_OPEN,
+                              AT_FDCWD,
+                              root.c_str()))
+        LOG_WARNING << "Cannot watch the filesystem of " << root << " for the prefetch";
+
+    if (-1 == pipe2(m_wakeup, O_CLOEXEC))
+      return std::unexpected(ERR(error::Code::Container));
+
+    m_thread = std::thread(&Recorder::loop,
+                           this,
+                           std::chrono::steady_clock::now()
+                             + std::chrono::seconds(options.prefetch));
+
+    LOG_INFO << "Recording the prefetch manifest " << m_path << " for " << options.prefetch
+             << "s...✓";
+    return {};
+  }
+
+  void Recorder::stop() noexcept
+  {
+    if (m_thread.joinable())
+      {
+        if (1 == write(m_wakeup[1], "", 1))
+          m_thread.join();
+        else
+          m_thread.detach();
+      }
+
+    for (const int fd : {m_fanotify, m_wakeup[0], m_wakeup[1]})
+      if (-1 != fd)
+        close(fd);
+
+    m_fanotify = m_wakeup[0] = m_wakeup[1] = -1;
+  }
+
+  void Recorder::loop(const std::chrono::steady_clock::time_point deadline) noexcept
+  {
+    alignas(fanotify_event_metadata) char buffer[8192];
+
+    while (true)
+      {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0)
+          break;
+
+        pollfd fds[2] = {
+          {.fd = m_wakeup[0], .events = POLLIN, .revents = 0},
+          {.fd = m_fanotify, .events = POLLIN, .revents = 0}};
+
+        if (-1 == poll(fds, 2, static_cast<int>(left.count())) && EINTR != errno)
+          break;
+
+        if (0 != fds[0].revents)
+          break;
+
+        ssize_t size = 0;
+        while (0 < (size = ::read(m_fanotify, buffer, sizeof(buffer))))
+          for (auto * event = reinterpret_cast<fanotify_event_metadata *>(buffer);
+               FAN_EVENT_OK(event, size);
+               event = FAN_EVENT_NEXT(event, size))
+            if (FAN_NOFD != event->fd)
+              accept(event->fd, event->pid);
+      }
+
+    std::vector<File> files;
+    for (auto & opened : m_opened)
+      {
+        /* Opened again only for the time of the sampling, and only if it is still the
+         * file the container opened. */
+        const unix::Fd fd(open(opened.file.path.c_str(), O_RDONLY | O_CLOEXEC));
+        struct stat    st = {};
+        if (!fd || -1 == fstat(fd.get(), &st) || st.st_dev != opened.dev
+            || st.st_ino != opened.ino)
+          continue;
+
+        opened.file.ranges = resident(fd.get(), static_cast<size_t>(st.st_size));
+        if (!opened.file.ranges.empty())
+          files.push_back(std::move(opened.file));
+      }
+    m_opened.clear();
+
+    if (Manifest::write(m_path, files).has_value())
+      LOG_INFO << "Recording " << files.size() << " files into the prefetch manifest "
+               << m_path << "...✓";
+  }
+
+  void Recorder::accept(const int fd, const pid_t pid) noexcept
+  {
+    /* The descriptor of the event is not held: the supervisor has few to spare. */
+    const unix::Fd event(fd);
+
+    struct stat opened = {};
+    if (m_opened.size() >= MAX_FILES || !inside(pid) || -1 == fstat(event.get(), &opened)
+        || !S_ISREG(opened.st_mode) || m_seen.contains({opened.st_dev, opened.st_ino}))
+      return;
+
+    char              link[PATH_MAX] = {0};
+    const std::string proc = "/proc/self/fd/" + std::to_string(event.get());
+    if (-1 == readlink(proc.c_str(), link, sizeof(link) - 1))
+      return;
+
+    for (const auto & path : candidates(link))
+      {
+        struct stat found = {};
+        if (0 == stat(path.c_str(), &found) && found.st_dev == opened.st_dev
+            && found.st_ino == opened.st_ino)
+          {
+            m_seen.insert({opened.st_dev, opened.st_ino});
+            m_opened.push_back({File{path, {}}, opened.st_dev, opened.st_ino});
+            return;
+          }
+      }
+  }
+
+  std::vector<std::string> Recorder::candidates(const std::string & link) const noexcept
+  {
+    const std::filesystem::path path = std::filesystem::path(link).lexically_normal();
+
+    /* The path in the container: the innermost mount it lies in, the root otherwise. */
+    std::filesystem::path host = std::filesystem::path(m_mount_dir) / path.relative_path();
+    size_t                depth = 0;
+    for (const auto & [real_path, mount_path] : m_mounts)
+      {
+        const std::filesystem::path mount =
+          std::filesystem::path(mount_path).lexically_normal();
+        const std::filesystem::path inside = path.lexically_relative(mount);
+        const size_t components = std::distance(mount.begin(), mount.end());
+
+        if (inside.empty() || ".." == *inside.begin() || components <= depth)
+          continue;
+
+        host = std::filesystem::path(real_path) / inside;
+        depth = components;
+      }
+
+    std::vector<std::string> candidates = {host.lexically_normal()};
+
+    /* A mount which the supervisor cannot reach may also name its files from its own
+     * root: the file is found back under the path it was bound from. */
+    for (const auto & [real_path, mount_path] : m_mounts)
+      candidates.push_back(
+        (std::filesystem::path(real_path) / path.relative_path()).lexically_normal());
+
+    return candidates;
+  }
+
+  std::vector<std::pair<off_t, size_t>>
+    Recorder::resident(const int fd, const size_t size) noexcept
+  {
+    std::vector<std::pair<off_t, size_t>> ranges;
+    if (0 == size)
+      return ranges;
+
+    void * map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == map)
+      return ranges;
+
+    const size_t               page = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> pages((size + page - 1) / page);
+
+    if (0 == mincore(map, size, pages.data()))
+      for (size_t i = 0; i < pages.size(); ++i)
+        if (0 != (pages[i] & 1))
+          {
+            if (!ranges.empty()
+                && ranges.back().first + static_cast<off_t>(ranges.back().second)
+                     == static_cast<off_t>(i * page))
+              ranges.back().second += page;
+            else
+              ranges.emplace_back(static_cast<off_t>(i * page), page);
+          }
+
+    munmap(map, size);
+    return ranges;
+  }
+
+  bool Recorder::inside(const pid_t pid) const noexcept
+  {
+    struct stat ns = {};
+    return 0 == stat(("/proc/" + std::to_string(pid) + "/ns/mnt").c_str(), &ns)
+           && ns.st_ino == m_namespace;
+  }
+} // namespace bonding::prefetch
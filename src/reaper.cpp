@@ -0,0 +1,211 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/reaper.h"
+#include "include/id.h"
+#include "include/resource.h"
+#include "include/store.h"
+#include "logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace bonding::reaper
+{
+  Job Job::of(
+    const config::Container_Options & options, const std::optional<size_t> slot) noexcept
+  {
+    return {
+      .cgroups = resource::CgroupsV1::directories(options),
+      .id = options.id,
+      .pool = resource::Pool::key_of(options),
+      .slot = slot,
+      .owner = getpid()};
+  }
+
+  void Reaper::detach(const Job & job) noexcept
+  {
+    /* The queued log entries would be written twice otherwise. */
+    logging::flush();
+
+    const pid_t intermediate = fork();
+    if (-1 == intermediate)
+      {
+        LOG_WARNING << "Cannot fork the reaper, cleaning up in place";
+        run(job);
+        return;
+      }
+
+    if (0 == intermediate)
+      {
+        /* Orphaned at once, init reaps it: nobody waits for the teardown. */
+        logging::after_fork();
+        setsid();
+        if (0 != fork())
+          _exit(0);
+
+        const int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+        for (const int fd : {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO})
+          if (-1 != null)
+            dup2(null, fd);
+
+        /* Owned by the reaper now: neither a restarted supervisor nor the garbage
+         * collector cleans up behind it. */
+        Job owned = job;
+        if (!job.id.empty())
+          id::Id::mark(job.id);
+
+        if (job.slot.has_value())
+          if (auto store = store::Store::open();
+              !store.has_value() || !store->adopt(*job.slot, job.owner))
+            owned.slot.reset();
+
+        run(owned);
+        _exit(0);
+      }
+
+    while (-1 == waitpid(intermediate, nullptr, 0) && EINTR == errno)
+      ;
+
+    LOG_INFO << "Handing the teardown over to the reaper...✓";
+  }
+
+  void Reaper::run(const Job & job) noexcept
+  {
+    kill(job.cgroups);
+
+    /* Drained, the cgroups are kept for the next container rather than removed. */
+    const bool recycled = !job.pool.empty() && drain(job.cgroups)
+                          && resource::Pool::recycle(job.pool, job.id, job.cgroups);
+    const std::vector<std::string> cgroups =
+      recycled ? std::vector<std::string>{} : job.cgroups;
+
+    /* Each removal may wait on the kernel, none waits on another. */
+    std::vector<std::thread> removals;
+    std::vector<char>        removed(cgroups.size() + (job.id.empty() ? 0 : 1), 0);
+    for (size_t i = 0; i < cgroups.size(); ++i)
+      removals.emplace_back([&, i]() { removed[i] = remove(cgroups[i], true); });
+
+    if (!job.id.empty())
+      removals.emplace_back([&]() {
+        removed[cgroups.size()] = remove(id::Id::state_dir(job.id), false);
+      });
+
+    for (auto & removal : removals)
+      removal.join();
+
+    const bool done =
+      std::all_of(removed.begin(), removed.end(), [](const char r) { return 0 != r; });
+
+    /* Whatever is left behind is collected later, from the marker. */
+    if (done && !job.id.empty())
+      id::Id::unmark(job.id);
+
+    /* Last, a restarted supervisor cleans up what is left behind a crash in between. */
+    if (job.slot.has_value())
+      if (auto store = store::Store::open(); store.has_value())
+        store->release(*job.slot);
+
+    if (done)
+      LOG_INFO << "Tearing down the container...✓";
+  }
+
+  void Reaper::kill(const std::vector<std::string> & cgroups) noexcept
+  {
+    for (const auto & cgroup : cgroups)
+      {
+        /* cgroups v2 kills the whole subtree in one write, and races no fork. */
+        if (0 == access((cgroup + "/cgroup.kill").c_str(), F_OK))
+          {
+            write_file(cgroup + "/cgroup.kill", "1");
+            continue;
+          }
+
+        /* cgroups v1: a frozen process cannot fork a new one while its siblings are
+         * being killed, the signals are delivered once thawed. */
+        if (0 == access((cgroup + "/freezer.state").c_str(), F_OK)
+            && write_file(cgroup + "/freezer.state", "FROZEN"))
+          {
+            kill_procs(cgroup);
+            write_file(cgroup + "/freezer.state", "THAWED");
+          }
+      }
+
+    /* The processes of the other v1 hierarchies, and those of a hierarchy without the
+     * freezer: the same processes, so most of them are already dying. */
+    for (const auto & cgroup : cgroups)
+      if (0 != access((cgroup + "/cgroup.kill").c_str(), F_OK))
+        kill_procs(cgroup);
+  }
+
+  bool Reaper::drain(const std::vector<std::string> & cgroups) noexcept
+  {
+    const auto deadline = std::chrono::steady_clock::now() + DRAIN;
+
+    /* The killed processes leave their cgroups once fully gone. */
+    for (auto backoff = FIRST_BACKOFF;; backoff = std::min(backoff * 2, MAX_BACKOFF))
+      {
+        const bool empty = std::all_of(cgroups.begin(), cgroups.end(), [](const auto & dir) {
+          std::ifstream procs(dir + "/cgroup.procs");
+          pid_t         pid = 0;
+          return procs && !(procs >> pid);
+        });
+
+        if (empty)
+          return true;
+
+        if (std::chrono::steady_clock::now() + backoff > deadline)
+          return false;
+
+        std::this_thread::sleep_for(backoff);
+      }
+  }
+
+  void Reaper::kill_procs(const std::string & cgroup) noexcept
+  {
+    std::ifstream procs(cgroup + "/cgroup.procs");
+    for (pid_t pid = 0; procs >> pid;)
+      if (0 < pid)
+        ::kill(pid, SIGKILL);
+  }
+
+  bool Reaper::write_file(const std::string & path, const std::string & value) noexcept
+  {
+    const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (-1 == fd)
+      return false;
+
+    const bool written =
+      static_cast<ssize_t>(value.size()) == write(fd, value.c_str(), value.size());
+    close(fd);
+    return written;
+  }
+
+  bool Reaper::remove(const std::string & dir, const bool cgroup) noexcept
+  {
+    const auto deadline = std::chrono::steady_clock::now() + GIVE_UP;
+
+    /* A killed process leaves its cgroup once it is fully gone, and the root of the
+     * container is unmounted once the last process of its mount namespace is. */
+    for (auto backoff = FIRST_BACKOFF;; backoff = std::min(backoff * 2, MAX_BACKOFF))
+      {
+        if (0 == rmdir(dir.c_str()) || ENOENT == errno)
+          return true;
+
+        if (EBUSY != errno || std::chrono::steady_clock::now() + backoff > deadline)
+          break;
+
+        std::this_thread::sleep_for(backoff);
+        if (cgroup)
+          kill_procs(dir);
+      }
+
+    LOG_WARNING << "Cannot remove " << dir << ", leaving it behind";
+    return false;
+  }
+} // namespace bonding::reaper
@@ -3,20 +3,41 @@
 #include "include/resource.h"
 #include "include/config.h"
 #include "include/environment.h"
+#include "include/id.h"
 #include "logging.h"
 #include "include/unix.h"
 #include <fcntl.h>
+#include <cstdlib>
 #include <filesystem>
+#include <fstream>
+#include <sstream>
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 namespace bonding::resource
 {
+  namespace
+  {
+    /** Best effort, a failure is no error */
+    bool write_file(const std::string & path, const std::string & value, const int flags) noexcept
+    {
+      const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC | flags, 0644);
+      if (-1 == fd)
+        return false;
+
+      const bool written =
+        static_cast<ssize_t>(value.size()) == write(fd, value.c_str(), value.size());
+      close(fd);
+      return written;
+    }
+  } // namespace
+
   std::expected<void, error::Err>
-    Resource::setup(const config::Container_Options & config) noexcept
+    Resource::setup(const config::Container_Options & config, const pid_t pid) noexcept
   {
-    LOG_INFO << "Restricting resources for hostname " << config.hostname;
-    CgroupsV1::setup(config).value();
+    LOG_INFO << "Restricting resources for container " << config.id;
+    CgroupsV1::setup(config, pid).value();
     Rlimit::setup().value();
 
     return {};
@@ -33,24 +54,14 @@ namespace bonding::resource
   }
 
   std::expected<void, error::Err> CgroupsV1::write_settings(
-    const std::string & dir, const config::CgroupsV1::Control::Setting & setting) noexcept
+    const unix::Fd & dir, const config::CgroupsV1::Control::Setting & setting) noexcept
   {
-    const int fd = unix::Filesystem::Open(dir + "/" + setting.name, O_WRONLY)
-                     .transform_error([&](const auto & e) {
-      return ERR_MSG(error::Code::Cgroups, "Cannot open controller " + setting.name);
-    }).value();
-
-    unix::Filesystem::Write(fd, setting.value)
+    unix::Filesystem::Write_at(dir, setting.name, setting.value)
       .transform_error([&](const auto & e) {
       return ERR_MSG(
         error::Code::Cgroups, "Cannot write value to controller " + setting.name);
     }).value();
 
-    unix::Filesystem::Close(fd)
-      .transform_error([&](const auto & e) {
-      return ERR_MSG(error::Code::Cgroups, "Cannot close controller " + setting.name);
-    }).value();
-
     if (setting.name != "tasks")
       {
         LOG_DEBUG << "Setting controller " << setting.name << "  by value "
@@ -60,97 +71,402 @@ namespace bonding::resource
     return {};
   }
 
-  std::expected<void, error::Err> CgroupsV1::write_contorl(
-    const std::string hostname, const config::CgroupsV1::Control & cgroup) noexcept
+  std::expected<void, error::Err>
+    CgroupsV1::create_group(const std::string & control, const std::string & group) noexcept
   {
-    if (environment::CgroupsV1::checking_if_controller_supported(cgroup.control))
+    std::string dir = "/sys/fs/cgroup/" + control;
+
+    for (size_t begin = 0; begin < group.size();)
       {
-        const std::string dir = "/sys/fs/cgroup/" + cgroup.control + "/" + hostname;
-        unix::Filesystem::Mkdir(dir).value();
+        const size_t end = std::min(group.find('/', begin), group.size());
+        const std::string parent = dir;
+        dir += "/" + group.substr(begin, end - begin);
+        begin = end + 1;
+
+        if (-1 == mkdir(dir.c_str(), 0755))
+          {
+            if (EEXIST == errno)
+              continue;
 
-        for (const auto & setting : cgroup.settings)
-          write_settings(dir, setting).value();
+            return std::unexpected(
+              ERR_MSG(error::Code::Cgroups, "Cannot create the cgroup " + dir));
+          }
 
-        write_settings(dir, TASK).value();
+        /* A new cpuset has no cpu nor memory node, a task cannot join it before they
+         * are copied from its parent. */
+        if (control == "cpuset")
+          if (const auto held = unix::Filesystem::Open_directory(dir); held.has_value())
+            for (const std::string file : {"cpuset.cpus", "cpuset.mems"})
+              unix::Filesystem::read_entire_file(parent + "/" + file)
+                .and_then([&](const std::string & value) {
+                return unix::Filesystem::Write_at(*held, file, value);
+              });
       }
-    else
-      LOG_WARNING << "Controller " << cgroup.control << " is not support!!";
 
     return {};
   }
 
-  std::expected<void, error::Err>
-    CgroupsV1::setup(const config::Container_Options & config) noexcept
+  std::expected<void, error::Err> CgroupsV1::write_contorl(
+    unix::Batch &                      batch,
+    const unix::Fd &                   root,
+    const std::string &                id,
+    const config::CgroupsV1::Control & cgroup,
+    const pid_t                        pid) noexcept
   {
-    for (const auto & control : config.cgroups_options)
-      write_contorl(config.hostname, control).value();
+    const std::string group = id::Id::cgroup_of(id);
 
-    LOG_INFO << "Setting cgroups by cgroups-v1...✓";
+    /* A chain per controller: its cgroup, then its settings, then the task. */
+    batch.chain();
+
+    if (cgroup.control == "cpuset")
+      create_group(cgroup.control, group).value();
+    else
+      for (size_t end = group.find('/'); ; end = group.find('/', end + 1))
+        {
+          batch.mkdir(root, group.substr(0, end), 0755);
+          if (std::string::npos == end)
+            break;
+        }
+
+    for (const auto & setting : cgroup.settings)
+      batch.write(root, group + "/" + setting.name, setting.value);
+
+    /* "0" would be the supervisor writing it, the limits are for the container. */
+    batch.write(root, group + "/tasks", std::to_string(pid));
     return {};
   }
 
   std::expected<void, error::Err>
-    CgroupsV1::clean_control_task(const config::CgroupsV1::Control & cgroup) noexcept
+    CgroupsV1::setup(const config::Container_Options & config, const pid_t pid) noexcept
   {
-    const std::string task = "/sys/fs/cgroup/" + cgroup.control + "/tasks";
+    /* Every cgroup file is written relative to the root of its hierarchy, resolved
+     * once, in a single batch. */
+    unix::Batch           batch;
+    std::vector<unix::Fd> roots;
+    roots.reserve(config.cgroups_options.size());
 
-    const int taskfd = unix::Filesystem::Open(task.c_str(), O_WRONLY)
-                         .transform_error([&](const auto & e) {
-      return ERR_MSG(
-        error::Code::Cgroups,
-        "Cannot open the cgroups tasks controller " + cgroup.control);
-    }).value();
+    for (const auto & control : config.cgroups_options)
+      {
+        if (!environment::CgroupsV1::checking_if_controller_supported(control.control)
+               .value())
+          {
+            LOG_WARNING << "Controller " << control.control << " is not support!!";
+            continue;
+          }
 
-    unix::Filesystem::Write(taskfd, "0")
-      .transform_error([&](const auto & e) {
-      unix::Filesystem::Close(taskfd)
-        .transform_error([&](const auto & e) {
-        return ERR_MSG(
-          error::Code::Cgroups,
-          "Cannot close the cgroups tasks controller " + cgroup.control);
-      }).value();
+        const std::string path = "/sys/fs/cgroup/" + control.control;
+        roots.push_back(unix::Filesystem::Open_directory(path)
+                          .transform_error([&](const auto & e) {
+          return ERR_MSG(error::Code::Cgroups, "Cannot open the hierarchy " + path);
+        }).value());
 
-      return ERR_MSG(
-        error::Code::Cgroups,
-        "Cannot write the cgroups tasks controller " + cgroup.control);
-    }).value();
+        write_contorl(batch, roots.back(), config.id, control, pid).value();
+      }
 
-    unix::Filesystem::Close(taskfd)
+    batch.submit()
       .transform_error([&](const auto & e) {
-      return ERR_MSG(
-        error::Code::Cgroups,
-        "Cannot close the cgroups tasks controller " + cgroup.control);
+      return ERR_MSG(error::Code::Cgroups, "Cannot set the cgroups of the container");
     }).value();
 
+    LOG_INFO << "Setting cgroups by cgroups-v1...✓";
     return {};
   }
 
   std::expected<void, error::Err>
-    CgroupsV1::clean(const config::Container_Options & config) noexcept
+    CgroupsV1::reset_counters(const config::Container_Options & config) noexcept
   {
-    for (const auto & cgroup : config.cgroups_options)
+    std::map<std::string, unix::Fd> dirs;
+    for (const auto & [control, counter] : RESETTABLE)
       {
-        const std::string dir =
-          "/sys/fs/cgroup/" + cgroup.control + "/" + config.hostname;
+        const std::string path =
+          "/sys/fs/cgroup/" + control + "/" + id::Id::cgroup_of(config.id);
+        if (!std::filesystem::exists(path + "/" + counter))
+          continue;
 
-        clean_control_task(cgroup).value();
+        if (!dirs.contains(control))
+          {
+            auto dir = unix::Filesystem::Open_directory(path);
+            if (!dir.has_value())
+              return std::unexpected(dir.error());
+            dirs[control] = std::move(*dir);
+          }
 
-        unix::Filesystem::Rmdir(dir)
-          .transform_error([&](const auto & _) {
-          return ERR_MSG(
-            error::Code::Cgroups, "Cannot clean cgroups controller " + cgroup.control);
-        }).value();
+        if (!unix::Filesystem::Write_at(dirs[control], counter, "0").has_value())
+          return std::unexpected(
+            ERR_MSG(error::Code::Cgroups, "Cannot reset the counter " + counter));
       }
 
-    LOG_INFO << "Cleaning cgroups-v1 settings...✓";
     return {};
   }
 
-  std::expected<void, error::Err>
-    Resource::clean(const config::Container_Options & config) noexcept
+  std::map<std::string, uint64_t>
+    CgroupsV1::read_counters(const config::Container_Options & config) noexcept
+  {
+    std::map<std::string, uint64_t> counters;
+
+    for (const auto & [control, counter] : COUNTERS)
+      {
+        const std::string path =
+          "/sys/fs/cgroup/" + control + "/" + id::Id::cgroup_of(config.id) + "/" + counter;
+        if (!std::filesystem::exists(path))
+          continue;
+
+        const auto content = unix::Filesystem::read_entire_file(path);
+        if (content.has_value())
+          counters[counter] = std::strtoull(content->c_str(), nullptr, 10);
+      }
+
+    return counters;
+  }
+
+  std::vector<std::string> CgroupsV1::directories(const config::Container_Options & config) noexcept
+  {
+    std::vector<std::string> dirs;
+    if (config.id.empty())
+      return dirs;
+
+    for (const auto & cgroup : config.cgroups_options)
+      dirs.push_back("/sys/fs/cgroup/" + cgroup.control + "/" + id::Id::cgroup_of(config.id));
+
+    return dirs;
+  }
+
+  std::string Pool::key_of(const config::Container_Options & options) noexcept
+  {
+    std::string controls;
+    for (const auto & control : options.cgroups_options)
+      {
+        controls += control.control + ":";
+        for (const auto & setting : control.settings)
+          controls += setting.name + ",";
+        controls += ";";
+      }
+
+    if (controls.empty())
+      return "";
+
+    /* FNV-1a, the same key in every process. */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const char c : controls)
+      hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+
+    char key[17] = {0};
+    snprintf(key, sizeof(key), "%016lx", hash);
+    return key;
+  }
+
+  std::string Pool::idle_of(const std::string & dir, const std::string & id) noexcept
+  {
+    return std::filesystem::path(dir).parent_path().string() + "/" + IDLE_PREFIX + id;
+  }
+
+  std::optional<std::string> Pool::idle_id(const std::string & name) noexcept
+  {
+    if (!name.starts_with(IDLE_PREFIX))
+      return std::nullopt;
+
+    return name.substr(IDLE_PREFIX.size());
+  }
+
+  bool Pool::pooled(const std::string & id) noexcept
+  {
+    std::error_code ec;
+    for (const auto & key : std::filesystem::directory_iterator(POOL_DIR, ec))
+      if (std::filesystem::exists(key.path() / id, ec)
+          || std::filesystem::exists(key.path() / (id + CLAIMED_SUFFIX), ec))
+        return true;
+
+    return false;
+  }
+
+  std::optional<std::string> Pool::take(const std::string & key) noexcept
+  {
+    if (key.empty())
+      return std::nullopt;
+
+    /* The entry is claimed by renaming it, and stays indexed until its cgroups are
+     * renamed: gc takes the idle cgroups no entry refers to for leaked ones. */
+    std::error_code ec;
+    for (const auto & entry : std::filesystem::directory_iterator(POOL_DIR + key, ec))
+      {
+        const std::string id = entry.path().filename().string();
+        const std::string claimed = entry.path().string() + CLAIMED_SUFFIX;
+        if (id.ends_with(CLAIMED_SUFFIX)
+            || -1 == rename(entry.path().c_str(), claimed.c_str()))
+          continue;
+
+        /* Its idle time starts over, shrink() leaves it to the launch for a while. */
+        utimensat(AT_FDCWD, claimed.c_str(), nullptr, 0);
+        return id;
+      }
+
+    return std::nullopt;
+  }
+
+  bool Pool::adopt(const std::string & from, const config::Container_Options & options) noexcept
   {
-    CgroupsV1::clean(config).value();
+    const std::vector<std::string> dirs = CgroupsV1::directories(options);
+
+    bool adopted = true;
+    for (const auto & dir : dirs)
+      if (-1 == rename(idle_of(dir, from).c_str(), dir.c_str()))
+        {
+          rmdir(idle_of(dir, from).c_str());
+          adopted = false;
+        }
+
+    unlink((POOL_DIR + key_of(options) + "/" + from + CLAIMED_SUFFIX).c_str());
+
+    /* The counters of the previous container are not those of this one: fresh cgroups
+     * are created when they cannot be reset. */
+    if (adopted && !CgroupsV1::reset_counters(options).has_value())
+      {
+        LOG_WARNING << "Cannot reset the counters of the cgroups of the container " << from;
+        for (const auto & dir : dirs)
+          rmdir(dir.c_str());
+        return false;
+      }
+
+    if (adopted)
+      LOG_DEBUG << "Reusing the cgroups of the container " << from << "...✓";
+    return adopted;
+  }
+
+  bool Pool::recycle(
+    const std::string &              key,
+    const std::string &              id,
+    const std::vector<std::string> & cgroups) noexcept
+  {
+    if (key.empty() || cgroups.empty())
+      return false;
+
+    shrink(key);
+
+    std::error_code ec;
+    const std::string index = POOL_DIR + key + "/";
+    std::filesystem::create_directories(index, ec);
+    if (ec
+        || MAX_IDLE <= static_cast<size_t>(std::distance(
+             std::filesystem::directory_iterator(index, ec), {})))
+      return false;
+
+    for (const auto & dir : cgroups)
+      {
+        /* cgroups v2 renames no cgroup, and a cgroup still in use is not reset. */
+        std::ifstream procs(dir + "/cgroup.procs");
+        pid_t         pid = 0;
+        if (0 == access((dir + "/cgroup.kill").c_str(), F_OK) || !procs || procs >> pid)
+          return false;
+      }
+
+    std::string entry;
+    for (size_t i = 0; i < cgroups.size(); ++i)
+      {
+        const std::string idle = idle_of(cgroups[i], id);
+        if (-1 == rename(cgroups[i].c_str(), idle.c_str()))
+          {
+            /* Back under their name, they are removed like any other. */
+            for (size_t j = 0; j < i; ++j)
+              rename(idle_of(cgroups[j], id).c_str(), cgroups[j].c_str());
+            return false;
+          }
+
+        /* The page cache charged to a memory cgroup outlives its tasks. */
+        if (0 == access((idle + "/memory.force_empty").c_str(), F_OK))
+          write_file(idle + "/memory.force_empty", "0", 0);
+
+        entry += idle + "\n";
+      }
+
+    /* Indexed last, a claimed entry has all its cgroups. */
+    const std::string temporary = POOL_DIR + key + "." + id;
+    if (write_file(temporary, entry, O_CREAT | O_TRUNC)
+        && 0 == rename(temporary.c_str(), (index + id).c_str()))
+      return true;
+
+    unlink(temporary.c_str());
+    for (const auto & dir : cgroups)
+      rename(idle_of(dir, id).c_str(), dir.c_str());
+
+    return false;
+  }
+
+  void Pool::destroy(const std::string & entry) noexcept
+  {
+    /* Read first, only the process whose unlink() succeeds removes them. */
+    std::ifstream            file(entry);
+    std::vector<std::string> dirs;
+    for (std::string dir; std::getline(file, dir);)
+      dirs.push_back(dir);
+
+    if (!file.eof() || 0 != unlink(entry.c_str()))
+      return;
+
+    for (const auto & dir : dirs)
+      if (!dir.empty() && -1 == rmdir(dir.c_str()) && ENOENT != errno)
+        LOG_WARNING << "Cannot remove the idle cgroup " << dir;
+  }
+
+  void Pool::shrink(const std::string & key) noexcept
+  {
+    std::error_code ec;
+    const auto      now = std::filesystem::file_time_type::clock::now();
+
+    std::vector<std::string> keys;
+    if (!key.empty())
+      keys.push_back(POOL_DIR + key);
+    else
+      for (const auto & dir : std::filesystem::directory_iterator(POOL_DIR, ec))
+        if (dir.is_directory(ec))
+          keys.push_back(dir.path().string());
+
+    for (const auto & index : keys)
+      for (const auto & entry : std::filesystem::directory_iterator(index, ec))
+        if (const auto modified = entry.last_write_time(ec);
+            !ec && now - modified > IDLE_TIMEOUT)
+          destroy(entry.path().string());
+  }
+
+  std::expected<void, error::Err> Resource::join(const pid_t pid) noexcept
+  {
+    const std::string self = std::to_string(getpid());
+    std::istringstream cgroups(
+      unix::Filesystem::read_entire_file("/proc/" + std::to_string(pid) + "/cgroup").value());
+
+    /* Lines are "<hierarchy>:<controllers>:<path>", the controllers are empty for the
+     * cgroups v2 hierarchy. */
+    for (std::string line; std::getline(cgroups, line);)
+      {
+        const size_t first = line.find(':');
+        const size_t second = line.find(':', first + 1);
+        if (std::string::npos == first || std::string::npos == second)
+          continue;
+
+        std::string controllers = line.substr(first + 1, second - first - 1);
+        const std::string path = line.substr(second + 1);
+        if (path == "/")
+          continue;
+
+        if (controllers.starts_with("name="))
+          controllers = controllers.substr(5);
+
+        std::string dir = "/sys/fs/cgroup/" + controllers;
+        if (controllers.empty() && std::filesystem::exists("/sys/fs/cgroup/unified"))
+          dir = "/sys/fs/cgroup/unified";
+
+        const auto joined =
+          unix::Filesystem::Open(dir + path + "/cgroup.procs", O_WRONLY)
+            .and_then([&](const int fd) {
+          const auto written = unix::Filesystem::Write(fd, self);
+          close(fd);
+          return written;
+        });
+
+        if (!joined.has_value())
+          LOG_WARNING << "Cannot join cgroup " << dir << path;
+      }
 
+    LOG_DEBUG << "Joining the cgroups of process " << pid << "...✓";
     return {};
   }
 } // namespace bonding::resource
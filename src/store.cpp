@@ -0,0 +1,386 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/store.h"
+#include "include/id.h"
+#include "include/reaper.h"
+#include "logging.h"
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+namespace bonding::store
+{
+  struct alignas(64) Store::Slot
+  {
+    /** Odd while the owner writes the record */
+    uint32_t seq;
+    uint32_t state;
+    pid_t    owner;
+    Record   record;
+  };
+
+  namespace
+  {
+    template <size_t N>
+    void copy(char (&destination)[N], const std::string & source) noexcept
+    {
+      const size_t size = std::min(source.size(), N - 1);
+      memcpy(destination, source.data(), size);
+      destination[size] = '\0';
+    }
+
+    /** The supervisor is still there, whoever it is */
+    bool exists(const pid_t pid) noexcept
+    {
+      return 0 < pid && (0 == kill(pid, 0) || EPERM == errno);
+    }
+  } // namespace
+
+  Record Record::of(const config::Container_Options & options, const pid_t pid) noexcept
+  {
+    Record record = {};
+
+    copy(record.id, options.id);
+    copy(record.name, options.name);
+    copy(record.hostname, options.hostname);
+    copy(record.cgroup, id::Id::cgroup_of(options.id));
+    copy(record.rootfs, options.mount_dir);
+    copy(record.command, options.path);
+
+    std::string controllers;
+    std::string limits;
+    for (const auto & control : options.cgroups_options)
+      {
+        controllers += (controllers.empty() ? "" : ",") + control.control;
+        for (const auto & setting : control.settings)
+          limits += (limits.empty() ? "" : " ") + setting.name + "=" + setting.value;
+      }
+
+    copy(record.controllers, controllers);
+    copy(record.limits, limits);
+
+    timespec now = {};
+    clock_gettime(CLOCK_REALTIME, &now);
+    record.started_at = now.tv_sec * 1000000000LL + now.tv_nsec;
+    record.pid = pid;
+    record.pid_start = Store::start_time(pid);
+
+    return record;
+  }
+
+  nlohmann::json Record::to_json() const noexcept
+  {
+    return {
+      {"id", id},
+      {"name", name},
+      {"hostname", hostname},
+      {"pid", pid},
+      {"started_at", started_at},
+      {"cgroup", cgroup},
+      {"controllers", controllers},
+      {"rootfs", rootfs},
+      {"command", command},
+      {"limits", limits}};
+  }
+
+  const char * Store::Entry::to_string(const Status status) noexcept
+  {
+    switch (status)
+      {
+      case Status::Running:
+        return "running";
+      case Status::Orphaned:
+        return "orphaned";
+      case Status::Exited:
+        return "exited";
+      }
+
+    return "unknown";
+  }
+
+  Store::~Store()
+  {
+    if (nullptr != m_map)
+      munmap(m_map, HEADER_SIZE + SLOTS * sizeof(Slot));
+  }
+
+  std::expected<Store, error::Err> Store::open() noexcept
+  {
+    const size_t size = HEADER_SIZE + SLOTS * sizeof(Slot);
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(PATH).parent_path(), ec);
+
+    const int fd = ::open(PATH.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (-1 == fd)
+      return std::unexpected(ERR_MSG(error::Code::Container, "Cannot open " + PATH));
+
+    /* Every process extends it to the same size, the slots are zeroes, that is free. */
+    struct stat st = {};
+    if (-1 == fstat(fd, &st)
+        || (static_cast<size_t>(st.st_size) < size && -1 == ftruncate(fd, size)))
+      {
+        close(fd);
+        return std::unexpected(ERR_MSG(error::Code::Container, "Cannot extend " + PATH));
+      }
+
+    void * map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map)
+      return std::unexpected(ERR_MSG(error::Code::Container, "Cannot map " + PATH));
+
+    Store store(map);
+
+    uint64_t expected = 0;
+    std::atomic_ref<uint64_t> magic(*static_cast<uint64_t *>(map));
+    if (!magic.compare_exchange_strong(expected, MAGIC) && MAGIC != expected)
+      return std::unexpected(
+        ERR_MSG(error::Code::Container, PATH + " was written by another bonding version"));
+
+    return store;
+  }
+
+  Store::Slot & Store::slot(const size_t index) const noexcept
+  {
+    return static_cast<Slot *>(
+      static_cast<void *>(static_cast<char *>(m_map) + HEADER_SIZE))[index];
+  }
+
+  std::expected<size_t, error::Err> Store::claim(const Record & record) noexcept
+  {
+    for (size_t i = 0; i < m_slots; ++i)
+      {
+        Slot &                    s = slot(i);
+        std::atomic_ref<uint32_t> state(s.state);
+
+        uint32_t expected = static_cast<uint32_t>(State::Free);
+        if (expected != state.load(std::memory_order_relaxed)
+            || !state.compare_exchange_strong(
+              expected, static_cast<uint32_t>(State::Claimed), std::memory_order_acquire))
+          continue;
+
+        std::atomic_ref<uint32_t> seq(s.seq);
+        const uint32_t            begin = seq.load(std::memory_order_relaxed);
+        seq.store(begin + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        s.record = record;
+        std::atomic_ref<pid_t>(s.owner).store(getpid(), std::memory_order_relaxed);
+
+        seq.store(begin + 2, std::memory_order_release);
+        state.store(static_cast<uint32_t>(State::Running), std::memory_order_release);
+
+        LOG_DEBUG << "Recording the container in the slot " << i << " of " << PATH << "...✓";
+        return i;
+      }
+
+    return std::unexpected(ERR_MSG(error::Code::Container, "No free slot in " + PATH));
+  }
+
+  void Store::release(const size_t index) noexcept
+  {
+    Slot &                    s = slot(index);
+    std::atomic_ref<uint32_t> seq(s.seq);
+
+    /* A reader copying the record sees it moved. Still odd when an owner died in
+     * here, the slot is reclaimed by another one which makes it even again. */
+    const uint32_t begin = (seq.load(std::memory_order_relaxed) + 1) & ~1U;
+    seq.store(begin + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    std::atomic_ref<pid_t>(s.owner).store(0, std::memory_order_relaxed);
+    seq.store(begin + 2, std::memory_order_release);
+    std::atomic_ref<uint32_t>(s.state).store(
+      static_cast<uint32_t>(State::Free), std::memory_order_release);
+  }
+
+  bool Store::adopt(const size_t index, pid_t previous) noexcept
+  {
+    return std::atomic_ref<pid_t>(slot(index).owner)
+      .compare_exchange_strong(previous, getpid(), std::memory_order_acq_rel);
+  }
+
+  std::optional<Store::Entry> Store::read(const size_t index) const noexcept
+  {
+    Slot &                    s = slot(index);
+    std::atomic_ref<uint32_t> seq(s.seq);
+    std::atomic_ref<uint32_t> state(s.state);
+
+    Entry entry = {};
+    bool  stalled = false;
+    for (int spins = 0;; ++spins)
+      {
+        const uint32_t begin = seq.load(std::memory_order_acquire);
+        if (static_cast<uint32_t>(State::Running) != state.load(std::memory_order_acquire))
+          return std::nullopt;
+
+        /* Odd for that long, its owner died while releasing it: only the owner is reset
+         * then, the record is left as it is and the slot is reclaimed as exited. */
+        stalled = 0 != (begin & 1) && spins >= STALLED_SPINS;
+        if (0 != (begin & 1) && !stalled)
+          {
+            std::this_thread::yield();
+            continue;
+          }
+
+        entry.record = s.record;
+        entry.owner = std::atomic_ref<pid_t>(s.owner).load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (stalled || begin == seq.load(std::memory_order_relaxed))
+          break;
+      }
+
+    entry.slot = index;
+    if (stalled || 0 == entry.record.pid_start
+        || entry.record.pid_start != start_time(entry.record.pid))
+      entry.status = Entry::Status::Exited;
+    else
+      entry.status = exists(entry.owner) ? Entry::Status::Running : Entry::Status::Orphaned;
+
+    return entry;
+  }
+
+  std::vector<Store::Entry> Store::list() const noexcept
+  {
+    std::vector<Entry> entries;
+    for (size_t i = 0; i < m_slots; ++i)
+      if (auto entry = read(i); entry.has_value())
+        entries.push_back(*entry);
+
+    return entries;
+  }
+
+  std::optional<Store::Entry> Store::find(const std::string & name) const noexcept
+  {
+    for (size_t i = 0; i < m_slots; ++i)
+      if (auto entry = read(i); entry.has_value())
+        if (name == entry->record.name || name == entry->record.id)
+          return entry;
+
+    return std::nullopt;
+  }
+
+  uint64_t Store::start_time(const pid_t pid) noexcept
+  {
+    const std::string path = "/proc/" + std::to_string(pid) + "/stat";
+    const int         fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 == fd)
+      return 0;
+
+    char          buffer[1024] = {0};
+    const ssize_t size = ::read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (size <= 0)
+      return 0;
+
+    /* The command name may hold blanks and parentheses, the fields follow the last ')'.
+     * The start time is the 22nd field, the 20th after the ')'. */
+    const char * field = strrchr(buffer, ')');
+    for (int i = 0; nullptr != field && i < 20; ++i)
+      field = strchr(field + 1, ' ');
+
+    return nullptr == field ? 0 : strtoull(field + 1, nullptr, 10);
+  }
+
+  void Adopter::clean(Store & store, const Store::Entry & entry) noexcept
+  {
+    reaper::Job job = {
+      .cgroups = {},
+      .id = entry.record.id,
+      .slot = std::nullopt,
+      .owner = getpid()};
+
+    const std::string controllers = entry.record.controllers;
+    for (size_t begin = 0; begin < controllers.size();)
+      {
+        const size_t end = std::min(controllers.find(',', begin), controllers.size());
+        job.cgroups.push_back("/sys/fs/cgroup/" + controllers.substr(begin, end - begin) + "/"
+                              + entry.record.cgroup);
+        begin = end + 1;
+      }
+
+    reaper::Reaper::run(job);
+
+    store.release(entry.slot);
+    LOG_INFO << "Cleaning after the container " << entry.record.name << "...✓";
+  }
+
+  std::expected<void, error::Err> Adopter::adopt() noexcept
+  {
+    Store store = Store::open().value();
+
+    std::vector<Store::Entry> adopted;
+    std::vector<pollfd>       pidfds;
+    for (const auto & entry : store.list())
+      {
+        /* The supervisor of a container which just exited is still cleaning up. */
+        if (Store::Entry::Status::Running == entry.status || exists(entry.owner)
+            || !store.adopt(entry.slot, entry.owner))
+          continue;
+
+        if (Store::Entry::Status::Exited == entry.status)
+          {
+            clean(store, entry);
+            continue;
+          }
+
+        /* Checked again once the pidfd pins the process, the pid may have been reused. */
+        const int pidfd = static_cast<int>(::syscall(SYS_pidfd_open, entry.record.pid, 0));
+        if (-1 == pidfd || entry.record.pid_start != Store::start_time(entry.record.pid))
+          {
+            if (-1 != pidfd)
+              close(pidfd);
+
+            clean(store, entry);
+            continue;
+          }
+
+        LOG_INFO << "Adopting the container " << entry.record.name << " on process "
+                 << entry.record.pid << "...✓";
+
+        adopted.push_back(entry);
+        pidfds.push_back({.fd = pidfd, .events = POLLIN, .revents = 0});
+      }
+
+    if (adopted.empty())
+      {
+        LOG_INFO << "No container to adopt";
+        return {};
+      }
+
+    /* A pidfd becomes readable once its process exits. */
+    for (size_t running = adopted.size(); 0 != running;)
+      {
+        if (-1 == poll(pidfds.data(), pidfds.size(), -1))
+          {
+            if (EINTR == errno)
+              continue;
+
+            return std::unexpected(ERR(error::Code::Container));
+          }
+
+        for (size_t i = 0; i < pidfds.size(); ++i)
+          if (-1 != pidfds[i].fd && 0 != pidfds[i].revents)
+            {
+              LOG_INFO << "Container " << adopted[i].record.name << " exited";
+              clean(store, adopted[i]);
+              close(pidfds[i].fd);
+              pidfds[i].fd = -1;
+              --running;
+            }
+      }
+
+    return {};
+  }
+} // namespace bonding::store
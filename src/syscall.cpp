@@ -1,8 +1,17 @@
 /** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
 
 #include "include/syscall.h"
+#include "include/bonding.hpp"
+#include "include/unix.h"
 #include <algorithm>
 #include <asm-generic/errno-base.h>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/seccomp.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #if __has_include(<libseccomp/seccomp.h>)
 #include <libseccomp/seccomp.h>
@@ -36,18 +45,155 @@ namespace bonding::syscall
     return {};
   }
 
-  std::expected<void, error::Err> Syscall::setup() noexcept
+  uint64_t Syscall::policy() noexcept
+  {
+    /* FNV-1a over the rules */
+    uint64_t   hash = 14695981039346656037ULL;
+    const auto feed = [&hash](const void * data, const size_t size) {
+      for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ static_cast<const uint8_t *>(data)[i]) * 1099511628211ULL;
+    };
+
+    feed(BONDING_VERSION.data(), BONDING_VERSION.size());
+    feed(default_refuse_syscalls.data(), sizeof(default_refuse_syscalls));
+    for (const auto & [syscall, ind, biteq] : default_refuse_if_comp_syscalls)
+      {
+        feed(&syscall, sizeof(syscall));
+        feed(&ind, sizeof(ind));
+        feed(&biteq, sizeof(biteq));
+      }
+
+    return hash;
+  }
+
+  std::string Syscall::cache_path() noexcept
+  {
+    char name[32] = {0};
+    snprintf(name, sizeof(name), "seccomp-%016lx.bpf", policy());
+    return CACHE_DIR + name;
+  }
+
+  uint64_t Syscall::checksum(const void * data, const size_t size) noexcept
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i)
+      hash = (hash ^ static_cast<const uint8_t *>(data)[i]) * 1099511628211ULL;
+
+    return hash;
+  }
+
+  std::expected<void, error::Err> Syscall::compile(const std::string & cache) noexcept
   {
     /* Initialize seccomp profile with all syscalls allowed by default */
     ctx = seccomp_init(SCMP_ACT_ALLOW);
     if (nullptr == ctx)
       return std::unexpected(ERR_MSG(error::Code::Systemcall, "seccomp_init error"));
 
-    refuse_syscall();
-    refuse_if_comp();
+    refuse_syscall().value();
+    refuse_if_comp().value();
+
+    /* Export next to the cache and rename it, a concurrent reader never sees a
+     * partially written filter. */
+    const std::string tmp = cache + "." + std::to_string(getpid());
+    const int         fd = unix::Filesystem::Open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644)
+                     .transform_error([&](const auto & e) {
+      return ERR_MSG(error::Code::Systemcall, "Cannot create " + tmp);
+    }).value();
+
+    /* The program is exported after room for the header, which is written once the
+     * program is read back. */
+    Header header = {MAGIC, policy(), 0};
+    bool   exported = sizeof(header) == write(fd, &header, sizeof(header))
+                    && 0 == seccomp_export_bpf(ctx, fd);
+    seccomp_release(ctx);
+    ctx = nullptr;
+
+    struct stat st = {};
+    if (exported && 0 == fstat(fd, &st))
+      {
+        std::string bpf(st.st_size - sizeof(header), '\0');
+        exported = static_cast<ssize_t>(bpf.size())
+                     == pread(fd, bpf.data(), bpf.size(), sizeof(header));
+
+        header.checksum = checksum(bpf.data(), bpf.size());
+        exported = exported && sizeof(header) == pwrite(fd, &header, sizeof(header), 0);
+      }
+    unix::Filesystem::Close(fd).value();
+
+    if (!exported || -1 == rename(tmp.c_str(), cache.c_str()))
+      {
+        unlink(tmp.c_str());
+        return std::unexpected(ERR_MSG(error::Code::Systemcall, "seccomp_export_bpf error"));
+      }
+
+    LOG_DEBUG << "Compiling seccomp filter to " << cache << "...✓";
+    return {};
+  }
+
+  std::expected<void, error::Err> Syscall::prepare() noexcept
+  {
+    if (!program.empty())
+      return {};
+
+    const std::string cache = cache_path();
+    if (load(cache))
+      return {};
+
+    /* Missing, or replaced by someone else: it is compiled again. */
+    unlink(cache.c_str());
+    unix::Filesystem::Mkdir(CACHE_DIR).value();
+    compile(cache).value();
+
+    if (!load(cache))
+      return std::unexpected(
+        ERR_MSG(error::Code::Systemcall, "Cannot load the seccomp filter cache " + cache));
+
+    return {};
+  }
+
+  bool Syscall::load(const std::string & cache) noexcept
+  {
+    const unix::Fd fd(open(cache.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+    struct stat    st = {};
+    if (!fd || -1 == fstat(fd.get(), &st) || !S_ISREG(st.st_mode) || st.st_uid != geteuid()
+        || 0 != (st.st_mode & (S_IWGRP | S_IWOTH))
+        || st.st_size < static_cast<off_t>(sizeof(Header)))
+      return false;
+
+    std::string bpf(st.st_size, '\0');
+    if (static_cast<ssize_t>(bpf.size()) != pread(fd.get(), bpf.data(), bpf.size(), 0))
+      return false;
+
+    Header header = {};
+    memcpy(&header, bpf.data(), sizeof(header));
+    bpf.erase(0, sizeof(header));
+
+    if (MAGIC != header.magic || policy() != header.policy || bpf.empty()
+        || 0 != bpf.size() % sizeof(sock_filter)
+        || checksum(bpf.data(), bpf.size()) != header.checksum)
+      {
+        LOG_WARNING << "Discarding the seccomp filter cache " << cache;
+        return false;
+      }
+
+    program.resize(bpf.size() / sizeof(sock_filter));
+    std::copy(bpf.begin(), bpf.end(), reinterpret_cast<char *>(program.data()));
+    return true;
+  }
+
+  std::expected<void, error::Err> Syscall::setup() noexcept
+  {
+    if (program.empty())
+      return std::unexpected(ERR_MSG(error::Code::Systemcall, "seccomp filter not prepared"));
+
+    const sock_fprog prog = {static_cast<unsigned short>(program.size()), program.data()};
+
+    /* What seccomp_load() does by default: an unprivileged filter requires it. */
+    if (-1 == prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0))
+      return std::unexpected(ERR_MSG(error::Code::Systemcall, "PR_SET_NO_NEW_PRIVS error"));
 
-    if (0 != seccomp_load(ctx))
-      return std::unexpected(ERR_MSG(error::Code::Systemcall, "seccomp_load error"));
+    if (-1 == prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog))
+      return std::unexpected(ERR_MSG(error::Code::Systemcall, "seccomp filter load error"));
 
     LOG_INFO << "Refusing / Filtering unwanted syscalls...✓";
     return {};
@@ -56,6 +202,7 @@ namespace bonding::syscall
   std::expected<void, error::Err> Syscall::clean() noexcept
   {
     seccomp_release(ctx);
+    ctx = nullptr;
     return {};
   }
 } // namespace bonding::syscall
@@ -3,8 +3,8 @@
 #include "include/unix.h"
 #include <fcntl.h>
 #include <filesystem>
-#include <fstream>
 #include <sys/capability.h>
+#include <sys/stat.h>
 #include <sys/utsname.h>
 #include <unistd.h>
 
@@ -103,27 +103,77 @@ namespace bonding::unix
   {
     constexpr auto read_size = std::size_t(4096);
 
-    auto stream = std::ifstream(path);
-    stream.exceptions(std::ios_base::badbit);
-
-    if (!stream.is_open())
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 == fd)
       return std::unexpected(ERR(error::Code::Unix));
 
-    auto out = std::string();
-    auto buf = std::string(read_size, '\0');
-    while (stream.read(&buf[0], read_size))
-      out.append(buf, 0, stream.gcount());
+    /* Regular files are read with a single allocation, the files of /proc
+     * report a size of 0 and grow as they are read. */
+    struct stat st = {};
+    auto        out = std::string();
+    out.resize(-1 != fstat(fd, &st) && st.st_size > 0 ? st.st_size + 1 : read_size);
+
+    size_t size = 0;
+    for (ssize_t n = 0; (n = read(fd, out.data() + size, out.size() - size)) != 0;)
+      {
+        if (-1 == n)
+          {
+            if (EINTR == errno)
+              continue;
+
+            close(fd);
+            return std::unexpected(ERR(error::Code::Unix));
+          }
+
+        size += n;
+        if (size == out.size())
+          out.resize(out.size() * 2);
+      }
 
-    out.append(buf, 0, stream.gcount());
+    close(fd);
+    out.resize(size);
     return out;
   }
 
   std::expected<void, error::Err>
     Filesystem::Write(const std::string & path, const std::string & s) noexcept
   {
-    int fd = Filesystem::Open(path, O_WRONLY | O_CREAT, 0777).value();
-    Filesystem::Write(fd, s).value();
-    return Filesystem::Close(fd);
+    const Fd fd(open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0777));
+    if (!fd)
+      return std::unexpected(ERR(error::Code::Unix));
+
+    return Filesystem::Write(fd.get(), s);
+  }
+
+  void Fd::reset(const int fd) noexcept
+  {
+    if (-1 != m_fd)
+      close(m_fd);
+
+    m_fd = fd;
+  }
+
+  std::expected<Fd, error::Err> Filesystem::Open_directory(const std::string & path) noexcept
+  {
+    Fd dir(open(path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC));
+    if (!dir)
+      return std::unexpected(ERR(error::Code::Unix));
+
+    return dir;
+  }
+
+  std::expected<void, error::Err> Filesystem::Write_at(
+    const Fd & dir, const std::string & file, const std::string & s) noexcept
+  {
+    const Fd fd(openat(dir.get(), file.c_str(), O_WRONLY | O_CLOEXEC));
+    if (!fd)
+      return std::unexpected(ERR(error::Code::Unix));
+
+    /* A cgroup or /proc file takes the whole value in a single write, or nothing. */
+    if (static_cast<ssize_t>(s.size()) != write(fd.get(), s.c_str(), s.size()))
+      return std::unexpected(ERR(error::Code::Unix));
+
+    return {};
   }
 
 } // namespace bonding::unix
\ No newline at end of file
@@ -0,0 +1,388 @@
+/** Copyright (C) 2023 Muqiu Han <muqiu-han@outlook.com> */
+
+#include "include/unix.h"
+#include "include/environment.h"
+#include "logging.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <memory>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace bonding::unix
+{
+  namespace
+  {
+    /** The io_uring instance of the process, set up on first use and kept. */
+    class Ring
+    {
+    public:
+      /** Nothing when the kernel lacks io_uring or one of the operations of a batch */
+      static Ring * get() noexcept
+      {
+        static Ring           ring;
+        static std::once_flag once;
+        static bool           ready = false;
+
+        std::call_once(once, [&]() {
+          ready = environment::Features::get().io_uring && ring.setup();
+          tried.store(true, std::memory_order_release);
+        });
+
+        return ready && !ring.m_broken ? &ring : nullptr;
+      }
+
+      /** Whether setting up the ring is already paid for, successfully or not */
+      static bool set_up() noexcept { return tried.load(std::memory_order_acquire); }
+
+      io_uring_sqe & sqe(const unsigned index) noexcept
+      {
+        const unsigned slot = index & *m_sq_mask;
+        m_sq_array[slot] = slot;
+
+        io_uring_sqe & sqe = m_sqes[slot];
+        memset(&sqe, 0, sizeof(sqe));
+        return sqe;
+      }
+
+      unsigned tail() const noexcept { return *m_sq_tail; }
+
+      /** Publish the SQEs up to `tail`, submit them and call `complete` on each of
+       ** their completions. */
+      template <typename Complete>
+      bool
+        submit(const unsigned tail, const unsigned count, Complete && complete) noexcept
+      {
+        std::atomic_ref<unsigned>(*m_sq_tail).store(tail, std::memory_order_release);
+
+        for (unsigned submitted = 0, completed = 0; completed < count;)
+          {
+            const long entered = ::syscall(
+              SYS_io_uring_enter,
+              m_fd,
+              count - submitted,
+              1,
+              IORING_ENTER_GETEVENTS,
+              nullptr,
+              0);
+
+            /* The completions left would be taken for those of the next batch. */
+            if (-1 == entered && EINTR != errno)
+              {
+                m_broken = true;
+                return false;
+              }
+
+            if (0 < entered)
+              submitted += entered;
+
+            std::atomic_ref<unsigned> cq_head(*m_cq_head);
+            const unsigned cq_tail =
+              std::atomic_ref<unsigned>(*m_cq_tail).load(std::memory_order_acquire);
+
+            unsigned head = cq_head.load(std::memory_order_relaxed);
+            for (; head != cq_tail; ++head, ++completed)
+              complete(m_cqes[head & *m_cq_mask]);
+
+            cq_head.store(head, std::memory_order_release);
+          }
+
+        return true;
+      }
+
+      unsigned entries() const noexcept { return m_entries; }
+
+      std::mutex lock;
+
+      /** The direct descriptors, one per chain of a submission */
+      inline static const unsigned SLOTS = 64;
+
+    private:
+      bool setup() noexcept
+      {
+        io_uring_params params = {};
+        m_fd = static_cast<int>(::syscall(SYS_io_uring_setup, ENTRIES, &params));
+        if (-1 == m_fd)
+          return false;
+
+        /* Every operation of a batch, and the direct descriptors they are chained by. */
+        const auto probe = std::make_unique<char[]>(
+          sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+        auto * ops = reinterpret_cast<io_uring_probe *>(probe.get());
+        memset(ops, 0, sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+
+        if (0 != ::syscall(SYS_io_uring_register, m_fd, IORING_REGISTER_PROBE, ops, 256))
+          return false;
+
+        for (const int op :
+             {IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_MKDIRAT})
+          if (ops->last_op < op || 0 == (ops->ops[op].flags & IO_URING_OP_SUPPORTED))
+            return false;
+
+        io_uring_rsrc_register files = {
+          .nr = SLOTS, .flags = IORING_RSRC_REGISTER_SPARSE, .resv2 = 0, .data = 0, .tags = 0};
+        if (0 != ::syscall(
+              SYS_io_uring_register, m_fd, IORING_REGISTER_FILES2, &files, sizeof(files)))
+          return false;
+
+        const size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        const size_t cq_size =
+          params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool   single = 0 != (params.features & IORING_FEAT_SINGLE_MMAP);
+
+        auto * sq = static_cast<char *>(
+          map(single ? std::max(sq_size, cq_size) : sq_size, IORING_OFF_SQ_RING));
+        auto * cq = single ? sq : static_cast<char *>(map(cq_size, IORING_OFF_CQ_RING));
+        m_sqes = static_cast<io_uring_sqe *>(
+          map(params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+        if (nullptr == sq || nullptr == cq || nullptr == m_sqes)
+          return false;
+
+        m_sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        m_sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        m_sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        m_cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        m_cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        m_entries = params.sq_entries;
+
+        LOG_DEBUG << "Setting up io_uring for the setup I/O...✓";
+        return true;
+      }
+
+      void * map(const size_t size, const off_t offset) const noexcept
+      {
+        void * map = mmap(
+          nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+        return MAP_FAILED == map ? nullptr : map;
+      }
+
+    private:
+      int            m_fd = -1;
+      bool           m_broken = false;
+      unsigned       m_entries = 0;
+      unsigned *     m_sq_tail = nullptr;
+      unsigned *     m_sq_mask = nullptr;
+      unsigned *     m_sq_array = nullptr;
+      io_uring_sqe * m_sqes = nullptr;
+      unsigned *     m_cq_head = nullptr;
+      unsigned *     m_cq_tail = nullptr;
+      unsigned *     m_cq_mask = nullptr;
+      io_uring_cqe * m_cqes = nullptr;
+
+      inline static std::atomic<bool> tried{false};
+
+      inline static const unsigned ENTRIES = 128;
+    };
+
+    /** The SQEs of an operation: mkdirat, or openat + write + close */
+    unsigned sqes_of(const bool write) noexcept { return write ? 3 : 1; }
+  } // namespace
+
+  void Batch::chain() noexcept
+  {
+    if (!m_ops.empty() && m_ops.back().chain == m_chain)
+      ++m_chain;
+  }
+
+  void Batch::mkdir(const Fd & dir, const std::string & path, const mode_t mode) noexcept
+  {
+    m_ops.push_back(Op{
+      .kind = Op::Kind::Mkdir,
+      .dir = dir.get(),
+      .path = path,
+      .value = {},
+      .mode = mode,
+      .chain = m_chain,
+      .result = 0,
+      .done = false});
+  }
+
+  void Batch::write(
+    const Fd & dir, const std::string & path, const std::string & value) noexcept
+  {
+    m_ops.push_back(Op{
+      .kind = Op::Kind::Write,
+      .dir = dir.get(),
+      .path = path,
+      .value = value,
+      .mode = 0,
+      .chain = m_chain,
+      .result = 0,
+      .done = false});
+  }
+
+  bool Batch::submit_ring() noexcept
+  {
+    if (m_ops.size() < MIN_RING_OPS && !Ring::set_up())
+      return false;
+
+    Ring * ring = Ring::get();
+    if (nullptr == ring)
+      return false;
+
+    std::lock_guard<std::mutex> guard(ring->lock);
+
+    /* A chain is submitted whole, through one direct descriptor. */
+    for (size_t begin = 0, sqes = 0; begin < m_ops.size(); ++begin)
+      {
+        sqes = (0 != begin && m_ops[begin].chain == m_ops[begin - 1].chain) ? sqes : 0;
+        sqes += sqes_of(Op::Kind::Write == m_ops[begin].kind);
+        if (sqes > ring->entries())
+          return false;
+      }
+
+    for (size_t begin = 0; begin < m_ops.size();)
+      {
+        /* As many whole chains as the ring and the direct descriptors take */
+        size_t   end = begin;
+        unsigned count = 0;
+        unsigned chains = 0;
+        while (end < m_ops.size() && chains < Ring::SLOTS)
+          {
+            size_t   last = end;
+            unsigned size = 0;
+            for (; last < m_ops.size() && m_ops[last].chain == m_ops[end].chain; ++last)
+              size += sqes_of(Op::Kind::Write == m_ops[last].kind);
+
+            if (count + size > ring->entries())
+              break;
+
+            count += size;
+            ++chains;
+            end = last;
+          }
+
+        unsigned tail = ring->tail();
+        unsigned slot = 0;
+        for (size_t i = begin; i < end; ++i)
+          {
+            Op &       op = m_ops[i];
+            const bool last = i + 1 == end || m_ops[i + 1].chain != op.chain;
+            const auto path = reinterpret_cast<uint64_t>(op.path.c_str());
+            const auto data = static_cast<uint64_t>(i) << 2;
+
+            /* Hard links: a failure does not cancel the rest of the chain, the direct
+             * descriptor is closed whatever happened to the write. */
+            if (Op::Kind::Mkdir == op.kind)
+              {
+                io_uring_sqe & mkdir = ring->sqe(tail++);
+                mkdir.opcode = IORING_OP_MKDIRAT;
+                mkdir.fd = op.dir;
+                mkdir.addr = path;
+                mkdir.len = op.mode;
+                mkdir.user_data = data;
+                mkdir.flags = last ? 0 : IOSQE_IO_HARDLINK;
+              }
+            else
+              {
+                io_uring_sqe & open = ring->sqe(tail++);
+                open.opcode = IORING_OP_OPENAT;
+                open.fd = op.dir;
+                open.addr = path;
+                open.open_flags = O_WRONLY;
+                open.file_index = slot + 1;
+                open.user_data = data;
+                open.flags = IOSQE_IO_HARDLINK;
+
+                io_uring_sqe & write = ring->sqe(tail++);
+                write.opcode = IORING_OP_WRITE;
+                write.fd = static_cast<int>(slot);
+                write.addr = reinterpret_cast<uint64_t>(op.value.data());
+                write.len = op.value.size();
+                write.user_data = data | 1;
+                write.flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+
+                io_uring_sqe & close = ring->sqe(tail++);
+                close.opcode = IORING_OP_CLOSE;
+                close.file_index = slot + 1;
+                close.user_data = data | 2;
+                close.flags = last ? 0 : IOSQE_IO_HARDLINK;
+              }
+
+            if (last)
+              ++slot;
+          }
+
+        const bool submitted = ring->submit(tail, count, [&](const io_uring_cqe & cqe) {
+          Op &      op = m_ops[cqe.user_data >> 2];
+          const int step = static_cast<int>(cqe.user_data & 3);
+
+          /* A short write of a cgroup or /proc file set nothing. */
+          const bool short_write = Op::Kind::Write == op.kind && 1 == step && 0 <= cqe.res
+                                   && static_cast<size_t>(cqe.res) != op.value.size();
+          const int  result = short_write ? -EIO : std::min(cqe.res, 0);
+
+          if (0 == op.result && !(Op::Kind::Mkdir == op.kind && -EEXIST == result))
+            op.result = result;
+
+          /* The write settles the operation, the close only releases the slot. */
+          op.done = op.done || Op::Kind::Mkdir == op.kind || 1 == step;
+        });
+
+        /* The ring is unusable, the chains left go through the system calls. */
+        if (!submitted)
+          return false;
+
+        begin = end;
+      }
+
+    return true;
+  }
+
+  void Batch::submit_sync() noexcept
+  {
+    /* An operation the ring left halfway is executed again from its start. */
+    for (auto & op : m_ops)
+      {
+        if (op.done)
+          continue;
+
+        op.result = 0;
+
+        if (Op::Kind::Mkdir == op.kind)
+          {
+            if (-1 == mkdirat(op.dir, op.path.c_str(), op.mode) && EEXIST != errno)
+              op.result = -errno;
+
+            continue;
+          }
+
+        const Fd fd(openat(op.dir, op.path.c_str(), O_WRONLY | O_CLOEXEC));
+        if (!fd)
+          op.result = -errno;
+        else if (static_cast<ssize_t>(op.value.size())
+                 != ::write(fd.get(), op.value.data(), op.value.size()))
+          op.result = -EIO;
+      }
+  }
+
+  std::expected<void, error::Err> Batch::submit() noexcept
+  {
+    if (!submit_ring())
+      submit_sync();
+
+    std::expected<void, error::Err> result = {};
+    for (const auto & op : m_ops)
+      if (0 != op.result)
+        {
+          result = std::unexpected(ERR_MSG(
+            error::Code::Unix,
+            (Op::Kind::Mkdir == op.kind ? "Cannot create " : "Cannot write ") + op.path
+              + ": " + strerror(-op.result)));
+          break;
+        }
+
+    m_ops.clear();
+    m_chain = 0;
+    return result;
+  }
+} // namespace bonding::unix
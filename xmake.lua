@@ -7,7 +7,7 @@ includes("src/**/xmake.lua")
 add_rules("mode.debug", "mode.release")
 add_rules("plugin.compile_commands.autoupdate", {outputdir = "."})
 
-add_requires("nlohmann_json", "libcap", "libseccomp", "plog")
+add_requires("nlohmann_json", "libcap", "libseccomp", "plog", "zlib")
 
 package("libseccomp")
     set_sourcedir(path.join(os.scriptdir(), "3rd/libseccomp"))
@@ -25,5 +25,5 @@ target("bonding")
     set_optimize("smallest")
     set_warnings("all", "error")
     add_files("src/*.cpp")
-    add_packages("nlohmann_json", "libcap", "libseccomp", "plog")
+    add_packages("nlohmann_json", "libcap", "libseccomp", "plog", "zlib")
     add_deps("logging")
\ No newline at end of file